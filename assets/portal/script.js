@@ -0,0 +1,30 @@
+function toggleDisplay(className, checked) {
+  for (const el of document.getElementsByClassName(className)) {
+    if (checked === true) {
+      el.style.display = 'block';
+    } else if (checked === false) {
+      el.style.display = 'none';
+    }
+  }
+}
+document.querySelector("input[name='wifi']").addEventListener('change', ev => toggleDisplay('wifi', ev.currentTarget.checked));
+document.querySelector("input[name='iop']").addEventListener('change', ev => toggleDisplay('iop', ev.currentTarget.checked));
+for (const el of document.getElementsByClassName('wifi')) {
+  toggleDisplay('wifi', el.checked);
+}
+for (const el of document.getElementsByClassName('iop')) {
+  toggleDisplay('iop', el.checked);
+}
+function loadNetworks() {
+  fetch('/networks').then(response => response.json()).then(networks => {
+    const list = document.getElementById('networks');
+    list.replaceChildren(...networks.map(network => {
+      const option = document.createElement('option');
+      option.value = network.ssid;
+      option.label = network.ssid + ' (' + network.rssi + ' dBm' + (network.secure ? ', protected' : '') + ')';
+      return option;
+    }));
+  }).catch(() => {});
+}
+loadNetworks();
+setInterval(loadNetworks, 15000);
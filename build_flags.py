@@ -1,3 +1,8 @@
+import inspect
+import os
+import sys
+import time
+
 global_env = DefaultEnvironment()
 global_env.Append(
     CPPDEFINES=[
@@ -9,4 +14,16 @@ global_env.Append(
         ("PIO_FRAMEWORK_ARDUINO_MMU_CACHE16_IRAM48_SECHEAP_SHARED", 1),
     ]
 )
-global_env.Append(CXXFLAGS=["-std=c++17"])
\ No newline at end of file
+global_env.Append(CXXFLAGS=["-std=c++17"])
+
+# The firmware's identity must change with the user code, not only when the library is compiled. The link time
+# becomes the address of `iop_build_stamp`, so only the link step sees a different command
+if global_env.get("PIOPLATFORM", "").startswith("espressif"):
+    global_env.Append(LINKFLAGS=["-Wl,--defsym=iop_build_stamp=%d" % int(time.time())])
+
+# SCons doesn't define __file__, regenerates the captive portal assets if they changed
+library_dir = os.path.dirname(os.path.realpath(inspect.getframeinfo(inspect.currentframe()).filename))
+sys.path.insert(0, os.path.join(library_dir, "tools"))
+import portal
+if portal.generate():
+    print("Regenerated captive portal assets")
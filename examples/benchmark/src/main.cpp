@@ -0,0 +1,279 @@
+#include "iop/loop.hpp"
+#include "iop/compression.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifndef BENCH_MIN_MILLIS
+#define BENCH_MIN_MILLIS 200
+#endif
+
+/// Keeps the compiler from optimizing away the benchmarked work
+template <typename T>
+static auto doNotOptimize(T const &value) noexcept -> void {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/// Runs `op` in batches until `BENCH_MIN_MILLIS` passed, then prints one JSON line
+template <typename F>
+static auto bench(const char *name, F op) noexcept -> void {
+  using clock = std::chrono::steady_clock;
+
+  // Warm up, first calls may allocate lazily initialized state
+  for (uint32_t index = 0; index < 100; ++index) op();
+
+  uint64_t iterations = 0;
+  uint64_t batch = 64;
+  // IOP_HEAP_TRACKING counts every allocation, they matter as much as time in the devices
+  const auto heapBefore = iop::heap::total();
+  const auto start = clock::now();
+  auto elapsed = clock::duration::zero();
+  while (elapsed < std::chrono::milliseconds(BENCH_MIN_MILLIS)) {
+    for (uint64_t index = 0; index < batch; ++index) op();
+    iterations += batch;
+    batch *= 2;
+    elapsed = clock::now() - start;
+  }
+
+  const auto nanos = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  const auto ops = static_cast<double>(iterations);
+  std::printf("{\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, \"allocations_per_op\": %.3f, \"allocated_bytes_per_op\": %.1f}\n",
+              name, static_cast<unsigned long long>(iterations), nanos / ops,
+              static_cast<double>(iop::heap::total().allocations - heapBefore.allocations) / ops,
+              static_cast<double>(iop::heap::total().bytes - heapBefore.bytes) / ops);
+  std::fflush(stdout);
+}
+
+static const char *fieldNames[] = {
+  "field00", "field01", "field02", "field03", "field04", "field05", "field06", "field07",
+  "field08", "field09", "field10", "field11", "field12", "field13", "field14", "field15",
+};
+
+static auto benchJson(iop::EventLoop &loop) noexcept -> void {
+  for (const size_t fields: {1, 4, 16}) {
+    const auto name = std::string("api_make_json_") + std::to_string(fields) + "_fields";
+    bench(name.c_str(), [&loop, fields]() {
+      const auto json = loop.api().makeJson(IOP_FUNC, [fields](JsonDocument &doc) {
+        for (size_t index = 0; index < fields; ++index) doc[fieldNames[index]] = 12.345 + static_cast<double>(index);
+      });
+      doNotOptimize(json);
+    });
+  }
+}
+
+static auto benchStorage(iop::EventLoop &loop) noexcept -> void {
+  iop::AuthToken first, second;
+  first.fill('a');
+  second.fill('b');
+  loop.storage().setToken(first);
+  bench("storage_token_read", [&loop]() { doNotOptimize(loop.storage().token()); });
+
+  // Alternates, as writing the same token is skipped
+  bool flip = false;
+  bench("storage_token_write", [&loop, &first, &second, &flip]() {
+    flip = !flip;
+    doNotOptimize(loop.storage().setToken(flip ? first : second));
+  });
+
+  iop::NetworkName ssid;
+  iop::NetworkPassword psk1, psk2;
+  ssid.fill('\0');
+  psk1.fill('\0');
+  psk2.fill('\0');
+  memcpy(ssid.data(), "benchmark", 9);
+  memcpy(psk1.data(), "password1", 9);
+  memcpy(psk2.data(), "password2", 9);
+  loop.storage().setWifi(iop::WifiCredentials(ssid, psk1));
+  bench("storage_wifi_read", [&loop]() { doNotOptimize(loop.storage().wifi()); });
+  bench("storage_wifi_write", [&loop, &ssid, &psk1, &psk2, &flip]() {
+    flip = !flip;
+    doNotOptimize(loop.storage().setWifi(iop::WifiCredentials(ssid, flip ? psk1 : psk2)));
+  });
+}
+
+static auto benchInterrupts() noexcept -> void {
+  bench("interrupt_schedule_deschedule", []() {
+    iop::scheduleInterrupt(iop::InterruptEvent::USER, 1, 2);
+    doNotOptimize(iop::descheduleInterrupt());
+  });
+  bench("interrupt_deschedule_empty", []() { doNotOptimize(iop::descheduleInterrupt()); });
+}
+
+static auto benchStrings() noexcept -> void {
+  const auto printable = std::string("[INFO] LOOP: a common log line, printable from start to end");
+  auto unprintable = printable;
+  unprintable[unprintable.size() / 2] = '\x01';
+
+  bench("is_all_printable", [&printable]() { doNotOptimize(iop::isAllPrintable(printable)); });
+  bench("scape_non_printable_clean", [&printable]() { doNotOptimize(iop::scapeNonPrintable(printable)); });
+  bench("scape_non_printable_dirty", [&unprintable]() { doNotOptimize(iop::scapeNonPrintable(unprintable)); });
+}
+
+static auto benchLog() noexcept -> void {
+  // Goes through the network logging hook, without a monitor server the upload fails fast
+  iop::Log logger(IOP_STR("BENCH"));
+  const auto view = std::string_view("a common log line, printable from start to end");
+  bench("log_hook_view", [&logger, view]() { logger.infoln(view); });
+  bench("log_hook_static", [&logger]() { logger.infoln(IOP_STR("a common log line, printable from start to end")); });
+}
+
+static auto benchTasks() noexcept -> void {
+  // Virtual time, so every task is due at every dispatch
+  iop::clock::useVirtualTime();
+
+  for (const size_t tasks: {1, 8, 32}) {
+    iop::EventLoop taskLoop(IOP_STR("http://127.0.0.1:4001"));
+    uint64_t calls = 0;
+    for (size_t index = 0; index < tasks; ++index) {
+      taskLoop.setInterval(0, [&calls](iop::EventLoop &) { calls++; });
+    }
+
+    const auto name = std::string("run_unauthenticated_tasks_") + std::to_string(tasks);
+    bench(name.c_str(), [&taskLoop]() { taskLoop.runUnauthenticatedTasks(); });
+    doNotOptimize(calls);
+  }
+
+  iop::clock::useRealTime();
+}
+
+IOP_EVENT_FIELD(air_temperature_celsius, float);
+IOP_EVENT_FIELD(air_humidity_percentage, float);
+IOP_EVENT_FIELD(soil_resistivity, uint16_t);
+IOP_EVENT_FIELD(light, bool);
+using Greenhouse = iop::Event<air_temperature_celsius, air_humidity_percentage, soil_resistivity, light>;
+
+struct GreenhouseSample {
+  iop::time::milliseconds uptime;
+  Greenhouse event;
+};
+
+/// A day sampled every minute: diurnal temperature and humidity at the sensors' resolution with noise,
+/// soil drying out between waterings and lights on for 16 hours
+static auto greenhouseTrace() noexcept -> std::vector<GreenhouseSample> {
+  std::mt19937 random(42);
+  std::normal_distribution<float> noise(0, 0.15f);
+  std::vector<GreenhouseSample> trace;
+  auto uptime = static_cast<iop::time::milliseconds>(5000);
+  uint16_t soil = 400;
+  for (uint32_t minute = 0; minute < 24 * 60; ++minute) {
+    const auto day = std::sin(static_cast<float>(minute) / (24 * 60) * 2 * static_cast<float>(M_PI));
+    const auto temperature = std::round((24 + 4 * day + noise(random)) * 10) / 10;
+    const auto humidity = std::round((65 - 10 * day + noise(random) * 3) * 10) / 10;
+    soil = minute % 360 == 0 ? 400 : static_cast<uint16_t>(soil + (random() % 4 == 0));
+    trace.push_back({ uptime, Greenhouse(air_temperature_celsius { temperature }, air_humidity_percentage { humidity }, soil_resistivity { soil }, light { minute >= 6 * 60 && minute < 22 * 60 }) });
+    // The loop is busy sometimes, so intervals aren't exact
+    uptime += 60000 + random() % 5;
+  }
+  return trace;
+}
+
+static auto benchSeries() noexcept -> void {
+  const auto trace = greenhouseTrace();
+  static iop::TimeSeries<air_temperature_celsius, air_humidity_percentage, soil_resistivity, light> series;
+  static decltype(series)::Buffer buffer;
+
+  // Compression ratio against sending each sample as its own JSON event, a full series at a time
+  size_t samples = 0, seriesBytes = 0, jsonBytes = 0;
+  for (const auto &sample: trace) {
+    if (!series.append(sample.uptime, sample.event)) {
+      seriesBytes += series.serialize(buffer, sample.uptime).length();
+      series.clear();
+      series.append(sample.uptime, sample.event);
+    }
+    Greenhouse::Buffer json;
+    jsonBytes += sample.event.serialize(json).length();
+    samples += 1;
+  }
+  seriesBytes += series.serialize(buffer, trace.back().uptime).length();
+  series.clear();
+
+  std::printf("{\"name\": \"series_compression_greenhouse\", \"samples\": %zu, \"series_bytes\": %zu, \"json_bytes\": %zu, \"bytes_per_sample\": %.2f, \"compression_ratio\": %.2f}\n",
+              samples, seriesBytes, jsonBytes, static_cast<double>(seriesBytes) / static_cast<double>(samples),
+              static_cast<double>(jsonBytes) / static_cast<double>(seriesBytes));
+
+  size_t index = 0;
+  bench("series_append_greenhouse", [&trace, &index]() {
+    const auto &sample = trace[index++ % trace.size()];
+    if (!series.append(sample.uptime, sample.event)) series.clear();
+  });
+  series.clear();
+  for (index = 0; index < trace.size() && series.append(trace[index].uptime, trace[index].event); ++index) {}
+  bench("series_serialize_full", []() { doNotOptimize(series.serialize(buffer, 0)); });
+}
+
+// Rough ESP8266 figures to estimate the energy saved by compressing: transmitting at ~170mA and 3.3V with ~1Mbps
+// of effective throughput, computing at ~80mA, and being ~40 times slower than a desktop core
+#ifndef BENCH_RADIO_NJ_PER_BYTE
+#define BENCH_RADIO_NJ_PER_BYTE 4500.0
+#endif
+#ifndef BENCH_CPU_NJ_PER_NS
+#define BENCH_CPU_NJ_PER_NS 0.26
+#endif
+#ifndef BENCH_DEVICE_SLOWDOWN
+#define BENCH_DEVICE_SLOWDOWN 40.0
+#endif
+
+/// What the network logger sends: a batch of the framework's usual lines, with some varying numbers
+static auto logCorpus() noexcept -> std::string {
+  std::mt19937 random(7);
+  const char *lines[] = {
+    "[INFO] LOOP: Trying hardcoded iop credentials\n",
+    "[INFO] API: Send event\n",
+    "[INFO] LOOP: Connecting to WiFi\n",
+    "[WARN] LOOP: Interrupt queue was full, interrupts dropped since boot: %u\n",
+    "[INFO] SENSORS: air_temperature_celsius=%u.%u air_humidity_percentage=%u.%u\n",
+    "[ERROR] API: Unexpected response at Api::registerEvent: %u\n",
+    "[INFO] LOOP: Time synced: %u:%u\n",
+  };
+  std::string corpus;
+  while (corpus.size() < 900) {
+    char line[128];
+    std::snprintf(line, sizeof(line), lines[random() % 7], random() % 100, random() % 10, random() % 100, random() % 10);
+    corpus += line;
+  }
+  return corpus;
+}
+
+static auto benchCompression() noexcept -> void {
+  const auto logs = logCorpus();
+  const auto event = std::string("{\"air_temperature_celsius\":21.5,\"air_humidity_percentage\":60.2,\"soil_resistivity\":612,\"soil_temperature_celsius\":19.75,\"light\":true}");
+
+  static std::array<uint8_t, IOP_COMPRESSION_BUFFER> output;
+  for (const auto &[name, body]: { std::make_pair("logs", &logs), std::make_pair("event", &event) }) {
+    const auto deflated = iop::compression::deflate(*body, output.data(), output.size());
+    if (!deflated) continue;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t index = 0; index < 1000; ++index) doNotOptimize(iop::compression::deflate(*body, output.data(), output.size()));
+    const auto nanos = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()) / 1000;
+
+    const auto saved = static_cast<double>(body->size()) - static_cast<double>(*deflated);
+    const auto energy = saved * BENCH_RADIO_NJ_PER_BYTE - nanos * BENCH_DEVICE_SLOWDOWN * BENCH_CPU_NJ_PER_NS;
+    std::printf("{\"name\": \"deflate_%s\", \"plain_bytes\": %zu, \"deflated_bytes\": %zu, \"compression_ratio\": %.2f, \"native_ns\": %.0f, \"ram_bytes\": %zu, \"estimated_device_uj_saved\": %.1f}\n",
+                name, body->size(), *deflated, static_cast<double>(body->size()) / static_cast<double>(*deflated), nanos,
+                static_cast<size_t>(IOP_COMPRESSION_BUFFER + IOP_COMPRESSION_HASH_ENTRIES * 2), energy / 1000);
+  }
+
+  bench("deflate_logs_throughput", [&logs]() { doNotOptimize(iop::compression::deflate(logs, output.data(), output.size())); });
+}
+
+namespace iop {
+auto setup(EventLoop &loop) noexcept -> void {
+  benchJson(loop);
+  benchStorage(loop);
+  benchInterrupts();
+  benchStrings();
+  benchTasks();
+  benchSeries();
+  benchCompression();
+  // Last, as it might write to stdout
+  benchLog();
+  std::exit(0);
+}
+}
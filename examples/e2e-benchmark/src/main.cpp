@@ -0,0 +1,179 @@
+#include "iop/loop.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+
+#ifndef BENCH_EVENTS
+#define BENCH_EVENTS 1000
+#endif
+
+#ifndef BENCH_LOGS
+#define BENCH_LOGS 1000
+#endif
+
+/// How long the loop runs with an actuator and uploads competing, to measure the actuation jitter
+#ifndef BENCH_JITTER_MILLIS
+#define BENCH_JITTER_MILLIS 10000
+#endif
+
+#ifndef BENCH_ACTUATOR_INTERVAL
+#define BENCH_ACTUATOR_INTERVAL 100
+#endif
+
+/// Client side measurements of one endpoint
+struct Endpoint {
+  const char *name;
+  std::vector<double> latencies; // Microseconds
+  uint64_t errors = 0;
+  uint64_t bytes = 0;
+  uint64_t allocations = 0;
+
+  explicit Endpoint(const char *name) noexcept: name(name) {}
+
+  template <typename F>
+  auto measure(const size_t bytes, F request) noexcept -> void {
+    // IOP_HEAP_TRACKING counts every allocation
+    const auto allocationsBefore = iop::heap::total().allocations;
+    const auto start = std::chrono::steady_clock::now();
+    const auto ok = request();
+    const auto end = std::chrono::steady_clock::now();
+    this->allocations += iop::heap::total().allocations - allocationsBefore;
+    this->latencies.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+    this->bytes += bytes;
+    if (!ok) this->errors++;
+  }
+
+  auto print(const bool last) noexcept -> void {
+    std::sort(this->latencies.begin(), this->latencies.end());
+    const auto count = this->latencies.size();
+    double total = 0;
+    for (const auto latency: this->latencies) total += latency;
+    const auto percentile = [this, count](const double fraction) {
+      return count ? this->latencies[std::min(count - 1, static_cast<size_t>(fraction * static_cast<double>(count)))] : 0.0;
+    };
+
+    std::printf("  \"%s\": {\"requests\": %zu, \"errors\": %llu, \"requests_per_sec\": %.2f, \"bytes\": %llu, \"allocations_per_request\": %.2f, \"p50_us\": %.1f, \"p99_us\": %.1f}%s\n",
+                this->name, count, static_cast<unsigned long long>(this->errors),
+                total > 0 ? static_cast<double>(count) * 1e6 / total : 0.0,
+                static_cast<unsigned long long>(this->bytes),
+                count ? static_cast<double>(this->allocations) / static_cast<double>(count) : 0.0,
+                percentile(0.50), percentile(0.99), last ? "" : ",");
+  }
+};
+
+/// Actuator that should toggle every `BENCH_ACTUATOR_INTERVAL`, measures how late each toggle was
+struct Actuator {
+  iop::Summary lateness;
+  std::optional<std::chrono::steady_clock::time_point> last;
+
+  auto toggle() noexcept -> void {
+    const auto now = std::chrono::steady_clock::now();
+    if (this->last) {
+      const auto elapsed = std::chrono::duration<double, std::milli>(now - *this->last).count();
+      this->lateness.add(std::max(0.0, elapsed - BENCH_ACTUATOR_INTERVAL));
+    }
+    this->last = now;
+  }
+
+  auto print(const char *name, const bool last) const noexcept -> void {
+    std::printf("    \"%s\": {\"toggles\": %u, \"mean_late_ms\": %.2f, \"stddev_late_ms\": %.2f, \"max_late_ms\": %.2f}%s\n",
+                name, this->lateness.count, this->lateness.mean, std::sqrt(this->lateness.variance()), this->lateness.max, last ? "" : ",");
+  }
+};
+
+/// The same actuator as a critical and as a normal task, while uploads keep the network busy.
+///
+/// It's driven by the platform's loop after `iop::setup` returns, like a real firmware, so it lives as long as the tasks that use it
+struct Jitter {
+  Actuator critical;
+  Actuator normal;
+  std::optional<std::chrono::steady_clock::time_point> end;
+};
+
+static Jitter jitter;
+
+static auto measureJitter(iop::EventLoop &loop) noexcept -> void {
+  loop.setInterval(BENCH_ACTUATOR_INTERVAL, [](iop::EventLoop &) { jitter.critical.toggle(); }, iop::Priority::CRITICAL);
+  loop.setInterval(BENCH_ACTUATOR_INTERVAL, [](iop::EventLoop &) { jitter.normal.toggle(); });
+  for (uint8_t index = 0; index < 3; ++index) {
+    loop.setAuthenticatedInterval(0, [](iop::EventLoop &loop, const iop::AuthToken &token) {
+      loop.registerEvent(token, std::string_view("{\"air_temperature_celsius\":21.5,\"air_humidity_percentage\":60}"));
+    }, iop::Priority::LOW);
+  }
+
+  // The first run starts the measurement, so it doesn't include the setup
+  loop.setInterval(BENCH_ACTUATOR_INTERVAL, [](iop::EventLoop &) {
+    const auto now = std::chrono::steady_clock::now();
+    if (!jitter.end) {
+      jitter.end = now + std::chrono::milliseconds(BENCH_JITTER_MILLIS);
+      return;
+    }
+    if (now < *jitter.end) return;
+
+    std::printf("  \"actuation_jitter\": {\n");
+    jitter.critical.print("critical", false);
+    jitter.normal.print("normal", true);
+    std::printf("  }\n");
+    std::printf("}\n");
+    std::exit(0);
+  });
+}
+
+namespace iop {
+auto setup(EventLoop &loop) noexcept -> void {
+  Endpoint login("/v1/user/login"), event("/v1/event"), log("/v1/log"), update("/v1/update");
+
+  iop::Box<AuthToken> token;
+  login.measure(0, [&loop, &token]() {
+    auto result = loop.api().authenticate("benchmark", "benchmark@example.com", "benchmark");
+    if (auto *authToken = std::get_if<iop::Box<AuthToken>>(&result)) token = std::move(*authToken);
+    return token != nullptr;
+  });
+  if (!token) {
+    std::fprintf(stderr, "Unable to authenticate, is tools/monitor_server.py running?\n");
+    std::exit(1);
+  }
+  loop.storage().setToken(*token);
+
+  for (uint32_t index = 0; index < BENCH_EVENTS; ++index) {
+    const auto json = loop.api().makeJson(IOP_FUNC, [index](JsonDocument &doc) {
+      doc["air_temperature_celsius"] = 20.0 + static_cast<double>(index % 100) / 10;
+      doc["air_humidity_percentage"] = 50.0 + static_cast<double>(index % 50) / 10;
+      doc["soil_temperature_celsius"] = 18.5;
+      doc["soil_resistivity_raw"] = 600 + index % 300;
+    });
+    iop_assert(json, IOP_STR("Benchmark event doesn't fit IOP_JSON_CAPACITY"));
+    event.measure(strlen(json->data()), [&loop, &token, &json]() {
+      return loop.api().registerEvent(*token, json) == iop::NetworkStatus::OK;
+    });
+  }
+
+  const auto message = std::string("[INFO] LOOP: Benchmarking the log route, this line has the size of a common log line\n");
+  for (uint32_t index = 0; index < BENCH_LOGS; ++index) {
+    log.measure(message.size(), [&loop, &token, &message]() {
+      return loop.api().registerLog(*token, message) == iop::NetworkStatus::OK;
+    });
+  }
+
+  // Without --firmware in the stand-in there is no update, so this measures the check
+  update.measure(0, [&loop, &token]() {
+    return loop.api().update(*token) == iop_hal::UpdateStatus::NO_UPGRADE;
+  });
+
+  std::printf("{\n");
+  login.print(false);
+  event.print(false);
+  log.print(false);
+  update.print(false);
+  // The report is finished by the jitter measurement, once the loop ran for BENCH_JITTER_MILLIS
+  measureJitter(loop);
+}
+}
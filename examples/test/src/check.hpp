@@ -0,0 +1,44 @@
+#ifndef IOP_TEST_CHECK_HPP
+#define IOP_TEST_CHECK_HPP
+
+#include "iop/loop.hpp"
+
+/// Counts the check, printing it if it failed. Doesn't stop the test
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+auto check(bool ok, const char *expression, const char *file, int line) noexcept -> bool;
+
+/// Authenticates against the monitor server stand-in, exits if it isn't running
+auto authenticate(iop::EventLoop &loop) noexcept -> iop::Box<iop::AuthToken>;
+
+/// Asks the monitor server stand-in what it received, or changes how it answers. `path` is one of its test routes, like `/stats`
+auto inspectServer(iop::StaticString path, JsonDocument &doc) noexcept -> bool;
+
+/// Simulated device for the tests that drive an event loop, with its own storage and virtual clock.
+///
+/// `iop::setup` runs for it too, only the default loop runs the suites. It must not be moved
+struct Device {
+  iop::VirtualClock clock;
+  iop::EventLoop loop;
+
+  /// Authenticated against the monitor server stand-in, unless `authenticated` is false
+  explicit Device(bool authenticated = true) noexcept;
+  /// Talks to `uri` instead of the stand-in, like an unreachable server
+  Device(bool authenticated, iop::StaticString uri) noexcept;
+  /// Iterates until `duration` of virtual time passed, moving the clock `step` after each iteration
+  auto run(iop::time::milliseconds duration, iop::time::milliseconds step = 10) noexcept -> void;
+};
+
+auto testCrashReport(iop::EventLoop &loop) noexcept -> void;
+auto testPanicSchedule(iop::EventLoop &loop) noexcept -> void;
+auto testInterrupts(iop::EventLoop &loop) noexcept -> void;
+auto testWifiStats(iop::EventLoop &loop) noexcept -> void;
+auto testSteadyState(iop::EventLoop &loop) noexcept -> void;
+auto testSeries(iop::EventLoop &loop) noexcept -> void;
+auto testPendingUpgrade(iop::EventLoop &loop) noexcept -> void;
+auto testDeadband(iop::EventLoop &loop) noexcept -> void;
+auto testSplitTasks(iop::EventLoop &loop) noexcept -> void;
+auto testDeadlineMisses(iop::EventLoop &loop) noexcept -> void;
+auto testCompression(iop::EventLoop &loop) noexcept -> void;
+auto testRadioOff(iop::EventLoop &loop) noexcept -> void;
+#endif
@@ -0,0 +1,118 @@
+#include "check.hpp"
+#include "iop/compression.hpp"
+
+#include <array>
+#include <string>
+#include <zlib.h>
+
+static auto roundTrips(const std::string_view input) noexcept -> bool {
+  static std::array<uint8_t, 64 * 1024> deflated;
+  static std::array<uint8_t, 64 * 1024> inflated;
+
+  const auto length = iop::compression::deflate(input, deflated.data(), deflated.size());
+  if (!length) return false;
+
+  uLongf inflatedLength = inflated.size();
+  if (uncompress(inflated.data(), &inflatedLength, deflated.data(), *length) != Z_OK) return false;
+  return std::string_view(reinterpret_cast<const char*>(inflated.data()), inflatedLength) == input;
+}
+
+// zlib inflates what we deflate, for inputs that stress the match finder: empty, too short to match, runs longer than a
+// match, repetition farther than the window, incompressible bytes and what devices actually send
+static auto testRoundTrips() noexcept -> void {
+  CHECK(roundTrips(""));
+  CHECK(roundTrips("a"));
+  CHECK(roundTrips("abc"));
+  CHECK(roundTrips(std::string(1000, 'a')));
+  CHECK(roundTrips(std::string(300, '\0')));
+
+  std::string log;
+  for (uint32_t line = 0; log.size() < 8000; ++line) {
+    log += "[INFO] LOOP: Connected to WiFi, took (ms): " + std::to_string(line * 37 % 5000) + "\n";
+    if (line % 5 == 0) log += "[INFO] API: Register event: {\"air_temperature_celsius\":" + std::to_string(20 + line % 10) + "}\n";
+  }
+  CHECK(roundTrips(log));
+
+  std::string distant;
+  uint32_t state = 2166136261;
+  for (size_t index = 0; index < IOP_COMPRESSION_WINDOW * 3; ++index) {
+    state = state * 1664525 + 1013904223;
+    distant += static_cast<char>(state >> 24);
+  }
+  CHECK(roundTrips(distant + distant));
+
+  // Every prefix of a mix of text and noise, so each end of input lands at a different spot of the match finder
+  const auto mixed = log.substr(0, 600) + distant.substr(0, 200) + log.substr(0, 600);
+  auto prefixes = true;
+  for (size_t length = 0; length <= mixed.size(); ++length) prefixes = roundTrips(std::string_view(mixed).substr(0, length)) && prefixes;
+  CHECK(prefixes);
+
+  std::array<uint8_t, 16> small;
+  CHECK(!iop::compression::deflate(log, small.data(), small.size()));
+}
+
+#ifdef IOP_COMPRESSION
+static auto inflatedBytes() noexcept -> uint64_t {
+  StaticJsonDocument<2048> doc;
+  if (!CHECK(inspectServer(IOP_STR("/stats"), doc))) return 0;
+  return doc["compression"]["inflated_bytes"].as<uint64_t>();
+}
+
+static auto eventErrors() noexcept -> uint32_t {
+  StaticJsonDocument<2048> doc;
+  if (!CHECK(inspectServer(IOP_STR("/stats"), doc))) return 0;
+  return doc["POST /v1/event"]["errors"].as<uint32_t>();
+}
+
+static auto setInflates(const bool enabled) noexcept -> void {
+  StaticJsonDocument<64> doc;
+  const auto path = enabled ? IOP_STR("/inflate?enabled=1") : IOP_STR("/inflate?enabled=0");
+  CHECK(inspectServer(path, doc) && doc["enabled"].as<bool>() == enabled);
+}
+
+// Compression is only enabled if the server answers the first big event saying it inflates them, and a server that
+// stops inflating later (415) gets the bodies again uncompressed
+static auto testNegotiation() noexcept -> void {
+  std::string event = "{\"log\":\"";
+  while (event.size() < IOP_COMPRESSION_MIN_BYTES * 2) event += "soil moisture within range, ";
+  event += "\"}";
+
+  Device device;
+  const auto token = device.loop.storage().token();
+  if (!CHECK(token.has_value())) return;
+  auto &api = device.loop.api();
+
+  const auto inflated = inflatedBytes();
+  const auto errors = eventErrors();
+  // Sent as is, asking
+  CHECK(api.registerEvent(*token, event) == iop::NetworkStatus::OK);
+  CHECK(inflatedBytes() == inflated);
+  CHECK(api.registerEvent(*token, event) == iop::NetworkStatus::OK);
+  CHECK(inflatedBytes() == inflated + event.size());
+
+  // Rolled back, the deflated body is refused and sent again uncompressed. Then compression stays disabled
+  setInflates(false);
+  CHECK(api.registerEvent(*token, event) == iop::NetworkStatus::OK);
+  CHECK(eventErrors() == errors + 1);
+  CHECK(api.registerEvent(*token, event) == iop::NetworkStatus::OK);
+  CHECK(eventErrors() == errors + 1);
+
+  // Like --no-inflate, the answer has no hint so it's never enabled
+  Device unsupported;
+  const auto unsupportedToken = unsupported.loop.storage().token();
+  if (CHECK(unsupportedToken.has_value())) {
+    CHECK(unsupported.loop.api().registerEvent(*unsupportedToken, event) == iop::NetworkStatus::OK);
+    CHECK(unsupported.loop.api().registerEvent(*unsupportedToken, event) == iop::NetworkStatus::OK);
+    CHECK(eventErrors() == errors + 1);
+  }
+  setInflates(true);
+  CHECK(inflatedBytes() == inflated + event.size());
+}
+#endif
+
+auto testCompression(iop::EventLoop &) noexcept -> void {
+  testRoundTrips();
+#ifdef IOP_COMPRESSION
+  testNegotiation();
+#endif
+}
@@ -0,0 +1,52 @@
+#include "check.hpp"
+
+#include <cstring>
+
+// Stored like `iop_panic` does, read back by the next boot, then sent like `EventLoop::handleCrashReport` does
+auto testCrashReport(iop::EventLoop &loop) noexcept -> void {
+  iop::CrashReport report;
+  memset(&report, 0, sizeof(iop::CrashReport));
+  report.reason = iop::ResetReason::PANIC;
+  report.uptime = 123456;
+  report.line = 42;
+  strncpy(report.file.data(), "src/sensors.cpp", report.file.size() - 1);
+  strncpy(report.func.data(), "measure", report.func.size() - 1);
+  strncpy(report.msg.data(), "Soil sensor \"unplugged\"", report.msg.size() - 1);
+  report.stackPointer = 0x3FFFFE00;
+  for (size_t index = 0; index < report.stack.size(); ++index) report.stack[index] = 0x40200000 + static_cast<uint32_t>(index);
+
+  CHECK(loop.storage().setCrashReport(report));
+
+  // The next boot only sees the flash image
+  auto rebooted = loop.storage();
+  rebooted.setup();
+  const auto stored = rebooted.crashReport();
+  if (!CHECK(stored.has_value())) return;
+  CHECK(memcmp(&stored->get(), &report, sizeof(iop::CrashReport)) == 0);
+
+  const auto token = authenticate(loop);
+  CHECK(loop.api().reportPanic(*token, *stored) == iop::NetworkStatus::OK);
+  rebooted.removeCrashReport();
+  CHECK(!rebooted.crashReport().has_value());
+
+  // Strings that filled their buffers are terminated when read, even if a crash handler stored them unterminated
+  memset(report.msg.data(), 'x', report.msg.size());
+  CHECK(loop.storage().setCrashReport(report));
+  const auto truncated = loop.storage().crashReport();
+  if (!CHECK(truncated.has_value())) return;
+  CHECK(strlen(truncated->get().msg.data()) == report.msg.size() - 1);
+  CHECK(loop.api().reportPanic(*token, *truncated) == iop::NetworkStatus::OK);
+  loop.storage().removeCrashReport();
+  CHECK(!loop.storage().crashReport().has_value());
+
+  // The crash path copies flash strings without the heap, it may be why the device crashed
+  CHECK(iop::hash(IOP_STR("src/sensors.cpp"), 42) == iop::hash(std::string_view("src/sensors.cpp"), 42));
+  {
+    iop::heap::Forbid forbid;
+    iop::panic::recordUnexpectedReset(iop::ResetReason::BROWNOUT);
+  }
+  const auto brownout = loop.storage().crashReport();
+  if (!CHECK(brownout.has_value())) return;
+  CHECK(iop::to_view(brownout->get().msg) == "BROWNOUT");
+  loop.storage().removeCrashReport();
+}
@@ -0,0 +1,59 @@
+#include "check.hpp"
+
+IOP_EVENT_FIELD(soil_moisture_percent, float);
+
+static auto eventsReceived() noexcept -> uint32_t {
+  StaticJsonDocument<2048> doc;
+  if (!CHECK(inspectServer(IOP_STR("/stats"), doc))) return 0;
+  return doc["POST /v1/event"]["requests"].as<uint32_t>();
+}
+
+// Deadbands read the device's clock, as the loop's tasks would
+static auto send(Device &device, iop::Deadband<soil_moisture_percent> &deadband, const float moisture) noexcept -> void {
+  const auto previous = iop::clock::install(&device.clock);
+  const auto token = device.loop.storage().token();
+  if (CHECK(token.has_value())) device.loop.registerEvent(*token, iop::Event<soil_moisture_percent>(soil_moisture_percent { moisture }), deadband);
+  iop::clock::install(previous);
+}
+
+// Readings within the band of the last one sent are suppressed, unless the heartbeat expired. The band is absolute near
+// zero and relative far from it, and an event the server didn't get isn't taken as sent
+auto testDeadband(iop::EventLoop &) noexcept -> void {
+  Device device;
+  iop::Deadband<soil_moisture_percent> deadband(60 * 1000, {{ {1, 0.1} }});
+  const auto before = eventsReceived();
+
+  send(device, deadband, 0);
+  device.clock.now += 1000;
+  // Relative to zero any change would be sent
+  send(device, deadband, 0.9f);
+  send(device, deadband, 1.5f);
+  CHECK(deadband.suppressed() == 1);
+  CHECK(eventsReceived() == before + 2);
+
+  send(device, deadband, 100);
+  // 10% of 100 is bigger than the absolute band
+  send(device, deadband, 109);
+  send(device, deadband, 111);
+  CHECK(deadband.suppressed() == 2);
+  CHECK(eventsReceived() == before + 4);
+
+  // Unchanged, sent anyway once the heartbeat expires
+  device.clock.now += 59 * 1000;
+  send(device, deadband, 111);
+  device.clock.now += 1000;
+  send(device, deadband, 111);
+  send(device, deadband, 111);
+  CHECK(deadband.suppressed() == 4);
+  CHECK(device.loop.suppressedEvents() == 4);
+  CHECK(eventsReceived() == before + 5);
+
+  // Nothing listens there, so the reading is sent again
+  Device offline(false, IOP_STR("http://127.0.0.1:9"));
+  offline.loop.storage().setToken(*authenticate(device.loop));
+  iop::Deadband<soil_moisture_percent> unsent(60 * 1000, {{ {1, 0.1} }});
+  send(offline, unsent, 50);
+  send(offline, unsent, 50);
+  CHECK(unsent.suppressed() == 0);
+  CHECK(offline.loop.suppressedEvents() == 0);
+}
@@ -0,0 +1,28 @@
+#include "check.hpp"
+
+#include <cstring>
+
+// A task that always overruns its maximum run time is counted at every run, but reported at most every 10 minutes
+auto testDeadlineMisses(iop::EventLoop &) noexcept -> void {
+  StaticJsonDocument<1024> doc;
+  if (!CHECK(inspectServer(IOP_STR("/events?key=deadline_misses"), doc))) return;
+  const auto before = doc["received"].as<uint32_t>();
+
+  Device device;
+  device.loop.setInterval(1000, [](iop::EventLoop &) { iop::clock::advance(250); }, iop::Priority::NORMAL, 100);
+  device.run(5000);
+
+  CHECK(device.loop.deadlineMisses() >= 4);
+  if (!CHECK(inspectServer(IOP_STR("/events?key=deadline_misses"), doc))) return;
+  CHECK(doc["received"].as<uint32_t>() == before + 1);
+  CHECK(doc["last"]["count"].as<uint32_t>() == 1);
+  CHECK(strcmp(doc["last"]["phase"].as<const char*>(), "TASKS") == 0);
+  CHECK(doc["last"]["task"].as<uint32_t>() == 0);
+  CHECK(doc["last"]["took"].as<uint32_t>() >= 250);
+
+  // The misses meanwhile are sent together
+  device.run(10 * 60 * 1000, 1000);
+  if (!CHECK(inspectServer(IOP_STR("/events?key=deadline_misses"), doc))) return;
+  CHECK(doc["received"].as<uint32_t>() == before + 2);
+  CHECK(doc["last"]["count"].as<uint32_t>() > 100);
+}
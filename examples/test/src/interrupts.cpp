@@ -0,0 +1,70 @@
+#include "check.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#ifndef TEST_INTERRUPT_PRODUCERS
+#define TEST_INTERRUPT_PRODUCERS 4
+#endif
+
+#ifndef TEST_INTERRUPTS_PER_PRODUCER
+#define TEST_INTERRUPTS_PER_PRODUCER 50000
+#endif
+
+// Producer threads stand in for interrupts, hammering the queue while the loop drains it. Every interrupt must either
+// arrive exactly once, in the order its producer scheduled it, or be counted as dropped
+auto testInterrupts(iop::EventLoop &) noexcept -> void {
+  constexpr uint16_t producers = TEST_INTERRUPT_PRODUCERS;
+  constexpr uint32_t perProducer = TEST_INTERRUPTS_PER_PRODUCER;
+
+  while (iop::descheduleInterrupt().event != iop::InterruptEvent::NONE) {}
+  const auto droppedBefore = iop::droppedInterrupts();
+
+  std::atomic<uint16_t> finished(0);
+  std::vector<std::thread> threads;
+  for (uint16_t producer = 0; producer < producers; ++producer) {
+    threads.emplace_back([producer, &finished]() {
+      for (uint32_t sequence = 0; sequence < perProducer; ++sequence) {
+        iop::scheduleInterrupt(iop::InterruptEvent::USER, producer, sequence);
+        // Gives the loop a chance to run, otherwise with few cores almost everything is dropped
+        if (sequence % 8 == 0) std::this_thread::yield();
+      }
+      finished.fetch_add(1, std::memory_order_release);
+    });
+  }
+
+  std::vector<std::vector<uint8_t>> received(producers, std::vector<uint8_t>(perProducer, 0));
+  std::vector<int64_t> last(producers, -1);
+  uint64_t count = 0, duplicates = 0, unordered = 0, unknown = 0;
+  while (true) {
+    // Read before draining, if every producer was done by then an empty queue means there is nothing left
+    const auto done = finished.load(std::memory_order_acquire) == producers;
+    const auto interrupt = iop::descheduleInterrupt();
+    if (interrupt.event == iop::InterruptEvent::NONE) {
+      if (done) break;
+      std::this_thread::yield();
+      continue;
+    }
+
+    if (interrupt.event != iop::InterruptEvent::USER || interrupt.code >= producers || interrupt.payload >= perProducer) {
+      unknown++;
+      continue;
+    }
+    auto &seen = received[interrupt.code][interrupt.payload];
+    if (seen) duplicates++;
+    seen = 1;
+    if (static_cast<int64_t>(interrupt.payload) <= last[interrupt.code]) unordered++;
+    last[interrupt.code] = interrupt.payload;
+    count++;
+  }
+  for (auto &thread: threads) thread.join();
+
+  const auto dropped = iop::droppedInterrupts() - droppedBefore;
+  CHECK(unknown == 0);
+  CHECK(duplicates == 0);
+  CHECK(unordered == 0);
+  CHECK(count + dropped == static_cast<uint64_t>(producers) * perProducer);
+  CHECK(count > 0);
+  CHECK(iop::descheduleInterrupt().event == iop::InterruptEvent::NONE);
+}
@@ -0,0 +1,79 @@
+#include "check.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <variant>
+
+static uint32_t checks = 0;
+static uint32_t failures = 0;
+
+auto check(const bool ok, const char *expression, const char *file, const int line) noexcept -> bool {
+  checks++;
+  if (!ok) {
+    failures++;
+    std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, expression);
+  }
+  return ok;
+}
+
+auto authenticate(iop::EventLoop &loop) noexcept -> iop::Box<iop::AuthToken> {
+  auto result = loop.api().authenticate("test", "test@example.com", "test");
+  if (auto *token = std::get_if<iop::Box<iop::AuthToken>>(&result)) return std::move(*token);
+
+  std::fprintf(stderr, "Unable to authenticate, is tools/monitor_server.py running?\n");
+  std::exit(1);
+}
+
+static auto monitorServer() noexcept -> iop::StaticString { return IOP_STR("http://127.0.0.1:4001"); }
+
+auto inspectServer(const iop::StaticString path, JsonDocument &doc) noexcept -> bool {
+  const iop::Network network(monitorServer());
+  auto response = network.httpPost(path, "");
+  if (response.status() != iop::NetworkStatus::OK) return false;
+
+  const auto payloadBuff = std::move(response.await().payload);
+  const auto payload = iop::to_view(payloadBuff);
+  return !deserializeJson(doc, payload.data(), payload.length());
+}
+
+Device::Device(const bool authenticated) noexcept: Device(authenticated, monitorServer()) {}
+
+Device::Device(const bool authenticated, const iop::StaticString uri) noexcept: clock(), loop(uri) {
+  this->clock.enabled = true;
+  this->loop.useClock(this->clock);
+  this->loop.setup();
+  // Unauthenticated devices serve the captive portal
+  this->loop.setAccessPointCredentials(IOP_STR("iop-test"), IOP_STR("test1234"));
+  if (authenticated) this->loop.storage().setToken(*authenticate(this->loop));
+}
+
+auto Device::run(const iop::time::milliseconds duration, const iop::time::milliseconds step) noexcept -> void {
+  const auto end = this->clock.now + duration;
+  while (this->clock.now < end) {
+    this->loop.loop();
+    this->clock.now += step;
+  }
+}
+
+namespace iop {
+auto setup(EventLoop &loop) noexcept -> void {
+  // Simulated devices run it too
+  if (&loop != &iop::eventLoop) return;
+
+  testCrashReport(loop);
+  testPanicSchedule(loop);
+  testInterrupts(loop);
+  testWifiStats(loop);
+  testSeries(loop);
+  testPendingUpgrade(loop);
+  testDeadband(loop);
+  testSplitTasks(loop);
+  testDeadlineMisses(loop);
+  testCompression(loop);
+  testRadioOff(loop);
+  testSteadyState(loop);
+
+  std::printf("%u checks, %u failed\n", checks, failures);
+  std::exit(failures > 0 ? 1 : 0);
+}
+}
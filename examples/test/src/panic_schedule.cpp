@@ -0,0 +1,68 @@
+#include "check.hpp"
+#include "iop/clock.hpp"
+
+#include <algorithm>
+#include <vector>
+
+constexpr static iop::time::milliseconds week = 7 * 24 * 60 * 60 * 1000ULL;
+
+static auto seedOf(const uint32_t device) noexcept -> uint32_t {
+  return iop::hash(std::string_view(reinterpret_cast<const char *>(&device), sizeof(device)));
+}
+
+static auto spread(const std::vector<iop::time::milliseconds> &wakes) noexcept -> iop::time::milliseconds {
+  const auto [min, max] = std::minmax_element(wakes.begin(), wakes.end());
+  return *max - *min;
+}
+
+// A week of a fleet halted by the same panic, in virtual time. Each wake up is a reboot, only the RTC memory survives it
+auto testPanicSchedule(iop::EventLoop &) noexcept -> void {
+  const auto schedule = iop::Backoff(60 * 1000, 60 * 60 * 1000, 2, 20);
+  iop::panic::setWakeSchedule(schedule);
+  iop::clock::useVirtualTime();
+
+  const auto site = iop::hash("src/sensors.cpp", 42);
+  constexpr uint32_t devices = 64;
+  std::vector<iop::time::milliseconds> firstWakes, hintedWakes;
+
+  for (uint32_t device = 0; device < devices; ++device) {
+    iop::panic::resetWakes();
+    const auto seed = seedOf(device);
+    const auto start = iop::clock::now();
+
+    uint32_t wakes = 0;
+    auto nominal = schedule.initial;
+    auto withinJitter = true;
+    while (iop::clock::now() - start < week) {
+      const auto delay = iop::panic::nextWake(seed, site, std::nullopt);
+      if (wakes == 0) firstWakes.push_back(delay);
+      // Doubles until the cap, give or take the jitter
+      withinJitter = withinJitter && delay >= nominal * 8 / 10 && delay <= nominal * 12 / 10;
+      nominal = std::min(nominal * schedule.factor, schedule.max);
+
+      iop::clock::deepSleep(delay / 1000);
+      wakes++;
+    }
+    CHECK(withinJitter);
+    // An hour apart after the first few, without the persisted count it would wake up every minute
+    CHECK(wakes <= 7 * 24 * 12 / 10 + 6);
+    CHECK(wakes >= 7 * 24 * 8 / 10);
+
+    // Another panic, or an update (it changes the seed), starts over
+    CHECK(iop::panic::nextWake(seed, site + 1, std::nullopt) <= schedule.initial * 12 / 10);
+    CHECK(iop::panic::nextWake(seed ^ 1, site + 1, std::nullopt) <= schedule.initial * 12 / 10);
+
+    // The same hint doesn't wake the whole fleet at once
+    iop::panic::resetWakes();
+    hintedWakes.push_back(iop::panic::nextWake(seed, site, 10 * 60 * 1000));
+  }
+
+  // 20% jitter spreads a minute over 24 seconds
+  CHECK(spread(firstWakes) >= 20 * 1000);
+  CHECK(spread(hintedWakes) >= 3 * 60 * 1000);
+  std::sort(firstWakes.begin(), firstWakes.end());
+  CHECK(std::unique(firstWakes.begin(), firstWakes.end()) - firstWakes.begin() >= devices * 9 / 10);
+
+  iop::panic::resetWakes();
+  iop::clock::useRealTime();
+}
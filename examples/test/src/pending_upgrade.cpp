@@ -0,0 +1,32 @@
+#include "check.hpp"
+
+static auto updateChecks() noexcept -> uint32_t {
+  StaticJsonDocument<2048> doc;
+  if (!CHECK(inspectServer(IOP_STR("/stats"), doc))) return 0;
+  return doc["GET /v1/update"]["requests"].as<uint32_t>();
+}
+
+// An update scheduled before the device has a token can't be checked, it must wait for one instead of being lost.
+// User interrupts don't need the network, so they are handled meanwhile
+auto testPendingUpgrade(iop::EventLoop &) noexcept -> void {
+  while (iop::descheduleInterrupt().event != iop::InterruptEvent::NONE) {}
+
+  Device device(false);
+  uint32_t handled = 0;
+  device.loop.setInterruptHandler([&handled](iop::EventLoop &, const iop::Interrupt &) { handled++; });
+
+  const auto before = updateChecks();
+  iop::scheduleInterrupt(iop::InterruptEvent::MUST_UPGRADE);
+  iop::scheduleInterrupt(iop::InterruptEvent::USER, 1, 2);
+  iop::scheduleInterrupt(iop::InterruptEvent::MUST_UPGRADE);
+  device.run(1000);
+
+  CHECK(handled == 1);
+  CHECK(iop::descheduleInterrupt().event == iop::InterruptEvent::NONE);
+  CHECK(updateChecks() == before);
+
+  // Coalesced into a single check
+  device.loop.storage().setToken(*authenticate(device.loop));
+  device.run(1000);
+  CHECK(updateChecks() == before + 1);
+}
@@ -0,0 +1,35 @@
+#include "check.hpp"
+
+IOP_EVENT_FIELD(light_lux, iop::Summary);
+
+static auto lightEvents(JsonDocument &doc) noexcept -> uint32_t {
+  if (!CHECK(inspectServer(IOP_STR("/events?key=light_lux"), doc))) return 0;
+  return doc["received"].as<uint32_t>();
+}
+
+// With the radio off between network deadlines the samples are still taken, and each window is sent when the radio
+// wakes up for it
+auto testRadioOff(iop::EventLoop &) noexcept -> void {
+  StaticJsonDocument<1024> doc;
+  const auto before = lightEvents(doc);
+
+  Device device;
+  device.loop.setRadioPolicy(iop::RadioPolicy { iop::RadioMode::OFF, 30 * 1000, 1000, 10 * 60 * 1000 });
+  uint32_t samples = 0;
+  device.loop.aggregate<light_lux>(1000, 5 * 60 * 1000, [&samples](iop::EventLoop &) {
+    samples++;
+    return std::make_optional(static_cast<double>(samples % 100));
+  });
+
+  constexpr iop::time::milliseconds duration = 31 * 60 * 1000;
+  device.run(duration, 100);
+
+  CHECK(samples >= duration / 1000 - 10);
+  CHECK(lightEvents(doc) == before + 6);
+  CHECK(doc["last"]["count"].as<uint32_t>() >= 295 && doc["last"]["count"].as<uint32_t>() <= 300);
+  CHECK(doc["last"]["max"].as<uint32_t>() == 99);
+
+  const auto previous = iop::clock::install(&device.clock);
+  CHECK(device.loop.radioOnTime() < duration / 2);
+  iop::clock::install(previous);
+}
@@ -0,0 +1,109 @@
+#include "check.hpp"
+#include "iop/series.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+IOP_EVENT_FIELD(soil_temperature_celsius, float);
+IOP_EVENT_FIELD(pump_on, bool);
+
+static auto readLE(const uint8_t *data, const uint8_t bytes) noexcept -> uint64_t {
+  uint64_t value = 0;
+  for (uint8_t index = 0; index < bytes; ++index) value |= static_cast<uint64_t>(data[index]) << (index * 8);
+  return value;
+}
+
+static auto bits(const float value) noexcept -> uint32_t {
+  uint32_t raw;
+  memcpy(&raw, &value, sizeof(raw));
+  return raw;
+}
+
+// Encodes until a column is full, then decodes the serialized series like the monitor server does
+auto testSeries(iop::EventLoop &loop) noexcept -> void {
+  static iop::TimeSeries<soil_temperature_celsius, pump_on> series;
+  std::vector<uint64_t> timestamps;
+  std::vector<float> temperatures;
+  std::vector<bool> pumps;
+
+  uint64_t timestamp = 1000;
+  uint32_t state = 12345;
+  while (true) {
+    // Mostly regular, with a clock going backwards, a long gap and jitter
+    const auto sample = timestamps.size();
+    if (sample == 3) {
+      timestamp -= 700;
+    } else if (sample == 5) {
+      timestamp += 1ULL << 40;
+    } else {
+      timestamp += 1000 + (sample % 7 == 0 ? sample : 0);
+    }
+
+    state = state * 1103515245 + 12345;
+    auto temperature = 20.0f + static_cast<float>(state >> 16) / 6553.6f;
+    if (sample == 2) temperature = NAN;
+    if (sample == 4) temperature = temperatures.back();
+    const auto pump = (sample / 10) % 2 == 1;
+
+    if (!series.append(timestamp, iop::Event<soil_temperature_celsius, pump_on>(soil_temperature_celsius { temperature }, pump_on { pump }))) break;
+    timestamps.push_back(timestamp);
+    temperatures.push_back(temperature);
+    pumps.push_back(pump);
+  }
+  // The random temperatures fill their column first
+  CHECK(timestamps.size() > 10);
+  CHECK(series.size() == timestamps.size());
+
+  static iop::TimeSeries<soil_temperature_celsius, pump_on>::Buffer buffer;
+  const auto serialized = series.serialize(buffer, 123456);
+  const auto *data = reinterpret_cast<const uint8_t *>(serialized.data());
+  CHECK(data[0] == iop::series::version);
+  CHECK(data[1] == 2);
+  CHECK(readLE(data + 2, 2) == timestamps.size());
+  CHECK(readLE(data + 4, 8) == 123456);
+
+  auto cursor = data + iop::series::headerLength;
+  for (const auto key: { soil_temperature_celsius::key, pump_on::key }) {
+    CHECK(std::string_view(reinterpret_cast<const char *>(cursor + 1), *cursor) == key);
+    cursor += 1 + *cursor;
+  }
+
+  size_t longest = 0;
+  const auto column = [&cursor, &longest]() {
+    const auto length = static_cast<size_t>(readLE(cursor, 2));
+    longest = std::max(longest, length);
+    auto reader = iop::series::BitReader(cursor + 2, length);
+    cursor += 2 + length;
+    return reader;
+  };
+  auto timestampReader = column();
+  auto temperatureReader = column();
+  auto pumpReader = column();
+  CHECK(cursor == data + serialized.length());
+
+  iop::series::TimestampDecoder timestampDecoder;
+  iop::series::ValueDecoder temperatureDecoder, pumpDecoder;
+  auto matches = true;
+  for (size_t sample = 0; sample < timestamps.size(); ++sample) {
+    const auto decodedTimestamp = timestampDecoder.next(timestampReader);
+    const auto temperature = temperatureDecoder.next(temperatureReader);
+    const auto pump = pumpDecoder.next(pumpReader);
+    // NaN doesn't compare equal to itself, the bits must round trip
+    matches = matches && decodedTimestamp == timestamps[sample] && temperature && bits(*temperature) == bits(temperatures[sample])
+      && pump == (pumps[sample] ? 1.0f : 0.0f);
+  }
+  CHECK(matches);
+  CHECK(std::isnan(temperatures[2]));
+  // A sample takes at most 44 bits, so the full column has less than that left
+  CHECK(longest * 8 + 44 > IOP_SERIES_COLUMN_BYTES * 8);
+
+  // The body has NUL bytes, it must reach the server verbatim
+  CHECK(memchr(serialized.data(), '\0', serialized.length()) != nullptr);
+  const auto token = authenticate(loop);
+  CHECK(loop.api().registerSeries(*token, serialized) == iop::NetworkStatus::OK);
+
+  series.clear();
+  CHECK(series.size() == 0);
+}
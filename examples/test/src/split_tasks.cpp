@@ -0,0 +1,59 @@
+#include "check.hpp"
+
+#include <optional>
+
+struct Conversion {
+  std::optional<iop::time::milliseconds> started;
+  std::optional<iop::time::milliseconds> finished;
+  bool timedOut = false;
+};
+
+static auto startSplit(Conversion &conversion, iop::Resume resume) noexcept {
+  return [&conversion, resume](iop::EventLoop &) {
+    if (!conversion.started) conversion.started = iop::clock::now();
+    return std::make_optional(resume);
+  };
+}
+
+static auto finishSplit(Conversion &conversion) noexcept {
+  return [&conversion](iop::EventLoop &, const bool timedOut) {
+    if (!conversion.finished) conversion.finished = iop::clock::now();
+    conversion.timedOut = timedOut;
+  };
+}
+
+// Sensors converting at the same time: one waits a fixed delay, one is ready early and one never is. Meanwhile the
+// other tasks keep running
+auto testSplitTasks(iop::EventLoop &) noexcept -> void {
+  Device device(false);
+
+  bool ready = false;
+  Conversion delayed, early, stuck;
+  device.loop.setSplitInterval(60 * 1000, startSplit(delayed, iop::Resume(750)), finishSplit(delayed));
+  device.loop.setSplitInterval(60 * 1000, startSplit(early, iop::Resume(2000, [&ready]() { return ready; })), finishSplit(early));
+  device.loop.setSplitInterval(60 * 1000, startSplit(stuck, iop::Resume(1000, []() { return false; })), finishSplit(stuck));
+
+  uint32_t ticks = 0;
+  device.loop.setInterval(50, [&ticks, &ready](iop::EventLoop &) {
+    ticks++;
+    if (iop::clock::now() >= 300) ready = true;
+  });
+  device.run(3000);
+
+  CHECK(delayed.started && early.started && stuck.started);
+  if (!CHECK(delayed.finished && early.finished && stuck.finished)) return;
+
+  // In parallel, not one after the other
+  CHECK(*early.started - *delayed.started < 100);
+  CHECK(*stuck.started - *delayed.started < 100);
+
+  CHECK(*delayed.finished - *delayed.started >= 750 && *delayed.finished - *delayed.started < 800);
+  CHECK(!delayed.timedOut);
+  CHECK(*early.finished >= 300 && *early.finished < 400);
+  CHECK(!early.timedOut);
+  CHECK(*stuck.finished - *stuck.started >= 1000 && *stuck.finished - *stuck.started < 1050);
+  CHECK(stuck.timedOut);
+
+  // Every 50ms for 3 seconds, unless the conversions blocked the loop
+  CHECK(ticks >= 55);
+}
@@ -0,0 +1,52 @@
+#include "check.hpp"
+
+#include <cstring>
+
+#ifndef TEST_STEADY_STATE_ITERATIONS
+#define TEST_STEADY_STATE_ITERATIONS 20
+#endif
+
+// What a running device keeps doing: measurements, logs to the network and panic reports.
+// With IOP_STATIC_ARENA none of it may allocate, `heap::Forbid` panics if it does
+auto testSteadyState(iop::EventLoop &loop) noexcept -> void {
+#ifdef IOP_STATIC_ARENA
+  const auto token = authenticate(loop);
+  CHECK(loop.storage().setToken(*token));
+
+  iop::CrashReport report;
+  memset(&report, 0, sizeof(iop::CrashReport));
+  report.reason = iop::ResetReason::WATCHDOG;
+  report.line = 7;
+  strncpy(report.file.data(), "src/actuator.cpp", report.file.size() - 1);
+  strncpy(report.func.data(), "toggle", report.func.size() - 1);
+  for (size_t index = 0; index < report.stack.size(); ++index) report.stack[index] = 0x40200000 + static_cast<uint32_t>(index);
+  const auto panic = iop::PanicData(std::string_view("Relay stuck"), IOP_STR("src/actuator.cpp"), 7, IOP_STR("toggle"));
+  const iop::Log logger(IOP_STR("TEST"));
+
+  // The first request warms up whatever the platform initializes lazily
+  CHECK(loop.api().reportPanic(*token, report) == iop::NetworkStatus::OK);
+
+  uint32_t sent = 0;
+  {
+    iop::heap::Forbid forbid;
+    for (uint32_t iteration = 0; iteration < TEST_STEADY_STATE_ITERATIONS; ++iteration) {
+      const auto json = loop.api().makeJson(IOP_FUNC, [iteration](JsonDocument &doc) {
+        doc["air_temperature_celsius"] = 20.0 + static_cast<double>(iteration % 10);
+        doc["soil_resistivity_raw"] = 600 + iteration;
+      });
+      if (!json) break;
+      sent += loop.api().registerEvent(*token, json) == iop::NetworkStatus::OK;
+
+      // Sent to the monitor server by the network logger
+      logger.info(IOP_STR("Steady state iteration: "));
+      logger.infoln(iteration);
+
+      sent += loop.api().reportPanic(*token, panic) == iop::NetworkStatus::OK;
+      sent += loop.api().reportPanic(*token, report) == iop::NetworkStatus::OK;
+    }
+  }
+  CHECK(sent == TEST_STEADY_STATE_ITERATIONS * 3);
+#else
+  (void) loop;
+#endif
+}
@@ -0,0 +1,72 @@
+#include "check.hpp"
+#include "iop/clock.hpp"
+
+#include <cstring>
+
+// What the next boot would see, pending stats are lost
+static auto flashed(const iop::Storage &storage) noexcept -> iop::WifiStats {
+  auto rebooted = storage;
+  rebooted.setup();
+  return rebooted.wifiStats(0);
+}
+
+static auto same(const iop::WifiStats &a, const iop::WifiStats &b) noexcept -> bool {
+  return a.successes == b.successes && a.failures == b.failures && a.connectMillis == b.connectMillis && a.rssi == b.rssi;
+}
+
+// A duty-cycled device reconnects every few minutes, most connections shouldn't touch the flash
+auto testWifiStats(iop::EventLoop &loop) noexcept -> void {
+  (void) loop;
+  iop::clock::useVirtualTime();
+
+  iop::Storage storage;
+  storage.setup();
+
+  iop::NetworkName ssid;
+  ssid.fill('\0');
+  strncpy(ssid.data(), "greenhouse", ssid.size() - 1);
+  iop::NetworkPassword psk;
+  psk.fill('\0');
+  strncpy(psk.data(), "password", psk.size() - 1);
+  CHECK(storage.setWifi(iop::WifiCredentials(ssid, psk)));
+  CHECK(storage.wifiSlot(iop::to_view(ssid)) == std::optional<uint8_t>(0));
+
+  // The first success is always written
+  storage.recordWifiConnection(0, 0, 1000, -60);
+  CHECK(flashed(storage).successes == 1);
+
+  const uint32_t connections = 12 * 5;
+  uint32_t writes = 0;
+  for (uint32_t index = 0; index < connections; ++index) {
+    iop::clock::advance(5 * 60 * 1000);
+    const auto before = flashed(storage);
+    storage.recordWifiConnection(0, 0, 950 + (index % 5) * 25, -60);
+    if (!same(before, flashed(storage))) writes++;
+  }
+  CHECK(writes > 0);
+  CHECK(writes < connections / 4);
+  // The ranking sees what wasn't written yet
+  CHECK(storage.wifiStats(0).successes > flashed(storage).successes);
+
+  // Failures are always written
+  storage.recordWifiConnection(0, 2, 1000, -60);
+  CHECK(same(storage.wifiStats(0), flashed(storage)));
+  CHECK(flashed(storage).failures == 2);
+
+  // A small change is still written once the last write gets old
+  iop::clock::advance(60 * 1000);
+  storage.recordWifiConnection(0, 0, 1000, -60);
+  CHECK(!same(storage.wifiStats(0), flashed(storage)));
+  iop::clock::advance(IOP_WIFI_STATS_WRITE_MILLIS);
+  storage.recordWifiConnection(0, 0, 1000, -60);
+  CHECK(same(storage.wifiStats(0), flashed(storage)));
+
+  // New credentials in the slot don't inherit the pending history
+  iop::clock::advance(60 * 1000);
+  storage.recordWifiConnection(0, 0, 1000, -60);
+  strncpy(psk.data(), "changed", psk.size() - 1);
+  CHECK(storage.setWifi(iop::WifiCredentials(ssid, psk)));
+  CHECK(storage.wifiStats(0).successes == 0);
+
+  iop::clock::useRealTime();
+}
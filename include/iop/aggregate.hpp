@@ -0,0 +1,27 @@
+#ifndef IOP_AGGREGATE_HPP
+#define IOP_AGGREGATE_HPP
+
+#include <stdint.h>
+
+namespace iop {
+/// Running statistics of a window of samples, in constant memory, samples aren't stored.
+///
+/// Mean and variance use Welford's algorithm, so they stay precise over long windows.
+/// As an event field it's serialized as `{"count": 60, "min": 19.5, "max": 21, "mean": 20.2, "variance": 0.3}`
+struct Summary {
+  uint32_t count = 0;
+  double min = 0;
+  double max = 0;
+  double mean = 0;
+  /// Sum of squared differences from the mean
+  double m2 = 0;
+
+  auto add(double sample) noexcept -> void;
+  /// Adds the samples summarized by `other`, as if they had been added one by one
+  auto merge(const Summary &other) noexcept -> void;
+  /// Population variance of the window, 0 if it has less than two samples
+  auto variance() const noexcept -> double;
+  auto clear() noexcept -> void { *this = Summary(); }
+};
+}
+#endif
@@ -3,8 +3,11 @@
 
 #include "iop-hal/network.hpp"
 #include "iop/utils.hpp"
+#include "iop/arena.hpp"
+#include "iop/compression.hpp"
 
 #include <ArduinoJson.h>
+#include <optional>
 
 namespace iop {
 class PanicData;
@@ -27,10 +30,22 @@ class Api {
 private:
   iop::Network network;
   iop::Log logger;
+  std::optional<iop::time::milliseconds> nextCheckHint;
+
+#ifdef IOP_LINUX_MOCK
+  bool radioOff = false;
+#endif
+
+#ifdef IOP_COMPRESSION
+  std::array<uint8_t, IOP_COMPRESSION_BUFFER> deflated;
+  /// Unknown until the server answers a request that asks if it inflates bodies, then fixed until reboot
+  std::optional<bool> serverInflates;
+#endif
 
 public:
   static constexpr size_t JsonCapacity = IOP_JSON_CAPACITY;
-  using Json = std::unique_ptr<const std::array<char, JsonCapacity>>;
+  /// Pooled with `IOP_STATIC_ARENA`, heap allocated otherwise
+  using Json = Box<const std::array<char, JsonCapacity>>;
 
   Api(iop::StaticString uri) noexcept;
 
@@ -46,7 +61,7 @@ public:
   /// IO_ERROR: problems with connection, retry later?
   /// BROKEN_CLIENT: IOP_JSON_CAPACITY is too small to contain this payload
   /// BROKEN_SERVER: must wait until server is fixed
-  auto authenticate(std::string_view organization, std::string_view username, std::string_view password) noexcept -> std::variant<std::unique_ptr<AuthToken>, iop::NetworkStatus>;
+  auto authenticate(std::string_view organization, std::string_view username, std::string_view password) noexcept -> std::variant<Box<AuthToken>, iop::NetworkStatus>;
 
   /// Sends a monitoring event to the server, also sends device metadata.
   ///
@@ -55,10 +70,19 @@ public:
   /// OK: success
   /// UNAUTHORIZED: auth token is invalid
   /// IO_ERROR: problems with the connection, retry later?
-  /// BROKEN_CLIENT: unreachable, doesn't allocate for the payload
+  /// BROKEN_CLIENT: the payload is missing, as `makeJson` failed
   /// BROKEN_SERVER: must wait until the server is fixed
   auto registerEvent(const AuthToken &token, const Api::Json &event) noexcept -> iop::NetworkStatus;
 
+  /// Sends an already serialized event, like a typed `iop::Event`. Return values are the same, but BROKEN_CLIENT is unreachable
+  auto registerEvent(const AuthToken &token, std::string_view event) noexcept -> iop::NetworkStatus;
+
+  /// Sends a batch of samples encoded by `iop::TimeSeries` to `/v1/event/series`. Return values are the same as `registerEvent`'s
+  ///
+  /// The body is binary and has NUL bytes. iop-hal's `Network::httpPost` sends a `std::string_view` body verbatim, `series.length()`
+  /// bytes with that Content-Length, it's never treated as a NUL terminated string
+  auto registerSeries(const AuthToken &token, std::string_view series) noexcept -> iop::NetworkStatus;
+
   /// Sends a panic message to the monitor server.
   ///
   /// Truncates the message as needed to avoid OOM.
@@ -72,6 +96,18 @@ public:
   /// BROKEN_SERVER: must wait until the server is fixed
   auto reportPanic(const AuthToken &authToken, const PanicData &event) noexcept -> iop::NetworkStatus;
 
+  /// Sends a post-mortem crash report, collected in a previous boot, to the monitor server.
+  ///
+  /// Truncates the message, and then the stack window, as needed to avoid OOM.
+  ///
+  /// Return values are the same as the `PanicData` overload
+  auto reportPanic(const AuthToken &authToken, const CrashReport &report) noexcept -> iop::NetworkStatus;
+
+  /// Returns (and forgets) how long the monitor server asked a panicking device to wait before checking for updates again.
+  ///
+  /// It's sent in response to the panic report as `{"next_check": seconds}`.
+  auto takeNextCheckHint() noexcept -> std::optional<iop::time::milliseconds>;
+
   /// Reports log message to server.
   ///
   /// Return values:
@@ -102,6 +138,22 @@ public:
   ///
   /// Gets a context name for logging purposes. And a callback that insert data into the JSON serializer abstraction.
   auto makeJson(iop::StaticString contextName, Api::JsonCallback jsonObjectBuilder) noexcept -> Api::Json;
+
+#ifdef IOP_LINUX_MOCK
+  /// `radio::off` is a no-op in linux, so the loop tells its `Api` to fail requests with IO_ERROR while the radio is off, like devices
+  auto setRadioOff(bool off) noexcept -> void { this->radioOff = off; }
+#endif
+
+private:
+  /// Requests can't reach the server, only while the simulated radio is off
+  auto unreachable() const noexcept -> bool;
+
+  /// Posts `body` to `path`. With IOP_COMPRESSION bodies of at least IOP_COMPRESSION_MIN_BYTES are deflated and posted
+  /// to `deflatedPath` instead, once the server said it inflates them: the first one is posted as is to `probePath`, and the
+  /// server enables compression by answering `{"accept_encoding": "deflate"}`. A 415 (Unsupported Media Type) later disables it,
+  /// and the body is resent as is
+  auto post(const AuthToken &authToken, iop::StaticString path, iop::StaticString probePath, iop::StaticString deflatedPath, std::string_view body, iop::StaticString context) noexcept -> iop::NetworkStatus;
+  auto sendPanic(const AuthToken &authToken, const Api::Json &json) noexcept -> iop::NetworkStatus;
 };
 
 /// Represents the data passed to the panic hook
@@ -0,0 +1,124 @@
+#ifndef IOP_ARENA_HPP
+#define IOP_ARENA_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <cstring>
+#include <utility>
+
+/// Define IOP_STATIC_ARENA so the framework doesn't touch the heap after setup.
+///
+/// JSON documents and buffers, auth tokens, captive portal credentials and the network log buffer come from fixed pools,
+/// reserved at link time. Exhausting a pool fails like an allocation failure (`NetworkStatus::BROKEN_CLIENT`), so size them below.
+///
+/// `EventLoop::setup` doesn't reserve them, there is nothing left to do: pools are constant initialized statics, so their memory is
+/// in .bss before any code runs, and can't fail or fragment the heap later. Reserving from the heap at setup would only add that risk.
+#ifndef IOP_ARENA_JSON_DOCUMENTS
+#define IOP_ARENA_JSON_DOCUMENTS 1
+#endif
+
+/// A JSON buffer is alive while its event is sent, plus one for the log and panic reports
+#ifndef IOP_ARENA_JSON_BUFFERS
+#define IOP_ARENA_JSON_BUFFERS 2
+#endif
+
+#ifndef IOP_ARENA_AUTH_TOKENS
+#define IOP_ARENA_AUTH_TOKENS 1
+#endif
+
+/// Credentials submitted to the captive portal that are waiting to be used, per kind
+#ifndef IOP_ARENA_CREDENTIALS
+#define IOP_ARENA_CREDENTIALS 1
+#endif
+
+/// Maximum length of the IoP organization, email and password submitted to the captive portal
+#ifndef IOP_ARENA_CREDENTIAL_SIZE
+#define IOP_ARENA_CREDENTIAL_SIZE 64
+#endif
+
+/// Logs longer than this are truncated before being sent to the monitor server
+#ifndef IOP_ARENA_LOG_SIZE
+#define IOP_ARENA_LOG_SIZE 512
+#endif
+
+namespace iop {
+/// Deleter that returns the object to the pool it came from, or to the heap if it didn't come from one
+template <typename T>
+struct Release {
+  void (*release)(const T*) = nullptr;
+
+  auto operator()(T *ptr) const noexcept -> void {
+    if (this->release) {
+      this->release(ptr);
+    } else {
+      delete ptr;
+    }
+  }
+};
+
+/// Owning pointer to either a heap or a pool allocated object
+template <typename T>
+using Box = std::unique_ptr<T, Release<T>>;
+
+/// Fixed number of slots for objects of type `T`, allocation never touches the heap.
+///
+/// It's lock-free, so it may be used from many threads (or many `EventLoop`s), but not from interrupts.
+template <typename T, size_t SIZE>
+class Pool {
+  // Initialized, so the pool is constant initialized (zeroed in .bss), not constructed at startup
+  alignas(T) std::array<std::array<uint8_t, sizeof(T)>, SIZE> slots = {};
+  std::array<std::atomic<bool>, SIZE> used = {};
+
+public:
+  /// Constructs `T` in a free slot, returns nullptr if they are all used.
+  ///
+  /// `release` must return the object to this pool, it's a plain function so `Box` doesn't grow
+  template <typename ...Args>
+  auto make(void (*release)(const T*), Args&& ...args) noexcept -> Box<T> {
+    for (size_t index = 0; index < SIZE; ++index) {
+      auto expected = false;
+      if (this->used[index].compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+        auto *ptr = new (this->slots[index].data()) T(std::forward<Args>(args)...);
+        return Box<T>(ptr, Release<T>{release});
+      }
+    }
+    return Box<T>(nullptr, Release<T>{release});
+  }
+
+  auto release(const T *ptr) noexcept -> void {
+    if (!ptr) return;
+    ptr->~T();
+
+    const auto *raw = reinterpret_cast<const uint8_t*>(ptr);
+    const auto index = static_cast<size_t>(raw - this->slots[0].data()) / sizeof(T);
+    this->used[index].store(false, std::memory_order_release);
+  }
+
+  /// Slots in use, for diagnostics
+  auto inUse() const noexcept -> size_t {
+    size_t count = 0;
+    for (const auto &slot: this->used) count += slot.load(std::memory_order_relaxed);
+    return count;
+  }
+};
+
+/// String with inline storage, values longer than `SIZE` are truncated
+template <size_t SIZE>
+class FixedString {
+  std::array<char, SIZE> data_;
+  size_t length_;
+
+public:
+  explicit FixedString(const std::string_view value) noexcept: data_(), length_(std::min(value.length(), SIZE)) {
+    memcpy(this->data_.data(), value.data(), this->length_);
+  }
+
+  auto view() const noexcept -> std::string_view { return std::string_view(this->data_.data(), this->length_); }
+  operator std::string_view() const noexcept { return this->view(); }
+};
+}
+#endif
@@ -0,0 +1,47 @@
+#ifndef IOP_CLOCK_HPP
+#define IOP_CLOCK_HPP
+
+#include "iop/utils.hpp"
+
+namespace iop {
+#ifdef IOP_LINUX_MOCK
+/// Virtual time of a simulated device. Each `EventLoop` can have its own, see `EventLoop::useClock`
+struct VirtualClock {
+  bool enabled = false;
+  iop::time::milliseconds now = 0;
+  iop::time::milliseconds yieldStep = 1;
+};
+#endif
+
+/// Time source of the framework, every schedule is computed from it.
+///
+/// It forwards to `iop_hal`, but in `IOP_LINUX_MOCK` it can be switched to virtual time, that only moves when advanced.
+/// So a simulated week of retries, NTP syncs and panic sleeps runs in milliseconds, and is reproducible.
+namespace clock {
+  /// Milliseconds since boot
+  auto now() noexcept -> iop::time::milliseconds;
+  /// Lets the platform run its tasks (WiFi stack, watchdog)
+  auto yield() noexcept -> void;
+  auto sleep(iop::time::milliseconds duration) noexcept -> void;
+  /// Device reboots when it wakes up, in virtual time it returns after advancing the clock, simulating the wake up
+  auto deepSleep(uintmax_t seconds) noexcept -> void;
+
+#ifdef IOP_LINUX_MOCK
+  /// Freezes time at `start`, from now on it only moves with `advance`, `sleep`, `deepSleep` and `yield`
+  auto useVirtualTime(iop::time::milliseconds start = 0) noexcept -> void;
+  /// Goes back to the wall clock
+  auto useRealTime() noexcept -> void;
+  auto isVirtual() noexcept -> bool;
+  auto advance(iop::time::milliseconds duration) noexcept -> void;
+  /// How much each `yield` advances virtual time, it's what makes busy-waits with deadlines end. Defaults to 1ms
+  auto setYieldStep(iop::time::milliseconds step) noexcept -> void;
+
+  /// Makes `clock` the one used by this thread (or the process wide one, if `nullptr`), returns the previous one.
+  ///
+  /// The functions above act on it, `EventLoop` installs its own while it runs
+  auto install(VirtualClock *clock) noexcept -> VirtualClock*;
+#endif
+}
+}
+
+#endif
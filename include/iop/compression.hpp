@@ -0,0 +1,40 @@
+#ifndef IOP_COMPRESSION_HPP
+#define IOP_COMPRESSION_HPP
+
+#include <optional>
+#include <string_view>
+#include <stdint.h>
+#include <stddef.h>
+
+/// Define IOP_COMPRESSION to deflate log and event bodies, see `Api`. Off by default
+///
+/// Farthest back a match may reference. The whole body is already in memory, so it costs no RAM, but the server
+/// decompresses with this window
+#ifndef IOP_COMPRESSION_WINDOW
+#define IOP_COMPRESSION_WINDOW 1024
+#endif
+
+/// Entries of the match finder's hash table, 2 bytes each, kept in the stack while compressing. Must be a power of two
+#ifndef IOP_COMPRESSION_HASH_ENTRIES
+#define IOP_COMPRESSION_HASH_ENTRIES 256
+#endif
+
+/// Output buffer, bodies that don't compress to fit it are sent uncompressed
+#ifndef IOP_COMPRESSION_BUFFER
+#define IOP_COMPRESSION_BUFFER 1024
+#endif
+
+/// Smaller bodies aren't worth it, the zlib framing alone takes 6 bytes
+#ifndef IOP_COMPRESSION_MIN_BYTES
+#define IOP_COMPRESSION_MIN_BYTES 128
+#endif
+
+namespace iop {
+namespace compression {
+  /// Compresses `input` in the zlib format (HTTP's `deflate` encoding), with fixed Huffman codes and greedy matching.
+  ///
+  /// Returns the compressed length, or std::nullopt if it doesn't fit in `capacity` (or `input` is bigger than 64KB)
+  auto deflate(std::string_view input, uint8_t *output, size_t capacity) noexcept -> std::optional<size_t>;
+}
+}
+#endif
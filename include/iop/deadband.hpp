@@ -0,0 +1,77 @@
+#ifndef IOP_DEADBAND_HPP
+#define IOP_DEADBAND_HPP
+
+#include "iop/event.hpp"
+#include "iop/clock.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <optional>
+
+namespace iop {
+/// How much a field must change, since the last event sent, for a new one to be sent.
+///
+/// The band is the biggest of `absolute` and `relative` times the last value sent, so a small `absolute` keeps
+/// `relative` from reacting to noise near zero. Zero for both sends any change
+struct Threshold {
+  double absolute;
+  /// Fraction of the last value sent, 0.05 means 5%
+  double relative;
+};
+
+/// Suppresses typed events whose fields are all within their thresholds of the last event sent, see `EventLoop::registerEvent`.
+///
+/// An event is sent anyway after `heartbeat` milliseconds of silence, so the server can tell an unchanged reading from a dead device.
+///
+/// ```
+/// IOP_EVENT_FIELD(soil_resistivity, uint16_t);
+/// IOP_EVENT_FIELD(soil_temperature_celsius, float);
+/// iop::Deadband<soil_resistivity, soil_temperature_celsius> deadband(60 * 60 * 1000, {{ {10, 0.02}, {0.5, 0} }});
+///
+/// loop.registerEvent(token, iop::Event<soil_resistivity, soil_temperature_celsius>(...), deadband);
+/// ```
+template <typename ...Fields>
+class Deadband {
+  static_assert((... && std::is_arithmetic_v<typename Fields::Type>), "Deadband fields must be numbers or booleans");
+
+  iop::time::milliseconds heartbeat;
+  std::array<Threshold, sizeof...(Fields)> thresholds;
+  std::array<double, sizeof...(Fields)> last = {};
+  std::optional<iop::time::milliseconds> lastSent;
+  uint32_t suppressed_ = 0;
+
+  auto exceeds(const size_t index, const double value) const noexcept -> bool {
+    const auto &threshold = this->thresholds[index];
+    const auto band = std::max(threshold.absolute, threshold.relative * std::abs(this->last[index]));
+    const auto delta = std::abs(value - this->last[index]);
+    return band == 0 ? delta != 0 : delta > band;
+  }
+
+public:
+  Deadband(const iop::time::milliseconds heartbeat, const std::array<Threshold, sizeof...(Fields)> thresholds) noexcept:
+    heartbeat(heartbeat), thresholds(thresholds) {}
+
+  /// Whether `event` must be sent, if not it's counted as suppressed
+  auto changed(const Event<Fields...> &event) noexcept -> bool {
+    if (!this->lastSent || iop::clock::now() - *this->lastSent >= this->heartbeat) return true;
+
+    size_t index = 0;
+    auto changed = false;
+    ((changed = this->exceeds(index++, static_cast<double>(event.template get<Fields>())) || changed), ...);
+
+    if (!changed) this->suppressed_ += 1;
+    return changed;
+  }
+
+  /// Records `event` as the last one sent, thresholds are relative to it
+  auto sent(const Event<Fields...> &event) noexcept -> void {
+    this->last = { static_cast<double>(event.template get<Fields>())... };
+    this->lastSent = iop::clock::now();
+  }
+
+  /// Events suppressed since boot
+  auto suppressed() const noexcept -> uint32_t { return this->suppressed_; }
+};
+}
+#endif
@@ -0,0 +1,134 @@
+#ifndef IOP_EVENT_HPP
+#define IOP_EVENT_HPP
+
+#include "iop/utils.hpp"
+#include "iop/aggregate.hpp"
+
+#include <ArduinoJson.h>
+#include <array>
+#include <limits>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+/// Declares a typed event field, the key is the field's name.
+///
+/// `IOP_EVENT_FIELD(air_temperature_celsius, float);` declares `struct air_temperature_celsius { float value; }`.
+///
+/// Supported types are `bool`, integers, floating points, `std::array<char, N>` (NUL padded strings) and `iop::Summary`.
+/// The type is variadic so it may contain commas
+#define IOP_EVENT_FIELD(NAME, ...)                         \
+  struct NAME {                                            \
+    using Type = __VA_ARGS__;                              \
+    constexpr static std::string_view key = #NAME;         \
+    Type value;                                            \
+  }
+
+namespace iop {
+namespace event {
+  /// Serialization bounds of a field's value: `length` is the longest JSON it may produce,
+  /// `stored` is how many bytes ArduinoJson copies into the document. Unsupported types don't compile
+  template <typename T, typename = void>
+  struct Bounds;
+
+  template <>
+  struct Bounds<bool> {
+    constexpr static size_t length = 5; // false
+    constexpr static size_t stored = 0;
+  };
+
+  template <typename T>
+  struct Bounds<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>> {
+    constexpr static size_t length = std::numeric_limits<T>::digits10 + 1 + std::is_signed_v<T>;
+    constexpr static size_t stored = 0;
+  };
+
+  /// ArduinoJson switches to exponent notation above 1e7 and writes up to 9 decimals: -9999999.999999999 or -1.234567891e-308
+  template <typename T>
+  struct Bounds<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+    constexpr static size_t length = 24;
+    constexpr static size_t stored = 0;
+  };
+
+  /// Each character may be escaped as \u00XX
+  template <size_t SIZE>
+  struct Bounds<std::array<char, SIZE>> {
+    constexpr static size_t length = SIZE * 6 + 2;
+    constexpr static size_t stored = SIZE + 1;
+  };
+
+  /// Nested object with the count and four floating points
+  template <>
+  struct Bounds<Summary> {
+    // Braces, commas, then each `"key":` and its value
+    constexpr static size_t length = 2 + 4 + (8 + 10) + (6 + 24) + (6 + 24) + (7 + 24) + (11 + 24);
+    constexpr static size_t stored = JSON_OBJECT_SIZE(5);
+  };
+
+  template <typename T>
+  struct IsString: std::false_type {};
+  template <size_t SIZE>
+  struct IsString<std::array<char, SIZE>>: std::true_type {};
+
+  template <typename T>
+  auto write(JsonDocument &doc, const std::string_view key, const T &value) noexcept -> void {
+    // Keys are literals, so ArduinoJson links them instead of copying
+    if constexpr (IsString<T>::value) {
+      doc[key.data()] = iop::to_view(value);
+    } else if constexpr (std::is_same_v<T, Summary>) {
+      auto object = doc.createNestedObject(key.data());
+      object["count"] = value.count;
+      object["min"] = value.min;
+      object["max"] = value.max;
+      object["mean"] = value.mean;
+      object["variance"] = value.variance();
+    } else {
+      doc[key.data()] = value;
+    }
+  }
+}
+
+/// Event with fields declared at compile time (see `IOP_EVENT_FIELD`), its document and buffer are sized exactly.
+///
+/// A field that doesn't fit is a compile error, instead of a `BROKEN_CLIENT` at runtime. Serialization uses the stack only.
+///
+/// ```
+/// IOP_EVENT_FIELD(air_temperature_celsius, float);
+/// IOP_EVENT_FIELD(air_humidity_percentage, float);
+/// using Measurement = iop::Event<air_temperature_celsius, air_humidity_percentage>;
+///
+/// loop.registerEvent(token, Measurement(air_temperature_celsius { 20.5 }, air_humidity_percentage { 60 }));
+/// ```
+template <typename ...Fields>
+class Event {
+  static_assert(sizeof...(Fields) > 0, "Events must have at least one field");
+
+  std::tuple<Fields...> fields;
+
+public:
+  /// Exact `StaticJsonDocument` capacity
+  constexpr static size_t capacity = JSON_OBJECT_SIZE(sizeof...(Fields)) + (0 + ... + event::Bounds<typename Fields::Type>::stored);
+  /// Longest serialization: braces, commas and each `"key":value`
+  constexpr static size_t maxLength = 2 + (sizeof...(Fields) - 1) + (0 + ... + (Fields::key.length() + 3 + event::Bounds<typename Fields::Type>::length));
+
+  /// Includes the NUL terminator
+  using Buffer = std::array<char, maxLength + 1>;
+
+  explicit Event(Fields ...values) noexcept: fields(values...) {}
+
+  /// Value of one of the event's fields
+  template <typename Field>
+  auto get() const noexcept -> const typename Field::Type & { return std::get<Field>(this->fields).value; }
+
+  /// Serializes into `buffer`, returning the JSON
+  auto serialize(Buffer &buffer) const noexcept -> std::string_view {
+    StaticJsonDocument<capacity> doc;
+    std::apply([&doc](const Fields &...field) { (event::write(doc, Fields::key, field.value), ...); }, this->fields);
+    iop_assert(!doc.overflowed(), IOP_STR("Event capacity is wrong"));
+
+    const auto length = serializeJson(doc, buffer.data(), buffer.size());
+    return std::string_view(buffer.data(), length);
+  }
+};
+}
+#endif
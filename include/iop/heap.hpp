@@ -0,0 +1,94 @@
+#ifndef IOP_HEAP_HPP
+#define IOP_HEAP_HPP
+
+#include "iop/utils.hpp"
+
+/// Define IOP_HEAP_TRACKING to attribute heap usage to each event loop phase and task.
+///
+/// In linux it replaces the global operator new, counting every allocation. In devices the allocator can't be hooked,
+/// so it measures how much free heap each phase and task consumed.
+#ifndef IOP_HEAP_REPORT_MILLIS
+#define IOP_HEAP_REPORT_MILLIS (60 * 60 * 1000)
+#endif
+
+namespace iop {
+/// Phases of an event loop iteration, heap usage is attributed to the innermost one
+enum class LoopPhase : uint8_t {
+  SETUP,
+  INTERRUPTS,
+  /// WiFi, credentials, captive portal and NTP, anything outside of the other phases
+  CONNECTIVITY,
+  /// Crash reports and boot timeline
+  REPORTS,
+  /// Tasks' own allocations are attributed to each task, this is the scheduling overhead
+  AUTHENTICATED_TASKS,
+  TASKS,
+  SPLIT_TASKS,
+};
+constexpr static uint8_t loopPhases = 7;
+
+auto loopPhaseToString(LoopPhase phase) noexcept -> iop::StaticString;
+
+struct HeapUsage {
+  /// Only tracked in linux
+  uint32_t allocations = 0;
+  uint32_t frees = 0;
+  uint64_t bytes = 0;
+  /// Only tracked in devices. Sum of how much free heap changed during each scope, negative means memory was retained.
+  /// Nested scopes' changes are attributed only to them, like the allocations in linux
+  int32_t freeHeapDelta = 0;
+};
+
+/// Attributes this thread's heap usage to `usage` while alive, nested scopes take precedence. No-op without IOP_HEAP_TRACKING
+class HeapScope {
+#ifdef IOP_HEAP_TRACKING
+  HeapUsage *previous;
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+  HeapUsage &usage;
+  uint32_t freeAtStart;
+  HeapScope *parent;
+  /// How much free heap changed inside nested scopes, it's subtracted from this one
+  int32_t childrenDelta;
+#endif
+#endif
+
+public:
+  explicit HeapScope(HeapUsage &usage) noexcept;
+  ~HeapScope() noexcept;
+  HeapScope(HeapScope const &other) noexcept = delete;
+  auto operator=(HeapScope const &other) noexcept -> HeapScope & = delete;
+};
+
+namespace heap {
+  struct Stats {
+    uint32_t free;
+    /// Biggest allocation that can succeed
+    uint32_t largestBlock;
+    /// Percentage, 0 means all free memory is contiguous
+    uint8_t fragmentation;
+  };
+
+  /// Allocator state, zeroed in linux as the OS owns the heap
+  auto stats() noexcept -> Stats;
+
+  /// Every allocation since boot, only tracked in linux with IOP_HEAP_TRACKING
+  auto total() noexcept -> HeapUsage;
+
+  /// Asserts steady state code doesn't allocate: while alive, any allocation in this thread panics.
+  ///
+  /// Only enforced in linux with IOP_HEAP_TRACKING, meant for tests and benchmarks
+  class Forbid {
+#ifdef IOP_HEAP_TRACKING
+    bool previous;
+#endif
+
+  public:
+    Forbid() noexcept;
+    ~Forbid() noexcept;
+    Forbid(Forbid const &other) noexcept = delete;
+    auto operator=(Forbid const &other) noexcept -> Forbid & = delete;
+  };
+}
+}
+
+#endif
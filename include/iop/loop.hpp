@@ -8,9 +8,18 @@
 #include "iop-hal/panic.hpp"
 #include "iop/storage.hpp"
 #include "iop/server.hpp"
+#include "iop/timeline.hpp"
+#include "iop/clock.hpp"
+#include "iop/heap.hpp"
+#include "iop/watchdog.hpp"
+#include "iop/event.hpp"
+#include "iop/deadband.hpp"
+#include "iop/series.hpp"
+#include "iop/radio.hpp"
 #include "iop/utils.hpp"
 
 #include <functional>
+#include <memory>
 #include <optional>
 
 namespace iop {
@@ -21,18 +30,67 @@ enum class ConnectResponse {
   TIMEOUT,
 };
 
+/// Tasks of a higher class run first, within a class the most overdue runs first.
+///
+/// `CRITICAL` tasks, like actuator control, are also checked between the phases of the loop (before serving the captive portal,
+/// after each network call and after each lower priority task), so they aren't delayed by more than one blocking operation
+enum class Priority {
+  CRITICAL = 0,
+  NORMAL,
+  LOW,
+};
+constexpr static uint8_t priorities = 3;
+
 struct TaskInterval {
   iop::time::milliseconds next;
   uint32_t interval;
   std::function<void(EventLoop&)> func;
-  TaskInterval(iop::time::milliseconds interval, std::function<void(EventLoop&)> func) noexcept;
+  Priority priority;
+  iop::time::milliseconds maxRunTime;
+  HeapUsage heap;
+  TaskInterval(iop::time::milliseconds interval, std::function<void(EventLoop&)> func, Priority priority, iop::time::milliseconds maxRunTime) noexcept;
 };
 
 struct AuthenticatedTaskInterval {
   iop::time::milliseconds next;
   uint32_t interval;
   std::function<void(EventLoop&, const AuthToken&)> func;
-  AuthenticatedTaskInterval(iop::time::milliseconds interval, std::function<void(EventLoop&, const AuthToken&)> func) noexcept;
+  Priority priority;
+  iop::time::milliseconds maxRunTime;
+  HeapUsage heap;
+  AuthenticatedTaskInterval(iop::time::milliseconds interval, std::function<void(EventLoop&, const AuthToken&)> func, Priority priority, iop::time::milliseconds maxRunTime) noexcept;
+};
+
+/// When a split-phase task resumes: as soon as `ready` returns true, polled every iteration, or once `timeout` elapses.
+///
+/// Without `ready` it just waits `timeout`, like a DS18B20 conversion. `ready` must be cheap, it runs every iteration
+struct Resume {
+  iop::time::milliseconds timeout;
+  std::function<bool()> ready;
+  explicit Resume(iop::time::milliseconds timeout, std::function<bool()> ready = nullptr) noexcept;
+};
+
+struct SplitTaskInterval {
+  iop::time::milliseconds next;
+  uint32_t interval;
+  std::function<std::optional<Resume>(EventLoop&)> start;
+  std::function<void(EventLoop&, bool)> finish;
+  /// Set while the operation is in flight
+  std::optional<Resume> pending;
+  iop::time::milliseconds deadline;
+  /// Of each part, `start` and `finish`
+  iop::time::milliseconds maxRunTime;
+  HeapUsage heap;
+  SplitTaskInterval(iop::time::milliseconds interval, std::function<std::optional<Resume>(EventLoop&)> start, std::function<void(EventLoop&, bool)> finish, iop::time::milliseconds maxRunTime) noexcept;
+};
+
+/// A task that started more than a whole interval late, skipping runs, or that ran for longer than its maximum run time
+struct DeadlineMiss {
+  LoopPhase phase;
+  /// Index in its phase, in registration order
+  uint16_t task;
+  iop::time::milliseconds late;
+  iop::time::milliseconds took;
 };
 
 class EventLoop {
@@ -41,15 +99,53 @@ private:
   Api api_;
   iop::Log logger_;
   Storage storage_;
+  BootTimeline bootTimeline;
+  /// The firmware was hashed in this boot, needed to trust the cached MD5 when the image has no identity
+  bool hashedFirmware = false;
 
   iop::time::milliseconds nextNTPSync;
 
-  iop::time::milliseconds nextTryStorageWifiCredentials;
+  /// Each stored network has its own backoff, so a router that is down doesn't delay the others
+  std::array<iop::time::milliseconds, Storage::wifiSlots> nextTryStorageWifi;
+  /// Failures since the last successful connection, only persisted along with the next success to spare writes
+  std::array<uint16_t, Storage::wifiSlots> storageWifiFailures;
   iop::time::milliseconds nextTryHardcodedWifiCredentials;
   iop::time::milliseconds nextTryHardcodedIopCredentials;
+  iop::time::milliseconds nextTryCrashReport;
 
   std::vector<TaskInterval> tasks;
   std::vector<AuthenticatedTaskInterval> authenticatedTasks;
+  std::vector<SplitTaskInterval> splitTasks;
+
+  std::function<void(EventLoop&, const Interrupt&)> interruptHandler;
+  uint32_t droppedInterrupts = 0;
+  /// A `MUST_UPGRADE` interrupt waits here for a token and the network, so it isn't lost
+  bool pendingUpgrade = false;
+  uint32_t suppressedEvents_ = 0;
+  /// How late tasks ran, per priority
+  std::array<Summary, priorities> lateness_;
+  uint32_t deadlineMisses_ = 0;
+  uint32_t reportedDeadlineMisses = 0;
+  std::optional<DeadlineMiss> lastDeadlineMiss;
+  iop::time::milliseconds nextDeadlineMissReport = 0;
+
+  RadioPolicy radioPolicy;
+  /// Turned off by the loop until the next network deadline
+  bool radioOff = false;
+  iop::time::milliseconds radioOnSince = 0;
+  /// Radio-on time of the periods that already ended
+  iop::time::milliseconds radioOnMillis = 0;
+  uint32_t radioWakes = 0;
+  iop::time::milliseconds nextRadioReport = IOP_RADIO_REPORT_MILLIS;
+
+  std::array<HeapUsage, loopPhases> heapUsage_;
+  iop::time::milliseconds nextHeapReport = 0;
+
+#ifdef IOP_LINUX_MOCK
+  VirtualClock *clock_ = nullptr;
+#endif
+
+  friend class RunningLoop;
 
 public:
   auto api() noexcept -> Api &{ return this->api_; }
@@ -58,9 +154,15 @@ public:
   auto setup() noexcept -> void;
   auto loop() noexcept -> void;
 
+  /// MD5 of the running firmware, cached in storage as hashing the whole image is slow.
+  ///
+  /// The cache is kept across boots only if the image has an identity (see `build_flags.py`), so a new image is always hashed
+  auto firmwareMD5() noexcept -> std::string_view;
+
   auto setAccessPointCredentials(StaticString SSID, StaticString PSK) noexcept -> void;
   auto setTimezone(int8_t timezone) const noexcept -> void;
   auto setCleanup(iop::PanicHook::Cleanup) const noexcept -> void;
+  auto setPanicWakeSchedule(Backoff schedule) const noexcept -> void;
 
   /// Connects to WiFi
   auto connect(std::string_view ssid, std::string_view password) noexcept -> ConnectResponse;
@@ -68,16 +170,165 @@ public:
   /// Uses IoP credentials to generate an authentication token for the device
   auto handleAuthenticationFailure(iop::NetworkStatus status) noexcept -> void;
 
-  auto setInterval(iop::time::milliseconds interval, std::function<void(EventLoop&)> func) noexcept -> void;
-  auto setAuthenticatedInterval(iop::time::milliseconds interval, std::function<void(EventLoop&, const AuthToken&)> func) noexcept -> void;
+  /// A task running for longer than `maxRunTime` is a deadline miss, with `IOP_WATCHDOG` the device is reset and the task
+  /// is sent with the crash report. Tasks are identified by their registration order, see `iop::watchdog`
+  auto setInterval(iop::time::milliseconds interval, std::function<void(EventLoop&)> func, Priority priority = Priority::NORMAL, iop::time::milliseconds maxRunTime = IOP_WATCHDOG_TASK_MILLIS) noexcept -> void;
+  auto setAuthenticatedInterval(iop::time::milliseconds interval, std::function<void(EventLoop&, const AuthToken&)> func, Priority priority = Priority::NORMAL, iop::time::milliseconds maxRunTime = IOP_WATCHDOG_TASK_MILLIS) noexcept -> void;
+  /// Split-phase task, for operations that take long without needing the CPU, like sensor conversions.
+  ///
+  /// Every `interval` `start` begins the operation and returns when to resume, the loop keeps running the other tasks
+  /// (and the captive portal) meanwhile, then `finish` collects the result. Many of them may be in flight at the same time,
+  /// so sensors convert in parallel. `start` returning `std::nullopt` skips `finish`, like when the sensor is missing.
+  /// `finish`'s flag is true if `ready` never returned true before the timeout.
+  ///
+  /// ```
+  /// loop.setSplitInterval(60 * 1000, [](EventLoop &loop) {
+  ///   sensors.setWaitForConversion(false);
+  ///   sensors.requestTemperatures();
+  ///   return std::make_optional(iop::Resume(750));
+  /// }, [](EventLoop &loop, bool timedOut) {
+  ///   const auto token = loop.storage().token();
+  ///   if (token) loop.registerEvent(token->get(), Measurement(soil_temperature_celsius { sensors.getTempCByIndex(0) }));
+  /// });
+  /// ```
+  auto setSplitInterval(iop::time::milliseconds interval, std::function<std::optional<Resume>(EventLoop&)> start, std::function<void(EventLoop&, bool)> finish, iop::time::milliseconds maxRunTime = IOP_WATCHDOG_TASK_MILLIS) noexcept -> void;
   auto registerEvent(const AuthToken& token, const Api::Json json) noexcept -> void;
+  auto registerEvent(const AuthToken& token, std::string_view json) noexcept -> void;
+
+  /// Serializes a typed event in the stack, its size is known at compile time. See `iop::Event`
+  template <typename ...Fields>
+  auto registerEvent(const AuthToken& token, const Event<Fields...> &event) noexcept -> void {
+    typename Event<Fields...>::Buffer buffer;
+    this->registerEvent(token, event.serialize(buffer));
+  }
+
+  /// Only sends `event` if a field moved out of its deadband, or the heartbeat expired. Suppressed events cost no network I/O
+  template <typename ...Fields>
+  auto registerEvent(const AuthToken& token, const Event<Fields...> &event, Deadband<Fields...> &deadband) noexcept -> void {
+    if (!deadband.changed(event)) {
+      this->suppressedEvents_ += 1;
+      this->logger().debug(IOP_STR("Event within deadband, suppressed since boot: "));
+      this->logger().debugln(this->suppressedEvents_);
+      return;
+    }
+
+    typename Event<Fields...>::Buffer buffer;
+    const auto status = this->api().registerEvent(token, event.serialize(buffer));
+    // Failed events aren't recorded, so the change is sent again
+    if (status == iop::NetworkStatus::OK) deadband.sent(event);
+    this->handleEventStatus(status);
+  }
+
+  /// Sends the samples buffered in `series`, they are cleared if the server accepts them. See `iop::TimeSeries`
+  template <typename ...Fields>
+  auto registerSeries(const AuthToken& token, TimeSeries<Fields...> &series) noexcept -> void {
+    if (!series.size()) return;
+
+    // Too big for the stack, one per series type
+    static IOP_THREAD_LOCAL typename TimeSeries<Fields...>::Buffer buffer;
+    const auto status = this->api().registerSeries(token, series.serialize(buffer, iop::clock::now()));
+    if (status == iop::NetworkStatus::OK) series.clear();
+    this->handleEventStatus(status);
+  }
+
+  /// How late, in milliseconds, the tasks of `priority` ran compared to their schedule since boot, the actuation jitter
+  auto lateness(Priority priority) const noexcept -> const Summary & { return this->lateness_[static_cast<uint8_t>(priority)]; }
+
+  /// How the radio is used between network-bound work. With `RadioMode::OFF` the loop turns the radio off whenever nothing
+  /// needs the network for `minimumOff` (authenticated tasks, NTP, pending reports and buffered logs), running only the
+  /// other tasks meanwhile, and reconnects `wakeAhead` before the next deadline. Tasks that need the network must be authenticated tasks.
+  auto setRadioPolicy(RadioPolicy policy) noexcept -> void;
+  /// Milliseconds the radio was on since boot, unless the mode is `ALWAYS_ON` it's sent as a `radio` event every `IOP_RADIO_REPORT_MILLIS`
+  auto radioOnTime() const noexcept -> iop::time::milliseconds;
+
+  /// Tasks that missed their deadline since boot, they are reported as `deadline_misses` events
+  auto deadlineMisses() const noexcept -> uint32_t { return this->deadlineMisses_; }
+
+  /// Events suppressed by deadbands since boot, across all of them
+  auto suppressedEvents() const noexcept -> uint32_t { return this->suppressedEvents_; }
+
+#ifdef IOP_LINUX_MOCK
+  /// Runs this loop with its own clock, so many simulated devices keep independent time in the same process.
+  ///
+  /// Without it the thread's clock is used, see `iop::clock::install`
+  auto useClock(VirtualClock &clock) noexcept -> void { this->clock_ = &clock; }
+#endif
+
+  /// Heap usage attributed to `phase` since boot, see `IOP_HEAP_TRACKING`
+  auto heapUsage(LoopPhase phase) const noexcept -> const HeapUsage & { return this->heapUsage_[static_cast<uint8_t>(phase)]; }
+  /// Logs the allocator state and the heap usage of each phase and task. With `IOP_HEAP_TRACKING` it's done every `IOP_HEAP_REPORT_MILLIS`
+  auto logHeapUsage() noexcept -> void;
+
+  /// Runs the due tasks registered with `setAuthenticatedInterval`, the event loop calls it every iteration once authenticated
+  auto runAuthenticatedTasks() noexcept -> void;
+  /// Runs the due tasks registered with `setInterval`, the event loop calls it every iteration
+  auto runUnauthenticatedTasks() noexcept -> void;
+  /// Starts the due tasks registered with `setSplitInterval` and finishes the ready ones, the event loop calls it every iteration
+  auto runSplitTasks() noexcept -> void;
+  /// Runs the due `CRITICAL` tasks, authenticated ones only if there is a token. The event loop calls it between its phases
+  auto runCriticalTasks() noexcept -> void;
+
+  /// Samples a metric every `sampleInterval` and, once authenticated, registers an event with the summary
+  /// (count, min, max, mean and variance) of each `window`, as `Field`. Samples aren't stored.
+  ///
+  /// Windows are consecutive, each starts when the previous one ends, even if it was empty or couldn't be sent.
+  /// `sample` may return `std::nullopt` to skip a sample, like when a sensor read fails. Empty windows aren't sent,
+  /// windows that end before they are sent (not authenticated yet, or the server failed) are merged into the next event.
+  ///
+  /// Sampling runs even with the radio off, sending is an authenticated task so the radio wakes up for it.
+  ///
+  /// ```
+  /// IOP_EVENT_FIELD(air_temperature_celsius, iop::Summary);
+  /// loop.aggregate<air_temperature_celsius>(1000, 5 * 60 * 1000, [](EventLoop &loop) { return sensor.measure(); });
+  /// ```
+  template <typename Field>
+  auto aggregate(iop::time::milliseconds sampleInterval, iop::time::milliseconds window, std::function<std::optional<double>(EventLoop&)> sample) noexcept -> void {
+    static_assert(std::is_same_v<typename Field::Type, Summary>, "Aggregated fields must be iop::Summary");
+
+    struct Window {
+      Summary current;
+      /// Windows that ended and weren't sent yet
+      Summary finished;
+      iop::time::milliseconds end;
+    };
+    // Shared by the sampling and the sending tasks
+    const auto state = std::shared_ptr<Window>(new (std::nothrow) Window { Summary(), Summary(), iop::clock::now() + window });
+    iop_assert(state, IOP_STR("Unable to allocate aggregation window"));
+
+    const auto roll = [window](Window &state) {
+      const auto now = iop::clock::now();
+      if (now < state.end) return;
+      // Skips the windows that ended since, otherwise after an idle period the next window would be a single sample
+      state.end += window > 0 ? ((now - state.end) / window + 1) * window : now - state.end;
+      state.finished.merge(state.current);
+      state.current.clear();
+    };
+
+    this->setInterval(sampleInterval, [sample, state, roll](EventLoop &loop) {
+      if (const auto value = sample(loop)) state->current.add(*value);
+      roll(*state);
+    });
+    this->setAuthenticatedInterval(window, [state, roll](EventLoop &loop, const AuthToken &token) {
+      roll(*state);
+      if (state->finished.count == 0) return;
+
+      typename Event<Field>::Buffer buffer;
+      const auto status = loop.api().registerEvent(token, Event<Field>(Field { state->finished }).serialize(buffer));
+      if (status == iop::NetworkStatus::OK) state->finished.clear();
+      loop.handleEventStatus(status);
+    });
+  }
+
+  /// Handles `InterruptEvent::USER` interrupts, scheduled with `iop::scheduleInterrupt`, in the main loop
+  auto setInterruptHandler(std::function<void(EventLoop&, const Interrupt&)> handler) noexcept -> void;
 
   explicit EventLoop(iop::StaticString uri) noexcept
       : credentialsServer(),
         api_(uri),
         logger_(IOP_STR("LOOP")), storage_(),
-        nextNTPSync(0), nextTryStorageWifiCredentials(0),
-        nextTryHardcodedWifiCredentials(0), nextTryHardcodedIopCredentials(0) {
+        nextNTPSync(0), nextTryStorageWifi(), storageWifiFailures(),
+        nextTryHardcodedWifiCredentials(0), nextTryHardcodedIopCredentials(0),
+        nextTryCrashReport(0) {
     IOP_TRACE();
   }
   ~EventLoop() noexcept = default;
@@ -91,21 +342,43 @@ private:
   auto syncNTP() noexcept -> void;
   auto serve() noexcept -> void;
 
-  auto handleStoredWifiCreds() noexcept -> void;
+  /// Stored network, out of backoff, expected to connect the fastest
+  auto nextStoredWifi() noexcept -> std::optional<uint8_t>;
+  auto handleStoredWifiCreds(uint8_t slot) noexcept -> void;
   
   auto handleHardcodedWifiCreds() noexcept -> void;
   auto handleHardcodedIopCreds() noexcept -> void;
 
   auto handleMeasurements(const AuthToken &token) noexcept -> void;
+  auto handleCrashReport() noexcept -> void;
+  auto handleBootTimeline() noexcept -> void;
+  auto handleDeadlineMisses() noexcept -> void;
+  auto handleRadioReport() noexcept -> void;
 
-  auto handleInterrupts() noexcept -> bool;
-  auto handleInterrupt(const InterruptEvent event, const std::optional<std::reference_wrapper<const AuthToken>> &token) noexcept -> void;
+  /// Earliest moment something needs the network
+  auto nextNetworkDeadline() noexcept -> iop::time::milliseconds;
+  /// Turns the radio off if the next network deadline is far enough, according to the policy
+  auto sleepRadio() noexcept -> void;
+  auto wakeRadio() noexcept -> void;
 
-  auto runAuthenticatedTasks() noexcept -> void;
-  auto runUnauthenticatedTasks() noexcept -> void;
+  auto handleEventStatus(iop::NetworkStatus status) noexcept -> void;
+
+  /// Runs the tasks of `priority` that were due when it was called, earliest deadline first, then `between` after each of them
+  template <typename Task, typename Run, typename Between>
+  auto runDue(std::vector<Task> &tasks, Priority priority, LoopPhase phase, Run run, Between between) noexcept -> void;
+  auto recordDeadlineMiss(DeadlineMiss miss) noexcept -> void;
+
+  auto handleInterrupts() noexcept -> bool;
+  auto handleInterrupt(const Interrupt interrupt, const std::optional<std::reference_wrapper<const AuthToken>> &token) noexcept -> void;
 };
 
 extern auto setup(EventLoop &loop) noexcept -> void;
+/// Default loop, driven by the platform's entrypoint
 extern EventLoop eventLoop;
+
+/// Loop running in this thread (`eventLoop` if none is), the panic and network logging hooks act on it.
+///
+/// Many loops can run in the same process (each in its own thread, or interleaved), as long as they aren't moved after `setup`
+auto currentLoop() noexcept -> EventLoop &;
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,148 @@
+#ifndef IOP_RADIO_HPP
+#define IOP_RADIO_HPP
+
+#include "iop-hal/log.hpp"
+#include "iop/utils.hpp"
+#include <array>
+#include <optional>
+
+namespace iop {
+#ifndef IOP_WIFI_SCAN_RESULTS
+#define IOP_WIFI_SCAN_RESULTS 12
+#endif
+
+/// Scan results newer than this are served without scanning again, scanning disturbs the clients of our access point
+#ifndef IOP_WIFI_SCAN_INTERVAL_MILLIS
+#define IOP_WIFI_SCAN_INTERVAL_MILLIS 30000
+#endif
+
+enum class WifiSecurity : uint8_t { OPEN, PROTECTED };
+
+/// Access point found by a WiFi scan
+struct ScannedNetwork {
+  iop::NetworkName ssid;
+  int8_t rssi;
+  WifiSecurity security;
+  uint8_t channel;
+};
+
+/// Radio parameters of the last successful connection, they allow reconnecting without a full channel scan
+struct WifiRadio {
+  std::array<uint8_t, 6> bssid;
+  uint8_t channel;
+  /// IPv4 lease, all zeroes if unknown. Only reused with `IOP_WIFI_REUSE_IP`, as the DHCP server may have handed it to someone else
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t mask;
+  uint32_t dns;
+
+  auto operator==(const WifiRadio &other) const noexcept -> bool {
+    return this->bssid == other.bssid && this->channel == other.channel && this->ip == other.ip
+        && this->gateway == other.gateway && this->mask == other.mask && this->dns == other.dns;
+  }
+};
+
+#ifndef IOP_WIFI_FAST_CONNECT_MILLIS
+#define IOP_WIFI_FAST_CONNECT_MILLIS 3000
+#endif
+
+/// How the radio is used between network-bound work, see `EventLoop::setRadioPolicy`
+enum class RadioMode : uint8_t {
+  /// Associated all the time, power saving is left as the SDK configures it
+  ALWAYS_ON,
+  /// Stays associated, the modem sleeps between the access point's beacons
+  MODEM_SLEEP,
+  /// Disconnects and turns the radio off until the next network deadline, reconnecting with `radio::fastConnect` just in time
+  OFF,
+};
+
+/// Per deployment default, `ALWAYS_ON`, `MODEM_SLEEP` or `OFF`
+#ifndef IOP_RADIO_MODE
+#define IOP_RADIO_MODE ALWAYS_ON
+#endif
+
+/// The radio is only turned off if nothing needs the network for longer than this, reconnecting costs energy too
+#ifndef IOP_RADIO_MIN_OFF_MILLIS
+#define IOP_RADIO_MIN_OFF_MILLIS (60 * 1000)
+#endif
+
+/// How long before a deadline the radio is turned back on, enough for a fast connect
+#ifndef IOP_RADIO_WAKE_AHEAD_MILLIS
+#define IOP_RADIO_WAKE_AHEAD_MILLIS (IOP_WIFI_FAST_CONNECT_MILLIS + 2000)
+#endif
+
+/// Logs are buffered while the radio is off, they are sent at most this late
+#ifndef IOP_RADIO_LOG_FLUSH_MILLIS
+#define IOP_RADIO_LOG_FLUSH_MILLIS (10 * 60 * 1000)
+#endif
+
+/// Most bytes of logs buffered while the radio is off, the rest are truncated. With IOP_STATIC_ARENA it's `IOP_ARENA_LOG_SIZE`
+#ifndef IOP_RADIO_LOG_BUFFER_BYTES
+#define IOP_RADIO_LOG_BUFFER_BYTES 2048
+#endif
+
+/// How often the radio-on time is sent as an event, unless the mode is `ALWAYS_ON`
+#ifndef IOP_RADIO_REPORT_MILLIS
+#define IOP_RADIO_REPORT_MILLIS (60 * 60 * 1000)
+#endif
+
+struct RadioPolicy {
+  RadioMode mode = RadioMode::IOP_RADIO_MODE;
+  iop::time::milliseconds minimumOff = IOP_RADIO_MIN_OFF_MILLIS;
+  iop::time::milliseconds wakeAhead = IOP_RADIO_WAKE_AHEAD_MILLIS;
+  iop::time::milliseconds logFlush = IOP_RADIO_LOG_FLUSH_MILLIS;
+};
+
+namespace radio {
+  /// Connects directly to the access point's BSSID in its channel, skipping the scan (and DHCP if `IOP_WIFI_REUSE_IP` is defined).
+  ///
+  /// Returns false if it didn't connect within `IOP_WIFI_FAST_CONNECT_MILLIS`, the caller should fallback to a regular connection.
+  /// Always returns false in linux, as it doesn't control the radio.
+  auto fastConnect(std::string_view ssid, std::string_view psk, const WifiRadio &radio) noexcept -> bool;
+
+  /// Radio parameters of the current connection, if connected
+  auto current() noexcept -> std::optional<WifiRadio>;
+
+  /// Signal strength of the current connection in dBm, if connected
+  auto rssi() noexcept -> std::optional<int8_t>;
+
+  /// Power saving while associated: modem sleep. `ALWAYS_ON` leaves the SDK's default (also modem sleep) as is
+  auto setMode(RadioMode mode) noexcept -> void;
+  /// Disconnects and powers the radio down, no-op in linux
+  auto off() noexcept -> void;
+  /// Powers the radio up, the caller connects
+  auto on() noexcept -> void;
+}
+
+/// Scans for WiFi access points in the background when requested, caching the strongest ones in a fixed size table.
+///
+/// Never blocks, `poll` must be called periodically to collect the results.
+class WifiScanner {
+  iop::Log logger;
+  std::array<ScannedNetwork, IOP_WIFI_SCAN_RESULTS> networks;
+  uint8_t length = 0;
+  bool scanning = false;
+  iop::time::milliseconds nextScan = 0;
+
+public:
+  WifiScanner() noexcept: logger(IOP_STR("SCAN")) {}
+
+  /// Starts a scan, unless one is in progress or the results are newer than `IOP_WIFI_SCAN_INTERVAL_MILLIS`
+  auto request() noexcept -> void;
+  /// Collects the results of the scan in progress, if any
+  auto poll() noexcept -> void;
+  /// Cancels the scan in progress, if any, the cached results are kept
+  auto stop() noexcept -> void;
+
+  auto begin() const noexcept -> const ScannedNetwork * { return this->networks.data(); }
+  auto end() const noexcept -> const ScannedNetwork * { return this->networks.data() + this->length; }
+  auto size() const noexcept -> uint8_t { return this->length; }
+
+  /// Maximum size of `toJson`'s output, SSIDs may need to be escaped
+  constexpr static size_t jsonCapacity = IOP_WIFI_SCAN_RESULTS * (sizeof(iop::NetworkName) * 6 + 48) + 3;
+
+  /// Serializes the results as `[{"ssid": "name", "rssi": -60, "secure": true}, ...]`
+  auto toJson(std::array<char, jsonCapacity> &buffer) const noexcept -> bool;
+};
+}
+#endif
@@ -0,0 +1,193 @@
+#ifndef IOP_SERIES_HPP
+#define IOP_SERIES_HPP
+
+#include "iop/event.hpp"
+
+#include <array>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+/// Bytes reserved for each column of a `TimeSeries` (the timestamps and each field)
+#ifndef IOP_SERIES_COLUMN_BYTES
+#define IOP_SERIES_COLUMN_BYTES 256
+#endif
+
+namespace iop {
+namespace series {
+  /// Writes bits, most significant first, to a fixed buffer
+  class BitWriter {
+    uint8_t *data;
+    size_t capacity;
+    size_t bits = 0;
+
+  public:
+    BitWriter(uint8_t *data, size_t capacity) noexcept: data(data), capacity(capacity) {}
+
+    /// Writes the `count` lowest bits of `value`, returns false if they don't fit
+    auto write(uint64_t value, uint8_t count) noexcept -> bool;
+    auto position() const noexcept -> size_t { return this->bits; }
+    /// Discards everything written after `position`
+    auto rewind(size_t position) noexcept -> void { this->bits = position; }
+    auto bytes() const noexcept -> size_t { return (this->bits + 7) / 8; }
+  };
+
+  class BitReader {
+    const uint8_t *data;
+    size_t length;
+    size_t bits = 0;
+
+  public:
+    BitReader(const uint8_t *data, size_t length) noexcept: data(data), length(length) {}
+    auto read(uint8_t count) noexcept -> std::optional<uint64_t>;
+  };
+
+  /// Delta of delta encoding, regular intervals cost one bit per sample:
+  ///
+  /// '0' same interval, '10' + 7 bits, '110' + 9 bits, '1110' + 12 bits, '11110' + 32 bits, '11111' + 64 bits (zigzag).
+  /// The first timestamp is written raw, in 64 bits.
+  class TimestampEncoder {
+    uint64_t last = 0;
+    int64_t lastDelta = 0;
+    bool first = true;
+
+  public:
+    auto append(BitWriter &writer, uint64_t timestamp) noexcept -> bool;
+  };
+
+  class TimestampDecoder {
+    uint64_t last = 0;
+    int64_t lastDelta = 0;
+    bool first = true;
+
+  public:
+    auto next(BitReader &reader) noexcept -> std::optional<uint64_t>;
+  };
+
+  /// XOR of each value with the previous one, as 32 bits floats. Slow changing values have most bits in common:
+  ///
+  /// '0' same value, '10' + the meaningful bits if they fit the previous window,
+  /// '11' + 5 bits of leading zeroes + 5 bits of length - 1 + the meaningful bits otherwise.
+  /// The first value is written raw.
+  class ValueEncoder {
+    uint32_t last = 0;
+    uint8_t leading = 0;
+    uint8_t trailing = 0;
+    bool first = true;
+    bool hasWindow = false;
+
+  public:
+    auto append(BitWriter &writer, float value) noexcept -> bool;
+  };
+
+  class ValueDecoder {
+    uint32_t last = 0;
+    uint8_t leading = 0;
+    uint8_t trailing = 0;
+    bool first = true;
+
+  public:
+    auto next(BitReader &reader) noexcept -> std::optional<float>;
+  };
+
+  constexpr static uint8_t version = 1;
+  /// Version, columns, samples and the uptime when serialized
+  constexpr static size_t headerLength = 1 + 1 + 2 + 8;
+
+  auto writeLE(uint8_t *data, uint64_t value, uint8_t bytes) noexcept -> void;
+}
+
+/// Compact columnar buffer of typed samples, to batch measurements or keep them while offline.
+///
+/// Timestamps are delta of delta encoded and values XOR encoded, bit packed. Greenhouse traces usually take
+/// a fraction of their JSON size. Fields are stored as 32 bits floats, so integers are exact up to 2^24.
+///
+/// Serialized (little endian): version, number of fields, number of samples (u16), uptime when serialized (u64), then each
+/// field's key (u8 length + bytes), then each column (u16 length + bytes), the timestamps first. Timestamps are uptime in
+/// milliseconds, the server anchors them with the serialization uptime. See `EventLoop::registerSeries`, the serialization
+/// isn't NUL terminated and has NUL bytes, so it's sent by length.
+///
+/// `series::TimestampDecoder` and `series::ValueDecoder` read the columns back, like the monitor server does
+template <typename ...Fields>
+class TimeSeries {
+  static_assert((... && std::is_arithmetic_v<typename Fields::Type>), "Time series fields must be numbers or booleans");
+  constexpr static size_t columns = sizeof...(Fields) + 1;
+
+  std::array<std::array<uint8_t, IOP_SERIES_COLUMN_BYTES>, columns> buffers;
+  std::array<series::BitWriter, columns> writers;
+  series::TimestampEncoder timestamps;
+  std::array<series::ValueEncoder, sizeof...(Fields)> values;
+  uint16_t length = 0;
+
+  template <size_t ...Indexes>
+  static auto makeWriters(std::array<std::array<uint8_t, IOP_SERIES_COLUMN_BYTES>, columns> &buffers, std::index_sequence<Indexes...>) noexcept -> std::array<series::BitWriter, columns> {
+    return {{ series::BitWriter(buffers[Indexes].data(), IOP_SERIES_COLUMN_BYTES)... }};
+  }
+
+public:
+  constexpr static size_t maxLength = series::headerLength + (0 + ... + (1 + Fields::key.length())) + columns * (2 + IOP_SERIES_COLUMN_BYTES);
+  using Buffer = std::array<char, maxLength>;
+
+  TimeSeries() noexcept: buffers(), writers(makeWriters(this->buffers, std::make_index_sequence<columns>())) {}
+  // Writers point to the buffers
+  TimeSeries(TimeSeries const &other) noexcept = delete;
+  auto operator=(TimeSeries const &other) noexcept -> TimeSeries & = delete;
+
+  /// Appends a sample, returns false if a column is full, then the series is unchanged and should be sent
+  auto append(const iop::time::milliseconds timestamp, const Event<Fields...> &event) noexcept -> bool {
+    std::array<size_t, columns> positions;
+    for (size_t index = 0; index < columns; ++index) positions[index] = this->writers[index].position();
+    const auto savedTimestamps = this->timestamps;
+    const auto savedValues = this->values;
+
+    size_t index = 0;
+    auto ok = this->timestamps.append(this->writers[0], static_cast<uint64_t>(timestamp));
+    ((ok = ok && this->values[index].append(this->writers[index + 1], static_cast<float>(event.template get<Fields>())), index++), ...);
+
+    if (!ok || this->length == UINT16_MAX) {
+      for (size_t column = 0; column < columns; ++column) this->writers[column].rewind(positions[column]);
+      this->timestamps = savedTimestamps;
+      this->values = savedValues;
+      return false;
+    }
+    this->length += 1;
+    return true;
+  }
+
+  auto size() const noexcept -> uint16_t { return this->length; }
+
+  auto clear() noexcept -> void {
+    for (auto &writer: this->writers) writer.rewind(0);
+    this->timestamps = series::TimestampEncoder();
+    this->values = {};
+    this->length = 0;
+  }
+
+  /// Serializes into `buffer`, `now` is the current uptime
+  auto serialize(Buffer &buffer, const iop::time::milliseconds now) const noexcept -> std::string_view {
+    auto *data = reinterpret_cast<uint8_t*>(buffer.data());
+    data[0] = series::version;
+    data[1] = sizeof...(Fields);
+    series::writeLE(data + 2, this->length, 2);
+    series::writeLE(data + 4, static_cast<uint64_t>(now), 8);
+    auto *cursor = data + series::headerLength;
+
+    const auto writeKey = [&cursor](const std::string_view key) {
+      *cursor++ = static_cast<uint8_t>(key.length());
+      memcpy(cursor, key.data(), key.length());
+      cursor += key.length();
+    };
+    (writeKey(Fields::key), ...);
+
+    for (size_t column = 0; column < columns; ++column) {
+      const auto bytes = this->writers[column].bytes();
+      series::writeLE(cursor, bytes, 2);
+      memcpy(cursor + 2, this->buffers[column].data(), bytes);
+      cursor += 2 + bytes;
+    }
+    return std::string_view(buffer.data(), static_cast<size_t>(cursor - data));
+  }
+};
+}
+#endif
@@ -3,10 +3,29 @@
 
 #include "iop-hal/log.hpp"
 #include "iop-hal/server.hpp"
+#include "iop/radio.hpp"
 #include "iop/utils.hpp"
+#include "iop/arena.hpp"
 #include <optional>
 
 namespace iop {
+#ifdef IOP_STATIC_ARENA
+/// Fixed size, so submitting the form doesn't allocate. Values too long are rejected by the captive portal
+struct DynamicIopCredential {
+  FixedString<IOP_ARENA_CREDENTIAL_SIZE> organization;
+  FixedString<IOP_ARENA_CREDENTIAL_SIZE> login;
+  FixedString<IOP_ARENA_CREDENTIAL_SIZE> password;
+
+  DynamicIopCredential(std::string_view organization, std::string_view login, std::string_view password) noexcept: organization(organization), login(login), password(password) {}
+};
+
+struct DynamicWifiCredential {
+  FixedString<sizeof(iop::NetworkName)> login;
+  FixedString<sizeof(iop::NetworkPassword)> password;
+
+  DynamicWifiCredential(std::string_view login, std::string_view password) noexcept: login(login), password(password) {}
+};
+#else
 struct DynamicIopCredential {
   std::string organization;
   std::string login;
@@ -21,6 +40,7 @@ struct DynamicWifiCredential {
 
   DynamicWifiCredential(std::string login, std::string password) noexcept: login(login), password(password) {}
 };
+#endif
 
 struct StaticCredential {
   iop::StaticString login;
@@ -31,6 +51,19 @@ struct StaticCredential {
 
 class Api;
 
+// For how long each `CredentialsServer::serve` call may keep handling DNS queries and HTTP connections before yielding to the event loop.
+// It returns earlier once there are no requests left
+#ifndef IOP_PORTAL_SERVE_MILLIS
+#define IOP_PORTAL_SERVE_MILLIS 100
+#endif
+
+// How long after its last request the captive portal is in use. Retrying stored networks closes it, so they wait meanwhile
+#ifndef IOP_PORTAL_IDLE_MILLIS
+#define IOP_PORTAL_IDLE_MILLIS (2 * 60 * 1000)
+#endif
+
+class EventLoop;
+
 /// Server to safely collect wifi and Internet of Plants credentials from a HTML form.
 ///
 /// It provides an access point with a captive portal.
@@ -49,14 +82,20 @@ class Api;
 class CredentialsServer {
 private:
   std::unique_ptr<StaticCredential> credentialsAccessPoint;
-  std::unique_ptr<DynamicIopCredential> credentialsIop;
-  std::unique_ptr<DynamicWifiCredential> credentialsWifi;
+  Box<DynamicIopCredential> credentialsIop;
+  Box<DynamicWifiCredential> credentialsWifi;
 
   Log logger;
 
   iop_hal::HttpServer server;
   iop_hal::CaptivePortal dnsServer;
+  WifiScanner scanner;
   bool isServerOpen = false;
+  /// When the last request was handled, since the portal opened
+  std::optional<iop::time::milliseconds> lastRequest;
+
+  /// Loop that owns this server, its storage holds the credentials and it connects to the WiFi
+  EventLoop *loop = nullptr;
 
 
   /// Internal method to initialize the credential server, if not running
@@ -66,17 +105,20 @@ public:
   explicit CredentialsServer() noexcept;
 
   /// Setups everything the Captive Portal needs
-  auto setup() noexcept -> void;
+  auto setup(EventLoop &loop) noexcept -> void;
 
   /// Configures Access Point credentials, must be called before `serve`
   auto setAccessPointCredentials(StaticString SSID, StaticString PSK) noexcept -> void;
 
   /// Serves the captive portal and handles each user connected to each,
   /// authenticating to the wifi and returning the monitor server credentials when available
-  auto serve() noexcept -> std::unique_ptr<DynamicIopCredential>;
+  auto serve() noexcept -> Box<DynamicIopCredential>;
 
   /// Closes the Captive Portal if it's still open
   auto close() noexcept -> bool;
+
+  /// Open and handled a request in the last `IOP_PORTAL_IDLE_MILLIS`, closing it would cut off whoever is filling the form
+  auto inUse() const noexcept -> bool;
 };
 }
 #endif
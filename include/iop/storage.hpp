@@ -2,27 +2,158 @@
 #define IOP_STORAGE_HPP
 
 #include "iop-hal/log.hpp"
+#include "iop-hal/storage.hpp"
+#include "iop/radio.hpp"
 #include "iop/utils.hpp"
 #include <optional>
 
+#ifdef IOP_LINUX_MOCK
+#include <vector>
+#include <cstring>
+#endif
+
 namespace iop {
+#ifndef IOP_WIFI_SLOTS
+#define IOP_WIFI_SLOTS 3
+#endif
+
+/// Connection history is only written to flash when the expected connection time moves by more than this percentage,
+/// a successful connection usually changes it a little, writing each of them wears the flash of duty-cycled devices
+#ifndef IOP_WIFI_STATS_CHANGE_PERCENT
+#define IOP_WIFI_STATS_CHANGE_PERCENT 10
+#endif
+
+/// Small changes to the connection history are still written at most this often, so a reset doesn't lose them all
+#ifndef IOP_WIFI_STATS_WRITE_MILLIS
+#define IOP_WIFI_STATS_WRITE_MILLIS (6 * 60 * 60 * 1000)
+#endif
+
+/// Connection history of a stored WiFi network, used to rank them
+struct WifiStats {
+  uint16_t successes;
+  uint16_t failures;
+  /// Moving average of how long connecting took
+  uint16_t connectMillis;
+  /// Signal strength at the last connection, 0 if unknown
+  int8_t rssi;
+
+  /// Expected time to get connected, considering the failure rate. Lower is better
+  auto expectedConnectMillis(uint16_t pendingFailures) const noexcept -> uint32_t;
+};
+
+#ifdef IOP_LINUX_MOCK
+/// In-memory storage image, it has the same API as `iop_hal::storage`.
+///
+/// Each `Storage` has its own, so many simulated devices can run in the same process. It survives `EventLoop::setup`, like flash survives reboots.
+class StorageImage {
+  std::vector<uint8_t> data;
+
+public:
+  auto setup(const uintmax_t size) noexcept -> void {
+    if (this->data.size() < size) this->data.resize(size, 0);
+  }
+
+  auto get(const uintmax_t index) const noexcept -> std::optional<uint8_t> {
+    if (index >= this->data.size()) return std::nullopt;
+    return this->data[index];
+  }
+
+  auto set(const uintmax_t index, const uint8_t byte) noexcept -> bool {
+    if (index >= this->data.size()) return false;
+    this->data[index] = byte;
+    return true;
+  }
+
+  template <size_t SIZE>
+  auto read(const uintmax_t index) const noexcept -> std::optional<std::array<char, SIZE>> {
+    if (index + SIZE > this->data.size()) return std::nullopt;
+    std::array<char, SIZE> value;
+    memcpy(value.data(), this->data.data() + index, SIZE);
+    return value;
+  }
+
+  template <size_t SIZE>
+  auto write(const uintmax_t index, const std::array<char, SIZE> &value) noexcept -> bool {
+    if (index + SIZE > this->data.size()) return false;
+    memcpy(this->data.data() + index, value.data(), SIZE);
+    return true;
+  }
+
+  auto commit() noexcept -> bool { return true; }
+};
+#endif
+
 /// Wraps storage memory to provide a safe and ergonomic API
+///
+/// The buffers the returned references point to belong to the instance, so they are valid until the next call that reads the same data
 class Storage {
   iop::Log logger;
 
+  AuthToken authToken;
+  std::array<iop::NetworkName, IOP_WIFI_SLOTS> ssids;
+  std::array<iop::NetworkPassword, IOP_WIFI_SLOTS> psks;
+  std::array<std::optional<WifiCredentials>, IOP_WIFI_SLOTS> credentials;
+  std::array<WifiRadio, IOP_WIFI_SLOTS> storedWifiRadios;
+  CrashReport storedCrashReport;
+  iop::MD5Hash cachedFirmwareMD5;
+  /// Connection history not yet written to flash, it's newer than the stored one
+  std::array<std::optional<WifiStats>, IOP_WIFI_SLOTS> pendingWifiStats;
+  std::array<iop::time::milliseconds, IOP_WIFI_SLOTS> wifiStatsWrittenAt;
+
+  auto storedWifiStats(uint8_t slot) noexcept -> WifiStats;
+
+#ifdef IOP_LINUX_MOCK
+  StorageImage image;
+  auto backend() noexcept -> StorageImage & { return this->image; }
+#else
+  auto backend() noexcept -> decltype(iop_hal::storage) & { return iop_hal::storage; }
+#endif
+
 public:
-  explicit Storage() noexcept: logger(IOP_STR("STORAGE")) {}
+  explicit Storage() noexcept: logger(IOP_STR("STORAGE")), authToken(), ssids(), psks(), credentials(), storedWifiRadios(), storedCrashReport(), cachedFirmwareMD5(), pendingWifiStats(), wifiStatsWrittenAt() {}
 
   /// Initializes storage memory storage
-  static auto setup() noexcept -> void;
+  auto setup() noexcept -> void;
 
   auto token() noexcept -> std::optional<std::reference_wrapper<const AuthToken>>;
   void removeToken() noexcept;
   auto setToken(const AuthToken &token) noexcept -> bool;
 
+  /// How many WiFi networks can be stored
+  constexpr static uint8_t wifiSlots = IOP_WIFI_SLOTS;
+
+  /// First stored WiFi network, if any
   auto wifi() noexcept -> std::optional<std::reference_wrapper<const WifiCredentials>>;
+  auto wifi(uint8_t slot) noexcept -> std::optional<std::reference_wrapper<const WifiCredentials>>;
+  auto wifiSlot(std::string_view ssid) noexcept -> std::optional<uint8_t>;
+  /// Removes every stored WiFi network
   void removeWifi() noexcept;
+  void removeWifi(uint8_t slot) noexcept;
+  /// Replaces the network with the same SSID, or uses an empty slot, or evicts the network with the worst history
   auto setWifi(const WifiCredentials &config) noexcept -> bool;
+
+  /// Latest connection history, including what wasn't written to flash yet
+  auto wifiStats(uint8_t slot) noexcept -> WifiStats;
+  /// Records a successful connection, along with the failures since the last one (they are only kept in memory, to spare writes).
+  ///
+  /// It's written to flash if there were failures, the network had no history, the ranking changed by more than `IOP_WIFI_STATS_CHANGE_PERCENT`,
+  /// or the last write is older than `IOP_WIFI_STATS_WRITE_MILLIS`. Otherwise it's kept in memory, and lost on reset
+  auto recordWifiConnection(uint8_t slot, uint16_t failures, iop::time::milliseconds took, std::optional<int8_t> rssi) noexcept -> void;
+
+  /// Radio parameters of the last successful connection with the stored WiFi credentials
+  auto wifiRadio(uint8_t slot) noexcept -> std::optional<std::reference_wrapper<const WifiRadio>>;
+  auto setWifiRadio(uint8_t slot, const WifiRadio &radio) noexcept -> bool;
+
+  auto crashReport() noexcept -> std::optional<std::reference_wrapper<const CrashReport>>;
+  void removeCrashReport() noexcept;
+  /// Doesn't panic on failure, as it's called from the panic hook and crash handlers
+  auto setCrashReport(const CrashReport &report) noexcept -> bool;
+
+  /// Firmware MD5 cached for this identity, hashing the whole image is slow
+  auto firmwareMD5(const FirmwareIdentity &identity) noexcept -> std::optional<std::reference_wrapper<const iop::MD5Hash>>;
+  /// The next call to `firmwareMD5` misses, and the image is hashed again
+  void removeFirmwareMD5() noexcept;
+  auto setFirmwareMD5(const FirmwareIdentity &identity, const iop::MD5Hash &md5) noexcept -> bool;
 };
 }
 #endif
\ No newline at end of file
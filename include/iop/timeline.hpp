@@ -0,0 +1,42 @@
+#ifndef IOP_TIMELINE_HPP
+#define IOP_TIMELINE_HPP
+
+#include "iop/utils.hpp"
+#include <optional>
+#include <array>
+
+namespace iop {
+/// Milestones of the boot process, in the order they are expected to happen
+enum class BootStage : uint8_t {
+  STORAGE,
+  API,
+  PANIC,
+  NETWORK_LOGGER,
+  CREDENTIALS_SERVER,
+  FIRMWARE_MD5,
+  USER_SETUP,
+  WIFI,
+  AUTHENTICATION,
+  FIRST_EVENT,
+};
+constexpr static uint8_t bootStages = 10;
+
+/// Records when each boot stage finished (in milliseconds since boot), so we can track startup regressions.
+///
+/// Only the first time a stage is reached is recorded, reconnections don't count.
+class BootTimeline {
+  std::array<std::optional<iop::time::milliseconds>, bootStages> stages;
+  bool reported = false;
+
+public:
+  auto mark(BootStage stage) noexcept -> void;
+  auto at(BootStage stage) const noexcept -> std::optional<iop::time::milliseconds>;
+
+  /// The timeline is ready to be reported once the first event was sent
+  auto isReady() const noexcept -> bool { return !this->reported && this->at(BootStage::FIRST_EVENT).has_value(); }
+  auto setReported() noexcept -> void { this->reported = true; }
+
+  static auto toString(BootStage stage) noexcept -> iop::StaticString;
+};
+}
+#endif
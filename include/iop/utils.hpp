@@ -3,12 +3,93 @@
 
 #include "iop-hal/string.hpp"
 #include "iop-hal/panic.hpp"
+#include "iop-hal/thread.hpp"
 #include <functional>
+#include <array>
+#include <optional>
 
 namespace iop {
-// If you change the number of interrupt types, please update interruptVariant to the correct size
-enum class InterruptEvent { NONE, MUST_UPGRADE };
-constexpr static uint8_t interruptVariants = 3;
+enum class InterruptEvent : uint8_t { NONE, MUST_UPGRADE, USER };
+
+/// Work scheduled from an interrupt (or any other context) to run in the main loop.
+///
+/// `code` and `payload` are free for `InterruptEvent::USER` events, like a GPIO number and how long a button was pressed.
+struct Interrupt {
+  InterruptEvent event;
+  uint16_t code;
+  uint32_t payload;
+};
+
+#if defined(IOP_LINUX_MOCK) || defined(IOP_LINUX)
+/// Per thread state, so many `EventLoop`s can run in the same process. Microcontrollers run a single one
+#define IOP_THREAD_LOCAL thread_local
+#else
+#define IOP_THREAD_LOCAL
+#endif
+
+// Must be a power of two
+#ifndef IOP_INTERRUPT_QUEUE_SIZE
+#define IOP_INTERRUPT_QUEUE_SIZE 16
+#endif
+
+/// Why the device booted. `PANIC` is never returned by the hardware, it marks reports collected by `iop_panic`
+enum class ResetReason : uint8_t {
+  UNKNOWN,
+  POWER_ON,
+  EXTERNAL,
+  SOFTWARE,
+  DEEP_SLEEP,
+  EXCEPTION,
+  WATCHDOG,
+  BROWNOUT,
+  PANIC,
+};
+
+/// Post-mortem data collected when the device panics or crashes. Persisted to be reported in the next boot.
+///
+/// It's stored as raw bytes, so only add fields at the end and update the storage layout.
+struct CrashReport {
+  ResetReason reason;
+  /// Milliseconds since boot when the crash happened, 0 if unknown
+  uint32_t uptime;
+  uint32_t line;
+  std::array<char, 48> file;
+  std::array<char, 32> func;
+  std::array<char, 96> msg;
+  /// Address the raw stack window was copied from
+  uint32_t stackPointer;
+  /// Raw stack words, feed them to `tools/symbolize.py` with the firmware's ELF to get a backtrace
+  std::array<uint32_t, 16> stack;
+};
+
+/// Exponential backoff with per-device jitter, so a fleet doesn't retry in lockstep
+struct Backoff {
+  iop::time::milliseconds initial;
+  iop::time::milliseconds max;
+  uint8_t factor;
+  /// Percentage (0-100) of each delay that is randomized per device
+  uint8_t jitter;
+
+  constexpr Backoff(iop::time::milliseconds initial, iop::time::milliseconds max, uint8_t factor, uint8_t jitter) noexcept:
+    initial(initial), max(max), factor(factor), jitter(jitter) {}
+
+  /// Delay before retry number `attempt` (starting at 0), `seed` should be unique per device
+  auto delay(uint32_t attempt, uint32_t seed) const noexcept -> iop::time::milliseconds;
+
+  /// Applies this schedule's jitter to an arbitrary delay, the delay is capped at `max` before the jitter is applied
+  auto jittered(iop::time::milliseconds delay, uint32_t attempt, uint32_t seed) const noexcept -> iop::time::milliseconds;
+};
+
+/// FNV-1a, cheap hash to derive per-device seeds from unique data
+auto hash(std::string_view data, uint32_t seed = 2166136261) noexcept -> uint32_t;
+/// Same hash, reading from flash without copying it to RAM, so it's safe in the panic path
+auto hash(iop::StaticString data, uint32_t seed = 2166136261) noexcept -> uint32_t;
+
+/// First 4 bytes block of the ESP8266's RTC user memory used by the panic wake up count, it takes 3 blocks.
+/// The default comes right after the watchdog's record, see `IOP_WATCHDOG_RTC_BLOCK`
+#ifndef IOP_PANIC_RTC_BLOCK
+#define IOP_PANIC_RTC_BLOCK 4
+#endif
 
 namespace panic {
   /// Sets custom panic hook to device, this hook logs the panic to the monitor server and requests for an update from the server constantly, rebooting when it succeeds
@@ -16,25 +97,68 @@ namespace panic {
 
   /// Sets custom cleanup panic hook to device, should cleanup all needed resources before halting (like water pump, etc)
   auto setCleanup(iop::PanicHook::Cleanup cleanup) noexcept -> void;
+
+  /// Configures how often a panicking device wakes up to report the panic and check for updates.
+  ///
+  /// The monitor server may override the next delay by answering the panic report with `{"next_check": seconds}`
+  auto setWakeSchedule(Backoff schedule) noexcept -> void;
+
+  /// Delay before a halted device wakes up again, it grows with each wake up of the same panic.
+  ///
+  /// The count survives deep sleep (RTC memory in devices). `site` identifies the panic and `seed` the device and its firmware,
+  /// so a successful update or a different panic starts over. `hint` is the monitor server's `next_check`, if any
+  auto nextWake(uint32_t seed, uint32_t site, std::optional<iop::time::milliseconds> hint) noexcept -> iop::time::milliseconds;
+  /// The device recovered, the next panic starts from the schedule's initial delay
+  auto resetWakes() noexcept -> void;
+
+  /// Reason for the last reset, as reported by the hardware
+  auto resetReason() noexcept -> ResetReason;
+
+  /// Human readable name of the reset reason, for logging and reporting
+  auto resetReasonToString(ResetReason reason) noexcept -> iop::StaticString;
+
+  /// If the device was reset by a crash that didn't go through `iop_panic`, persists whatever we know about it,
+  /// including the loop phase and task that was running (see `iop::watchdog`). Must be called after the storage is initialized.
+  auto recordUnexpectedReset(ResetReason reason) noexcept -> void;
 }
 namespace network_logger {
   /// Sets custom logging hook to device, this hook also logs messages, from `iop::LogType::INFO` on, to the monitor server.
   void setup() noexcept;
+
+  /// Uptime when the oldest log not sent yet was buffered, logs wait while the device is offline
+  auto pendingSince() noexcept -> std::optional<iop::time::milliseconds>;
+  /// Sends the buffered logs, if connected
+  auto flush() noexcept -> void;
 }
 
-/// Schedules update to run in the next main loop run.
-/// Has a pre-allocated slot for every kind of interrupt we support.
-/// Discards interrupt if it already is scheduled for the next main loop run.
-void scheduleInterrupt(InterruptEvent ev) noexcept;
+/// Schedules an interrupt to be handled in the next main loop run. Safe to call from interrupts and other threads.
+///
+/// It's a fixed size lock-free queue of `IOP_INTERRUPT_QUEUE_SIZE` elements, if it's full the interrupt is dropped and counted.
+void scheduleInterrupt(InterruptEvent ev, uint16_t code = 0, uint32_t payload = 0) noexcept;
+
+/// Extracts the oldest interrupt scheduled. Should be called until a `InterruptEvent::NONE` is returned.
+///
+/// Must only be called from the main loop (single consumer).
+auto descheduleInterrupt() noexcept -> Interrupt;
 
-/// Extracts first interrupt scheduled. Should be called until a `InterruptEvent::NONE` is returned.
-auto descheduleInterrupt() noexcept -> InterruptEvent;
+/// How many interrupts were dropped because the queue was full, since boot
+auto droppedInterrupts() noexcept -> uint32_t;
 
 /// Represents an authentication token returned by the monitor server.
 ///
 /// Must be sent in every authenticated request to the monitor server.
 using AuthToken = std::array<char, 64>;
 
+/// Cheap identity of the running firmware image, used to know when cached data about it is stale
+struct FirmwareIdentity {
+  /// Hash of the library's build timestamp, the image's link time (see `build_flags.py`) and `IOP_BUILD_ID`, if defined
+  uint32_t build;
+  /// Image size on ESP8266, running partition address on ESP32 (it changes on every OTA), 0 on linux
+  uint32_t image;
+
+  auto operator==(const FirmwareIdentity &other) const noexcept -> bool { return this->build == other.build && this->image == other.image; }
+};
+
 /// Helpful to pass around references to the cached stored WiFi credentials
 struct WifiCredentials {
   std::reference_wrapper<const iop::NetworkName> ssid;
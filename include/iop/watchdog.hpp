@@ -0,0 +1,72 @@
+#ifndef IOP_WATCHDOG_HPP
+#define IOP_WATCHDOG_HPP
+
+#include "iop/heap.hpp"
+
+#include <optional>
+
+/// Define IOP_WATCHDOG to reset the device when a task runs for longer than its maximum run time, or a loop iteration takes
+/// longer than `IOP_WATCHDOG_LOOP_MILLIS`. What was running is kept in memory that survives the reset (RTC memory in devices)
+/// and sent with the next crash report. The hardware watchdog is only fed when the loop makes progress.
+///
+/// In linux nothing is reset, overruns are only reported as deadline misses once the task returns.
+
+/// Default maximum run time of a task, see `EventLoop::setInterval`
+#ifndef IOP_WATCHDOG_TASK_MILLIS
+#define IOP_WATCHDOG_TASK_MILLIS (30 * 1000)
+#endif
+
+/// Covers what runs outside of tasks: WiFi, the captive portal, authentication, reports and updates
+#ifndef IOP_WATCHDOG_LOOP_MILLIS
+#define IOP_WATCHDOG_LOOP_MILLIS (3 * 60 * 1000)
+#endif
+
+#ifndef IOP_WATCHDOG_CHECK_MILLIS
+#define IOP_WATCHDOG_CHECK_MILLIS 1000
+#endif
+
+/// First 4 bytes block of the ESP8266's RTC user memory used, the record takes 4 blocks
+#ifndef IOP_WATCHDOG_RTC_BLOCK
+#define IOP_WATCHDOG_RTC_BLOCK 0
+#endif
+
+namespace iop {
+/// Section of the loop that was running when the device reset.
+///
+/// It's stored as raw bytes in RTC memory, its size must stay a multiple of 4
+struct WatchdogRecord {
+  uint32_t magic;
+  /// Uptime when the section started
+  uint32_t start;
+  uint32_t limit;
+  /// Task index in its phase (registration order), `watchdog::noTask` outside of tasks
+  uint16_t task;
+  LoopPhase phase;
+  /// The software watchdog reset the device, otherwise the section was running when something else did
+  bool fired;
+};
+
+static_assert(sizeof(WatchdogRecord) % 4 == 0, "RTC memory is written in 4 bytes blocks");
+
+namespace watchdog {
+  constexpr static uint16_t noTask = UINT16_MAX;
+
+  /// Starts checking the running section, must be called after `takeRecord`
+  auto setup() noexcept -> void;
+  /// Stops checking, a panicking device waits for updates for as long as needed
+  auto stop() noexcept -> void;
+
+  /// Marks the start of a section that must end within `limit`
+  auto enter(LoopPhase phase, uint16_t task, iop::time::milliseconds limit) noexcept -> void;
+  /// Marks the end of the section, returning how long it ran. Back to the loop iteration's limit
+  auto leave() noexcept -> iop::time::milliseconds;
+  /// The loop finished an iteration, feeds the hardware watchdog and restarts the iteration's limit
+  auto feed() noexcept -> void;
+
+  /// Section that was running when the device last reset, if any. Consumes it
+  auto takeRecord() noexcept -> std::optional<WatchdogRecord>;
+  /// Section running now, for crash handlers
+  auto current() noexcept -> const WatchdogRecord &;
+}
+}
+#endif
@@ -0,0 +1,37 @@
+#include "iop/aggregate.hpp"
+
+namespace iop {
+auto Summary::add(const double sample) noexcept -> void {
+  if (this->count == 0 || sample < this->min) this->min = sample;
+  if (this->count == 0 || sample > this->max) this->max = sample;
+
+  this->count += 1;
+  const auto delta = sample - this->mean;
+  this->mean += delta / this->count;
+  this->m2 += delta * (sample - this->mean);
+}
+
+// Chan's parallel variance, Welford's update with a whole window instead of a sample
+auto Summary::merge(const Summary &other) noexcept -> void {
+  if (other.count == 0) return;
+  if (this->count == 0) {
+    *this = other;
+    return;
+  }
+
+  if (other.min < this->min) this->min = other.min;
+  if (other.max > this->max) this->max = other.max;
+
+  const double count = this->count;
+  const double total = count + other.count;
+  const auto delta = other.mean - this->mean;
+  this->mean += delta * other.count / total;
+  this->m2 += other.m2 + delta * delta * count * other.count / total;
+  this->count += other.count;
+}
+
+auto Summary::variance() const noexcept -> double {
+  if (this->count < 2) return 0;
+  return this->m2 / this->count;
+}
+}
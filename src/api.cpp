@@ -10,6 +10,19 @@
 // TODO: have an endpoint to report BROKEN_CLIENTS
 
 namespace iop {
+using FixedJsonBuffer = StaticJsonDocument<Api::JsonCapacity>;
+using JsonBuffer = std::array<char, Api::JsonCapacity>;
+
+#ifdef IOP_STATIC_ARENA
+static iop::Pool<FixedJsonBuffer, IOP_ARENA_JSON_DOCUMENTS> documents;
+static iop::Pool<JsonBuffer, IOP_ARENA_JSON_BUFFERS> buffers;
+static iop::Pool<iop::AuthToken, IOP_ARENA_AUTH_TOKENS> tokens;
+
+static auto releaseDocument(const FixedJsonBuffer *doc) noexcept -> void { documents.release(doc); }
+static auto releaseBuffer(const JsonBuffer *json) noexcept -> void { buffers.release(json); }
+static auto releaseToken(const iop::AuthToken *token) noexcept -> void { tokens.release(token); }
+#endif
+
 static void updateScheduler() noexcept {
   iop::scheduleInterrupt(iop::InterruptEvent::MUST_UPGRADE);
 }
@@ -32,10 +45,12 @@ auto Api::reportPanic(const AuthToken &authToken, const PanicData &event) noexce
   auto json = Api::Json();
 
   while (true) {
-    const auto make = [event, &msg](JsonDocument &doc) {
-      doc["file"] = event.file.toString();
+    // Captured by reference, so the callback fits in `std::function` without allocating
+    const auto make = [&event, &msg](JsonDocument &doc) {
+      // Flash strings are copied into the document, `toString` would allocate
+      doc["file"] = event.file.get();
       doc["line"] = event.line;
-      doc["func"] = event.func.toString();
+      doc["func"] = event.func.get();
       doc["msg"] = msg;
     };
     json = this->makeJson(IOP_FUNC, make);
@@ -54,8 +69,73 @@ auto Api::reportPanic(const AuthToken &authToken, const PanicData &event) noexce
   if (!json)
     return iop::NetworkStatus::BROKEN_CLIENT;
 
+  return this->sendPanic(authToken, json);
+}
+
+auto Api::reportPanic(const AuthToken &authToken, const CrashReport &report) noexcept -> iop::NetworkStatus {
+  IOP_TRACE();
+  this->logger.info(IOP_STR("Report crash from previous boot: "));
+  this->logger.infoln(iop::panic::resetReasonToString(report.reason));
+
+  // Captured as a whole, so the callback fits in `std::function` without allocating
+  struct {
+    std::string_view msg;
+    std::string_view stack;
+  } truncated = { iop::to_view(report.msg), std::string_view() };
+  auto stackWords = report.stack.size();
+  auto json = Api::Json();
+
+  while (true) {
+    // Hex formatted words, the symbolizer expects them space separated from the lowest address up
+    std::array<char, std::tuple_size<decltype(report.stack)>::value * 11 + 1> stack;
+    size_t stackLength = 0;
+    for (size_t index = 0; index < stackWords; ++index) {
+      stackLength += static_cast<size_t>(snprintf(stack.data() + stackLength, stack.size() - stackLength, "0x%08x ", static_cast<unsigned int>(report.stack[index])));
+    }
+    truncated.stack = std::string_view(stack.data(), stackLength);
+
+    const auto make = [&report, &truncated](JsonDocument &doc) {
+      doc["file"] = iop::to_view(report.file);
+      doc["line"] = report.line;
+      doc["func"] = iop::to_view(report.func);
+      doc["msg"] = truncated.msg;
+      doc["reset_reason"] = iop::panic::resetReasonToString(report.reason).get();
+      doc["uptime"] = report.uptime;
+      doc["stack_pointer"] = report.stackPointer;
+      doc["stack"] = truncated.stack;
+      doc["post_mortem"] = true;
+    };
+    json = this->makeJson(IOP_FUNC, make);
+
+    if (!json) {
+      if (truncated.msg.length() > 0) {
+        truncated.msg = truncated.msg.substr(0, truncated.msg.length() / 2);
+      } else if (stackWords > 0) {
+        stackWords /= 2;
+      } else {
+        return iop::NetworkStatus::BROKEN_CLIENT;
+      }
+      continue;
+    }
+    break;
+  }
+
+  return this->sendPanic(authToken, json);
+}
+
+auto Api::unreachable() const noexcept -> bool {
+#ifdef IOP_LINUX_MOCK
+  return this->radioOff;
+#else
+  return false;
+#endif
+}
+
+auto Api::sendPanic(const AuthToken &authToken, const Api::Json &json) noexcept -> iop::NetworkStatus {
+  IOP_TRACE();
+  if (this->unreachable()) return iop::NetworkStatus::IO_ERROR;
   const auto token = iop::to_view(authToken);
-  const auto response = this->network.httpPost(token, IOP_STR("/v1/panic"), iop::to_view(*json));
+  auto response = this->network.httpPost(token, IOP_STR("/v1/panic"), iop::to_view(*json));
 
   const auto status = response.status();
   if (!status || *status == iop::NetworkStatus::IO_ERROR) {
@@ -63,26 +143,60 @@ auto Api::reportPanic(const AuthToken &authToken, const PanicData &event) noexce
     this->logger.errorln(response.code());
     return iop::NetworkStatus::BROKEN_SERVER;
   }
+
+  if (*status == iop::NetworkStatus::OK) {
+    const auto payloadBuff = std::move(response.await().payload);
+    const auto payload = iop::to_view(payloadBuff);
+
+    // Older servers answer with an empty payload, so no hint is fine
+    StaticJsonDocument<JSON_OBJECT_SIZE(1)> doc;
+    if (payload.length() > 0 && !deserializeJson(doc, payload.data(), payload.length()) && doc["next_check"].is<uint32_t>()) {
+      this->nextCheckHint = static_cast<iop::time::milliseconds>(doc["next_check"].as<uint32_t>()) * 1000;
+      this->logger.info(IOP_STR("Server asked to check for updates again in (secs): "));
+      this->logger.infoln(doc["next_check"].as<uint32_t>());
+    }
+  }
   return *status;
 }
 
+auto Api::takeNextCheckHint() noexcept -> std::optional<iop::time::milliseconds> {
+  const auto hint = this->nextCheckHint;
+  this->nextCheckHint.reset();
+  return hint;
+}
+
 auto Api::registerEvent(const AuthToken &authToken, const Api::Json &event) noexcept -> iop::NetworkStatus {
+  if (!event) return iop::NetworkStatus::BROKEN_CLIENT;
+  return this->registerEvent(authToken, iop::to_view(*event));
+}
+
+auto Api::registerEvent(const AuthToken &authToken, const std::string_view event) noexcept -> iop::NetworkStatus {
   IOP_TRACE();
   this->logger.infoln(IOP_STR("Send event"));
+  return this->post(authToken, IOP_STR("/v1/event"), IOP_STR("/v1/event?accept_encoding=deflate"), IOP_STR("/v1/event?encoding=deflate"), event, IOP_STR("Api::registerEvent"));
+}
+
+auto Api::registerSeries(const AuthToken &authToken, const std::string_view series) noexcept -> iop::NetworkStatus {
+  IOP_TRACE();
+  this->logger.info(IOP_STR("Send time series, bytes: "));
+  this->logger.infoln(series.length());
+  if (this->unreachable()) return iop::NetworkStatus::IO_ERROR;
 
   const auto token = iop::to_view(authToken);
-  const auto response = this->network.httpPost(token, IOP_STR("/v1/event"), iop::to_view(event));
+  const auto response = this->network.httpPost(token, IOP_STR("/v1/event/series"), series);
 
   const auto status = response.status();
   if (!status || *status == iop::NetworkStatus::IO_ERROR) {
-    this->logger.error(IOP_STR("Unexpected response at Api::registerEvent: "));
+    this->logger.error(IOP_STR("Unexpected response at Api::registerSeries: "));
     this->logger.errorln(response.code());
     return iop::NetworkStatus::BROKEN_SERVER;
   }
   return *status;
 }
-auto Api::authenticate(std::string_view organization, std::string_view username, std::string_view password) noexcept -> std::variant<std::unique_ptr<AuthToken>, iop::NetworkStatus> {
+
+auto Api::authenticate(std::string_view organization, std::string_view username, std::string_view password) noexcept -> std::variant<Box<AuthToken>, iop::NetworkStatus> {
   IOP_TRACE();
+  if (this->unreachable()) return iop::NetworkStatus::IO_ERROR;
 
   this->logger.info(IOP_STR("Authenticate IoP user: "));
   this->logger.info(username);
@@ -139,7 +253,11 @@ auto Api::authenticate(std::string_view organization, std::string_view username,
     return iop::NetworkStatus::BROKEN_SERVER;
   }
 
-  auto token = std::unique_ptr<AuthToken>(new (std::nothrow) AuthToken());
+#ifdef IOP_STATIC_ARENA
+  auto token = tokens.make(releaseToken);
+#else
+  auto token = Box<AuthToken>(new (std::nothrow) AuthToken());
+#endif
   if (!token) {
     this->logger.errorln(IOP_STR("Unable to allocate auth token"));
     return iop::NetworkStatus::BROKEN_CLIENT;
@@ -150,26 +268,81 @@ auto Api::authenticate(std::string_view organization, std::string_view username,
 
 auto Api::registerLog(const AuthToken &authToken, std::string_view log) noexcept -> iop::NetworkStatus {
   IOP_TRACE();
-  const auto token = iop::to_view(authToken);
   this->logger.debug(IOP_STR("Register logToken: "));
-  this->logger.debugln(token);
+  this->logger.debugln(iop::to_view(authToken));
   this->logger.debug(IOP_STR("Log: "));
   this->logger.debugln(log);
-  auto const response = this->network.httpPost(token, IOP_STR("/v1/log"), log);
+  return this->post(authToken, IOP_STR("/v1/log"), IOP_STR("/v1/log?accept_encoding=deflate"), IOP_STR("/v1/log?encoding=deflate"), log, IOP_STR("Api::registerLog"));
+}
 
-  const auto status = response.status();
-  if (!status || *status == iop::NetworkStatus::IO_ERROR) {
-    this->logger.error(IOP_STR("Unexpected response at Api::registerLog: "));
-    this->logger.errorln(response.code());
-    return iop::NetworkStatus::BROKEN_SERVER;
+auto Api::post(const AuthToken &authToken, const iop::StaticString path, const iop::StaticString probePath, const iop::StaticString deflatedPath, const std::string_view body, const iop::StaticString context) noexcept -> iop::NetworkStatus {
+  IOP_TRACE();
+  if (this->unreachable()) return iop::NetworkStatus::IO_ERROR;
+  const auto token = iop::to_view(authToken);
+  const auto check = [this, context](const auto &response) {
+    const auto status = response.status();
+    if (!status || *status == iop::NetworkStatus::IO_ERROR) {
+      this->logger.error(IOP_STR("Unexpected response at "));
+      this->logger.error(context);
+      this->logger.error(IOP_STR(": "));
+      this->logger.errorln(response.code());
+      return iop::NetworkStatus::BROKEN_SERVER;
+    }
+    return *status;
+  };
+
+#ifdef IOP_COMPRESSION
+  // HTTP's Content-Encoding header can't be set through iop-hal, so the encoding goes in the query string.
+  // Until the server says it inflates bodies they are sent as they are, asking it
+  if (!this->serverInflates && body.length() >= IOP_COMPRESSION_MIN_BYTES) {
+    auto response = this->network.httpPost(token, probePath, body);
+    if (response.status() == iop::NetworkStatus::OK) {
+      const auto payloadBuff = std::move(response.await().payload);
+      const auto payload = iop::to_view(payloadBuff);
+
+      // Older servers answer with an empty payload, they don't inflate
+      StaticJsonDocument<JSON_OBJECT_SIZE(1)> doc;
+      this->serverInflates = payload.length() > 0 && !deserializeJson(doc, payload.data(), payload.length())
+        && doc["accept_encoding"].is<const char*>() && strcmp(doc["accept_encoding"].as<const char*>(), "deflate") == 0;
+      if (*this->serverInflates) {
+        this->logger.infoln(IOP_STR("Server inflates bodies, compression enabled"));
+      } else {
+        this->logger.infoln(IOP_STR("Server doesn't inflate bodies, compression disabled until reboot"));
+      }
+    }
+    return check(response);
   }
-  return *status;
+
+  const auto deflated = this->serverInflates.value_or(false) && body.length() >= IOP_COMPRESSION_MIN_BYTES
+    ? iop::compression::deflate(body, this->deflated.data(), this->deflated.size())
+    : std::nullopt;
+  if (deflated && *deflated < body.length()) {
+    this->logger.debug(IOP_STR("Deflated body, bytes: "));
+    this->logger.debug(body.length());
+    this->logger.debug(IOP_STR(" -> "));
+    this->logger.debugln(*deflated);
+
+    const auto response = this->network.httpPost(token, deflatedPath, std::string_view(reinterpret_cast<const char*>(this->deflated.data()), *deflated));
+    if (response.code() != 415) return check(response);
+
+    // The server stopped inflating since it said it did, like after a rollback
+    this->logger.warnln(IOP_STR("Server doesn't inflate bodies anymore, compression disabled until reboot"));
+    this->serverInflates = false;
+  }
+#else
+  (void) probePath;
+  (void) deflatedPath;
+#endif
+
+  const auto response = this->network.httpPost(token, path, body);
+  return check(response);
 }
 
 auto Api::update(const AuthToken &token) noexcept
     -> iop_hal::UpdateStatus {
   IOP_TRACE();
   this->logger.infoln(IOP_STR("Upgrading sketch"));
+  if (this->unreachable()) return iop_hal::UpdateStatus::IO_ERROR;
 
   return this->network.update(IOP_STR("/v1/update"), iop::to_view(token));
 }
@@ -179,14 +352,20 @@ Api::Api(iop::StaticString uri) noexcept
   IOP_TRACE();
 }
 
-using FixedJsonBuffer = StaticJsonDocument<Api::JsonCapacity>;
-
 auto Api::makeJson(const iop::StaticString contextName, const Api::JsonCallback jsonObjectBuilder) noexcept -> Api::Json {
   IOP_TRACE();
 
-  auto doc = std::unique_ptr<FixedJsonBuffer>(new (std::nothrow) FixedJsonBuffer());
-  if (!doc) return nullptr;
-  doc->clear(); // Zeroes heap memory
+#ifdef IOP_STATIC_ARENA
+  auto doc = documents.make(releaseDocument);
+#else
+  auto doc = Box<FixedJsonBuffer>(new (std::nothrow) FixedJsonBuffer());
+#endif
+  if (!doc) {
+    this->logger.error(IOP_STR("Unable to allocate JSON document at "));
+    this->logger.errorln(contextName);
+    return nullptr;
+  }
+  doc->clear(); // Zeroes previous documents
   jsonObjectBuilder(*doc);
 
   if (doc->overflowed()) {
@@ -195,11 +374,20 @@ auto Api::makeJson(const iop::StaticString contextName, const Api::JsonCallback
     return nullptr;
   }
 
-  auto json = std::unique_ptr<std::array<char, JsonCapacity>>(new (std::nothrow) std::array<char, JsonCapacity>());
-  if (!json) return nullptr;
-  json->fill('\0'); // Zeroes heap memory
+#ifdef IOP_STATIC_ARENA
+  auto json = buffers.make(releaseBuffer);
+#else
+  auto json = Box<JsonBuffer>(new (std::nothrow) JsonBuffer());
+#endif
+  if (!json) {
+    this->logger.error(IOP_STR("Unable to allocate JSON buffer at "));
+    this->logger.errorln(contextName);
+    return nullptr;
+  }
+  json->fill('\0'); // Zeroes previous payloads
   serializeJson(*doc, json->data(), json->size());
 
-  return json;
+  const auto release = json.get_deleter().release;
+  return Api::Json(json.release(), Release<const JsonBuffer>{release});
 }
 }
\ No newline at end of file
@@ -0,0 +1,66 @@
+#include "iop/clock.hpp"
+#include "iop-hal/thread.hpp"
+#include "iop-hal/device.hpp"
+
+namespace iop {
+namespace clock {
+#ifdef IOP_LINUX_MOCK
+static VirtualClock processClock;
+static IOP_THREAD_LOCAL VirtualClock *threadClock = nullptr;
+
+static auto current() noexcept -> VirtualClock & { return threadClock ? *threadClock : processClock; }
+
+auto install(VirtualClock *clock) noexcept -> VirtualClock* {
+  auto *previous = threadClock;
+  threadClock = clock;
+  return previous;
+}
+
+auto useVirtualTime(const iop::time::milliseconds start) noexcept -> void {
+  current().enabled = true;
+  current().now = start;
+}
+auto useRealTime() noexcept -> void { current().enabled = false; }
+auto isVirtual() noexcept -> bool { return current().enabled; }
+auto advance(const iop::time::milliseconds duration) noexcept -> void { current().now += duration; }
+auto setYieldStep(const iop::time::milliseconds step) noexcept -> void { current().yieldStep = step; }
+#endif
+
+auto now() noexcept -> iop::time::milliseconds {
+#ifdef IOP_LINUX_MOCK
+  if (current().enabled) return current().now;
+#endif
+  return iop_hal::thisThread.timeRunning();
+}
+
+auto yield() noexcept -> void {
+#ifdef IOP_LINUX_MOCK
+  if (current().enabled) {
+    current().now += current().yieldStep;
+    return;
+  }
+#endif
+  iop_hal::thisThread.yield();
+}
+
+auto sleep(const iop::time::milliseconds duration) noexcept -> void {
+#ifdef IOP_LINUX_MOCK
+  if (current().enabled) {
+    current().now += duration;
+    return;
+  }
+#endif
+  iop_hal::thisThread.sleep(duration);
+}
+
+auto deepSleep(const uintmax_t seconds) noexcept -> void {
+#ifdef IOP_LINUX_MOCK
+  if (current().enabled) {
+    current().now += seconds * 1000;
+    return;
+  }
+#endif
+  iop_hal::device.deepSleep(seconds);
+}
+}
+}
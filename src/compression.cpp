@@ -0,0 +1,174 @@
+#include "iop/compression.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace iop {
+namespace compression {
+/// Deflate packs bits starting from the least significant, but Huffman codes from their most significant bit
+class BitWriter {
+  uint8_t *data;
+  size_t capacity;
+  size_t length = 0;
+  uint32_t buffer = 0;
+  uint8_t bits = 0;
+  bool overflowed = false;
+
+public:
+  BitWriter(uint8_t *data, size_t capacity) noexcept: data(data), capacity(capacity) {}
+
+  auto write(const uint32_t value, const uint8_t count) noexcept -> void {
+    this->buffer |= value << this->bits;
+    this->bits += count;
+    while (this->bits >= 8) {
+      this->byte(static_cast<uint8_t>(this->buffer));
+      this->buffer >>= 8;
+      this->bits -= 8;
+    }
+  }
+
+  auto writeCode(const uint32_t code, const uint8_t count) noexcept -> void {
+    uint32_t reversed = 0;
+    for (uint8_t index = 0; index < count; ++index) reversed |= ((code >> index) & 1) << (count - 1 - index);
+    this->write(reversed, count);
+  }
+
+  auto flush() noexcept -> void {
+    if (this->bits > 0) this->byte(static_cast<uint8_t>(this->buffer));
+    this->buffer = 0;
+    this->bits = 0;
+  }
+
+  auto byte(const uint8_t value) noexcept -> void {
+    if (this->length >= this->capacity) {
+      this->overflowed = true;
+      return;
+    }
+    this->data[this->length++] = value;
+  }
+
+  auto size() const noexcept -> std::optional<size_t> {
+    if (this->overflowed) return std::nullopt;
+    return this->length;
+  }
+};
+
+struct Range {
+  uint16_t base;
+  uint8_t extra;
+};
+
+// Symbols 257 to 285
+static constexpr std::array<Range, 29> lengths = {{
+  {3, 0}, {4, 0}, {5, 0}, {6, 0}, {7, 0}, {8, 0}, {9, 0}, {10, 0}, {11, 1}, {13, 1}, {15, 1}, {17, 1}, {19, 2}, {23, 2}, {27, 2},
+  {31, 2}, {35, 3}, {43, 3}, {51, 3}, {59, 3}, {67, 4}, {83, 4}, {99, 4}, {115, 4}, {131, 5}, {163, 5}, {195, 5}, {227, 5}, {258, 0},
+}};
+
+static constexpr std::array<Range, 30> distances = {{
+  {1, 0}, {2, 0}, {3, 0}, {4, 0}, {5, 1}, {7, 1}, {9, 2}, {13, 2}, {17, 3}, {25, 3}, {33, 4}, {49, 4}, {65, 5}, {97, 5}, {129, 6},
+  {193, 6}, {257, 7}, {385, 7}, {513, 8}, {769, 8}, {1025, 9}, {1537, 9}, {2049, 10}, {3073, 10}, {4097, 11}, {6145, 11},
+  {8193, 12}, {12289, 12}, {16385, 13}, {24577, 13},
+}};
+
+static constexpr uint16_t minMatch = 3;
+static constexpr uint16_t maxMatch = 258;
+
+static_assert(IOP_COMPRESSION_WINDOW <= 32768, "Deflate's window is at most 32KB");
+static_assert((IOP_COMPRESSION_HASH_ENTRIES & (IOP_COMPRESSION_HASH_ENTRIES - 1)) == 0, "IOP_COMPRESSION_HASH_ENTRIES must be a power of two");
+
+/// Fixed Huffman code of a literal/length symbol
+static auto symbol(BitWriter &writer, const uint16_t symbol) noexcept -> void {
+  if (symbol < 144) {
+    writer.writeCode(0x30 + symbol, 8);
+  } else if (symbol < 256) {
+    writer.writeCode(0x190 + symbol - 144, 9);
+  } else if (symbol < 280) {
+    writer.writeCode(symbol - 256, 7);
+  } else {
+    writer.writeCode(0xC0 + symbol - 280, 8);
+  }
+}
+
+template <size_t SIZE>
+static auto find(const std::array<Range, SIZE> &ranges, const uint16_t value) noexcept -> uint8_t {
+  uint8_t index = SIZE - 1;
+  while (ranges[index].base > value) index -= 1;
+  return index;
+}
+
+static auto match(BitWriter &writer, const uint16_t length, const uint16_t distance) noexcept -> void {
+  const auto lengthCode = find(lengths, length);
+  symbol(writer, 257 + lengthCode);
+  writer.write(length - lengths[lengthCode].base, lengths[lengthCode].extra);
+
+  const auto distanceCode = find(distances, distance);
+  writer.writeCode(distanceCode, 5);
+  writer.write(distance - distances[distanceCode].base, distances[distanceCode].extra);
+}
+
+static auto hash(const uint8_t *data) noexcept -> uint16_t {
+  const auto value = static_cast<uint32_t>(data[0]) << 16 | static_cast<uint32_t>(data[1]) << 8 | data[2];
+  return static_cast<uint16_t>((value * 2654435761U) >> 16) & (IOP_COMPRESSION_HASH_ENTRIES - 1);
+}
+
+static auto adler32(const std::string_view input) noexcept -> uint32_t {
+  uint32_t a = 1, b = 0;
+  for (const auto byte: input) {
+    a = (a + static_cast<uint8_t>(byte)) % 65521;
+    b = (b + a) % 65521;
+  }
+  return b << 16 | a;
+}
+
+auto deflate(const std::string_view input, uint8_t *output, const size_t capacity) noexcept -> std::optional<size_t> {
+  if (input.length() > UINT16_MAX) return std::nullopt;
+  const auto *data = reinterpret_cast<const uint8_t*>(input.data());
+  const auto length = static_cast<uint16_t>(input.length());
+
+  BitWriter writer(output, capacity);
+  // zlib header: deflate with a 32KB window (the decoder's limit), fastest compression
+  writer.byte(0x78);
+  writer.byte(0x01);
+  // A single final block with fixed Huffman codes, dynamic ones would need much more RAM
+  writer.write(1, 1);
+  writer.write(1, 2);
+
+  // Positions are stored plus one, zero means empty
+  std::array<uint16_t, IOP_COMPRESSION_HASH_ENTRIES> table = {};
+  uint16_t position = 0;
+  while (position < length) {
+    uint16_t matched = 0;
+    uint16_t distance = 0;
+
+    if (length - position >= minMatch) {
+      auto &entry = table[hash(data + position)];
+      if (entry && position - (entry - 1) <= IOP_COMPRESSION_WINDOW) {
+        const auto candidate = static_cast<uint16_t>(entry - 1);
+        const auto limit = static_cast<uint16_t>(std::min<size_t>(maxMatch, length - position));
+        while (matched < limit && data[candidate + matched] == data[position + matched]) matched += 1;
+        distance = static_cast<uint16_t>(position - candidate);
+      }
+      entry = static_cast<uint16_t>(position + 1);
+    }
+
+    if (matched >= minMatch) {
+      match(writer, matched, distance);
+      // Indexes the skipped positions, so later matches can find them
+      for (uint16_t skipped = 1; skipped < matched && position + skipped + minMatch <= length; ++skipped) {
+        table[hash(data + position + skipped)] = static_cast<uint16_t>(position + skipped + 1);
+      }
+      position += matched;
+    } else {
+      symbol(writer, data[position]);
+      position += 1;
+    }
+  }
+  symbol(writer, 256);
+  writer.flush();
+
+  const auto checksum = adler32(input);
+  for (int8_t shift = 24; shift >= 0; shift -= 8) writer.byte(static_cast<uint8_t>(checksum >> shift));
+  return writer.size();
+}
+}
+}
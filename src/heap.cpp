@@ -0,0 +1,160 @@
+#include "iop/heap.hpp"
+#include "iop-hal/panic.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+#include <Esp.h>
+#endif
+
+#if defined(IOP_HEAP_TRACKING) && (defined(IOP_LINUX_MOCK) || defined(IOP_LINUX))
+#define IOP_HEAP_HOOKS
+#endif
+
+namespace iop {
+auto loopPhaseToString(const LoopPhase phase) noexcept -> iop::StaticString {
+  switch (phase) {
+  case LoopPhase::SETUP:
+    return IOP_STR("SETUP");
+  case LoopPhase::INTERRUPTS:
+    return IOP_STR("INTERRUPTS");
+  case LoopPhase::CONNECTIVITY:
+    return IOP_STR("CONNECTIVITY");
+  case LoopPhase::REPORTS:
+    return IOP_STR("REPORTS");
+  case LoopPhase::AUTHENTICATED_TASKS:
+    return IOP_STR("AUTHENTICATED_TASKS");
+  case LoopPhase::TASKS:
+    return IOP_STR("TASKS");
+  case LoopPhase::SPLIT_TASKS:
+    return IOP_STR("SPLIT_TASKS");
+  }
+  return IOP_STR("UNKNOWN");
+}
+
+#ifdef IOP_HEAP_TRACKING
+static IOP_THREAD_LOCAL HeapUsage *currentUsage = nullptr;
+#endif
+
+#ifdef IOP_HEAP_HOOKS
+static std::atomic<uint32_t> totalAllocations(0);
+static std::atomic<uint32_t> totalFrees(0);
+static std::atomic<uint64_t> totalBytes(0);
+static IOP_THREAD_LOCAL bool forbidden = false;
+#endif
+
+#ifdef IOP_HEAP_TRACKING
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+static IOP_THREAD_LOCAL HeapScope *currentScope = nullptr;
+
+HeapScope::HeapScope(HeapUsage &usage) noexcept: previous(currentUsage), usage(usage), freeAtStart(ESP.getFreeHeap()), parent(currentScope), childrenDelta(0) {
+  currentUsage = &usage;
+  currentScope = this;
+}
+HeapScope::~HeapScope() noexcept {
+  const auto delta = static_cast<int32_t>(ESP.getFreeHeap()) - static_cast<int32_t>(this->freeAtStart);
+  // The free heap can't tell whose the memory was, so what nested scopes measured is theirs alone
+  this->usage.freeHeapDelta += delta - this->childrenDelta;
+  if (this->parent) this->parent->childrenDelta += delta;
+  currentUsage = this->previous;
+  currentScope = this->parent;
+}
+#else
+HeapScope::HeapScope(HeapUsage &usage) noexcept: previous(currentUsage) { currentUsage = &usage; }
+HeapScope::~HeapScope() noexcept { currentUsage = this->previous; }
+#endif
+#else
+HeapScope::HeapScope(HeapUsage &usage) noexcept { (void) usage; }
+HeapScope::~HeapScope() noexcept {}
+#endif
+
+namespace heap {
+auto stats() noexcept -> Stats {
+  Stats stats = { 0, 0, 0 };
+#if defined(IOP_ESP8266)
+  stats.free = ESP.getFreeHeap();
+  stats.largestBlock = ESP.getMaxFreeBlockSize();
+  stats.fragmentation = ESP.getHeapFragmentation();
+#elif defined(IOP_ESP32)
+  stats.free = ESP.getFreeHeap();
+  stats.largestBlock = ESP.getMaxAllocHeap();
+  stats.fragmentation = stats.free ? static_cast<uint8_t>(100 - stats.largestBlock * 100 / stats.free) : 0;
+#endif
+  return stats;
+}
+
+auto total() noexcept -> HeapUsage {
+  HeapUsage usage;
+#ifdef IOP_HEAP_HOOKS
+  usage.allocations = totalAllocations.load();
+  usage.frees = totalFrees.load();
+  usage.bytes = totalBytes.load();
+#endif
+  return usage;
+}
+
+#ifdef IOP_HEAP_TRACKING
+#ifdef IOP_HEAP_HOOKS
+Forbid::Forbid() noexcept: previous(forbidden) { forbidden = true; }
+Forbid::~Forbid() noexcept { forbidden = this->previous; }
+#else
+Forbid::Forbid() noexcept: previous(false) {}
+Forbid::~Forbid() noexcept {}
+#endif
+#else
+Forbid::Forbid() noexcept {}
+Forbid::~Forbid() noexcept {}
+#endif
+}
+
+#ifdef IOP_HEAP_HOOKS
+static auto trackAllocation(const size_t size) noexcept -> void {
+  if (forbidden) {
+    // Panicking allocates
+    forbidden = false;
+    iop_panic(IOP_STR("Heap allocation while forbidden by iop::heap::Forbid"));
+  }
+
+  totalAllocations++;
+  totalBytes += size;
+  if (auto *usage = currentUsage) {
+    usage->allocations++;
+    usage->bytes += size;
+  }
+}
+
+static auto trackFree(void *ptr) noexcept -> void {
+  if (!ptr) return;
+  totalFrees++;
+  if (auto *usage = currentUsage) usage->frees++;
+}
+#endif
+}
+
+#ifdef IOP_HEAP_HOOKS
+auto operator new(const size_t size) -> void* {
+  iop::trackAllocation(size);
+  auto *ptr = std::malloc(size ? size : 1);
+  // Exceptions may be disabled, and the framework uses the nothrow overloads
+  if (!ptr) std::abort();
+  return ptr;
+}
+auto operator new(const size_t size, const std::nothrow_t&) noexcept -> void* {
+  iop::trackAllocation(size);
+  return std::malloc(size ? size : 1);
+}
+auto operator new[](const size_t size) -> void* { return operator new(size); }
+auto operator new[](const size_t size, const std::nothrow_t &tag) noexcept -> void* { return operator new(size, tag); }
+
+void operator delete(void *ptr) noexcept {
+  iop::trackFree(ptr);
+  std::free(ptr);
+}
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete(void *ptr, const std::nothrow_t&) noexcept { operator delete(ptr); }
+void operator delete[](void *ptr) noexcept { operator delete(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t&) noexcept { operator delete(ptr); }
+#endif
@@ -1,7 +1,8 @@
 #include "iop-hal/log.hpp"
 #include "iop/loop.hpp"
 
-#include "iop-hal/thread.hpp"
+#include "iop/clock.hpp"
+#include "iop/arena.hpp"
 
 static auto staticPrinter(const iop::StaticString str, iop::LogLevel level, iop::LogType kind) noexcept -> void;
 static auto viewPrinter(const std::string_view, iop::LogLevel level, iop::LogType kind) noexcept -> void;
@@ -19,19 +20,85 @@ namespace network_logger {
 }
 }
 
-static auto currentLog = std::string();
-static auto logToNetwork = true;
+#ifdef IOP_STATIC_ARENA
+/// Fixed size, so logging to the network doesn't allocate. Longer logs are truncated, ending with "..."
+class LogBuffer {
+  static_assert(IOP_ARENA_LOG_SIZE >= 3, "IOP_ARENA_LOG_SIZE must fit the truncation marker");
+  std::array<char, IOP_ARENA_LOG_SIZE> buffer;
+  size_t length_ = 0;
+
+  auto append(const char *str, const size_t length, void *(*copy)(void*, const void*, size_t)) noexcept -> void {
+    const auto size = std::min(length, this->buffer.size() - this->length_);
+    copy(this->buffer.data() + this->length_, str, size);
+    this->length_ += size;
+    if (size < length) memcpy(this->buffer.data() + this->buffer.size() - 3, "...", 3);
+  }
+
+public:
+  auto operator+=(const std::string_view str) noexcept -> LogBuffer & {
+    this->append(str.data(), str.length(), memcpy);
+    return *this;
+  }
+  auto operator+=(const iop::StaticString str) noexcept -> LogBuffer & {
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+    this->append(reinterpret_cast<const char*>(str.get()), str.length(), memcpy_P);
+#else
+    this->append(reinterpret_cast<const char*>(str.get()), str.length(), memcpy);
+#endif
+    return *this;
+  }
+
+  auto length() const noexcept -> size_t { return this->length_; }
+  auto clear() noexcept -> void { this->length_ = 0; }
+  operator std::string_view() const noexcept { return std::string_view(this->buffer.data(), this->length_); }
+};
+#else
+/// Grows as needed, up to IOP_RADIO_LOG_BUFFER_BYTES, so logs buffered while the radio is off can't exhaust the heap.
+/// Longer logs are truncated, ending with "...", like the arena's buffer
+class LogBuffer {
+  static_assert(IOP_RADIO_LOG_BUFFER_BYTES >= 3, "IOP_RADIO_LOG_BUFFER_BYTES must fit the truncation marker");
+  std::string buffer;
+
+  auto append(const std::string_view str) noexcept -> void {
+    const auto size = std::min(str.length(), static_cast<size_t>(IOP_RADIO_LOG_BUFFER_BYTES) - this->buffer.length());
+    this->buffer.append(str.data(), size);
+    if (size < str.length()) this->buffer.replace(this->buffer.length() - 3, 3, "...");
+  }
+
+public:
+  auto operator+=(const std::string_view str) noexcept -> LogBuffer & {
+    this->append(str);
+    return *this;
+  }
+  auto operator+=(const iop::StaticString str) noexcept -> LogBuffer & {
+    // Copying from flash allocates, it's skipped once full
+    if (this->buffer.length() < IOP_RADIO_LOG_BUFFER_BYTES) {
+      this->append(str.toString());
+    } else {
+      this->append(std::string_view("..."));
+    }
+    return *this;
+  }
+
+  auto length() const noexcept -> size_t { return this->buffer.length(); }
+  auto clear() noexcept -> void { this->buffer.clear(); }
+  operator std::string_view() const noexcept { return this->buffer; }
+};
+#endif
+static IOP_THREAD_LOCAL auto currentLog = LogBuffer();
+static IOP_THREAD_LOCAL auto logToNetwork = true;
+static IOP_THREAD_LOCAL iop::time::milliseconds bufferedAt = 0;
 
 void reportLog() noexcept {
   if (!logToNetwork || !currentLog.length() || iop::wifi.status() != iop_hal::StationStatus::GOT_IP)
     return;
   logToNetwork = false;
 
-  iop_hal::thisThread.yield();
+  iop::clock::yield();
 
-  const auto token = iop::eventLoop.storage().token();
+  const auto token = iop::currentLoop().storage().token();
   if (token) {
-    iop::eventLoop.api().registerLog(*token, currentLog);
+    iop::currentLoop().api().registerLog(*token, currentLog);
   } else {
     iop::Log(IOP_STR("NETWORK LOGGING")).debugln(IOP_STR("Unable to log to the monitor server, not authenticated"));
   }
@@ -39,11 +106,23 @@ void reportLog() noexcept {
   currentLog.clear();
 }
 
+namespace iop {
+namespace network_logger {
+  auto pendingSince() noexcept -> std::optional<iop::time::milliseconds> {
+    if (!currentLog.length()) return std::nullopt;
+    return bufferedAt;
+  }
+
+  auto flush() noexcept -> void { reportLog(); }
+}
+}
+
 static void staticPrinter(const iop::StaticString str, const iop::LogLevel level, const iop::LogType kind) noexcept {
   iop::LogHook::defaultStaticPrinter(str, level, kind);
 
   if (logToNetwork && level >= iop::LogLevel::INFO) {
-    currentLog += str.toString();
+    if (!currentLog.length()) bufferedAt = iop::clock::now();
+    currentLog += str;
 
     if (kind == iop::LogType::END || kind == iop::LogType::STARTEND) {
       if (level <= iop::LogLevel::DEBUG) iop::LogHook::defaultStaticPrinter(IOP_STR("[DEBUG] Logger: Logging to network\n"), iop::LogLevel::DEBUG, iop::LogType::STARTEND);
@@ -56,6 +135,7 @@ static auto viewPrinter(const std::string_view str, const iop::LogLevel level, c
   iop::LogHook::defaultViewPrinter(str, level, kind);
 
   if (logToNetwork && level >= iop::LogLevel::INFO) {
+    if (!currentLog.length()) bufferedAt = iop::clock::now();
     currentLog += str;
 
     if (kind == iop::LogType::END || kind == iop::LogType::STARTEND) {
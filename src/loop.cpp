@@ -5,6 +5,14 @@
 #include "iop-hal/device.hpp"
 #include "iop/utils.hpp"
 
+#include <algorithm>
+
+#if defined(IOP_ESP8266)
+#include <Esp.h>
+#elif defined(IOP_ESP32)
+#include <esp_ota_ops.h>
+#endif
+
 #define STRINGIFY(s) STRINGIFY_(s)
 #define STRINGIFY_(s) #s
 
@@ -51,9 +59,80 @@ static const char* uriRaw IOP_ROM = "https://api.internet-of-plants.org:4001";
 #endif
 static const StaticString uri(reinterpret_cast<const __FlashStringHelper*>(uriRaw));
 
+// Only changes when the library is compiled, which PlatformIO skips if the user code is the only thing that changed.
+// Firmwares generated by the monitor server also define IOP_BUILD_ID
+#ifdef IOP_BUILD_ID
+static const char* buildRaw = __DATE__ " " __TIME__ " " STRINGIFY(IOP_BUILD_ID);
+#else
+static const char* buildRaw = __DATE__ " " __TIME__;
+#endif
+
+// Link time of the image, `build_flags.py` defines its address (`--defsym`) at every link, so it changes with the user code too.
+// Weak, so it's null if the firmware wasn't linked with it
+extern "C" const char iop_build_stamp[] __attribute__((weak));
+
+/// Identity of the running image, if it can be told apart from other images cheaply
+static auto firmwareIdentity() noexcept -> std::optional<FirmwareIdentity> {
+  const auto stamp = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(iop_build_stamp));
+  if (stamp == 0) return std::nullopt;
+
+  FirmwareIdentity identity;
+  identity.build = iop::hash(buildRaw, stamp);
+#if defined(IOP_ESP8266)
+  // Reads the image headers, doesn't hash the image
+  identity.image = ESP.getSketchSize();
+#elif defined(IOP_ESP32)
+  // ESP.getSketchSize verifies the image, which is as slow as hashing it. The running partition changes at every OTA
+  const auto *partition = esp_ota_get_running_partition();
+  identity.image = partition ? partition->address : 0;
+#else
+  identity.image = 0;
+#endif
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+  if (identity.image == 0) return std::nullopt;
+#endif
+  return identity;
+}
+
 EventLoop eventLoop(uri);
 
+static IOP_THREAD_LOCAL EventLoop *runningLoop = nullptr;
+
+auto currentLoop() noexcept -> EventLoop & { return runningLoop ? *runningLoop : eventLoop; }
+
+/// Makes the loop (and its clock) current while it runs, so the hooks act on the right device
+class RunningLoop {
+  EventLoop *previous;
+#ifdef IOP_LINUX_MOCK
+  VirtualClock *previousClock = nullptr;
+  bool installedClock = false;
+#endif
+
+public:
+  explicit RunningLoop(EventLoop &loop) noexcept: previous(runningLoop) {
+    runningLoop = &loop;
+#ifdef IOP_LINUX_MOCK
+    if (loop.clock_) {
+      this->previousClock = iop::clock::install(loop.clock_);
+      this->installedClock = true;
+    }
+#endif
+  }
+
+  ~RunningLoop() noexcept {
+#ifdef IOP_LINUX_MOCK
+    if (this->installedClock) iop::clock::install(this->previousClock);
+#endif
+    runningLoop = this->previous;
+  }
+
+  RunningLoop(RunningLoop const &other) noexcept = delete;
+  auto operator=(RunningLoop const &other) noexcept -> RunningLoop & = delete;
+};
+
 auto EventLoop::setup() noexcept -> void {
+  const RunningLoop running(*this);
+  const HeapScope heap(this->heapUsage_[static_cast<uint8_t>(LoopPhase::SETUP)]);
   iop::Log::setup();
 
   IOP_TRACE();
@@ -61,23 +140,65 @@ auto EventLoop::setup() noexcept -> void {
   this->logger().infoln(IOP_STR("Start Setup"));
   //iop_hal::gpio.setMode(iop_hal::io::LED_BUILTIN, iop_hal::io::Mode::OUTPUT);
 
-  Storage::setup();
+  this->storage().setup();
+  this->hashedFirmware = false;
+  this->pendingUpgrade = false;
+  this->bootTimeline.mark(BootStage::STORAGE);
+
+  const auto resetReason = iop::panic::resetReason();
+  this->logger().info(IOP_STR("Reset reason: "));
+  this->logger().infoln(iop::panic::resetReasonToString(resetReason));
+  iop::panic::recordUnexpectedReset(resetReason);
+  // After the reset was recorded, as it consumes the previous watchdog record
+  iop::watchdog::setup();
+
   this->logger().info(IOP_STR("Api endpoint: "));
   this->logger().infoln(uri);
   this->api().setup();
+  this->bootTimeline.mark(BootStage::API);
   iop::panic::setup();
+  this->bootTimeline.mark(BootStage::PANIC);
   iop::network_logger::setup();
-  this->credentialsServer.setup();
-  const auto md5 = iop::to_view(iop_hal::device.firmwareMD5());
+  this->bootTimeline.mark(BootStage::NETWORK_LOGGER);
+  this->credentialsServer.setup(*this);
+  this->bootTimeline.mark(BootStage::CREDENTIALS_SERVER);
+  const auto md5Start = iop::clock::now();
+  const auto md5 = this->firmwareMD5();
   this->logger().info(IOP_STR("MD5: "));
   this->logger().infoln(md5);
+  this->logger().debug(IOP_STR("Firmware MD5 took (ms): "));
+  this->logger().debugln(static_cast<uint64_t>(iop::clock::now() - md5Start));
+  this->bootTimeline.mark(BootStage::FIRMWARE_MD5);
   this->logger().infoln(IOP_STR("Core setup finished, running user layer's setup"));
 
   iop::setup(*this);
+  this->bootTimeline.mark(BootStage::USER_SETUP);
 
   this->logger().infoln(IOP_STR("User setup finished, starting event loop"));
 }
 
+auto EventLoop::firmwareMD5() noexcept -> std::string_view {
+  IOP_TRACE();
+
+  // Without an identity the cache can't tell images apart, so it's only trusted after hashing the image in this boot
+  const auto identity = firmwareIdentity();
+  const auto key = identity.value_or(FirmwareIdentity { 0, 0 });
+  if (identity || this->hashedFirmware) {
+    if (const auto cached = this->storage().firmwareMD5(key)) {
+      return iop::to_view(cached->get());
+    }
+  }
+
+  this->logger().debugln(IOP_STR("Hashing firmware image"));
+  const iop::MD5Hash md5 = iop_hal::device.firmwareMD5();
+  this->storage().setFirmwareMD5(key, md5);
+  this->hashedFirmware = true;
+
+  const auto cached = this->storage().firmwareMD5(key);
+  iop_assert(cached, IOP_STR("Unable to cache firmware MD5"));
+  return iop::to_view(cached->get());
+}
+
 auto EventLoop::setAccessPointCredentials(StaticString SSID, StaticString PSK) noexcept -> void {
   this->credentialsServer.setAccessPointCredentials(SSID, PSK);
 }
@@ -90,20 +211,32 @@ auto EventLoop::setCleanup(iop::PanicHook::Cleanup cleanup) const noexcept -> vo
   panic::setCleanup(cleanup);
 }
 
-AuthenticatedTaskInterval::AuthenticatedTaskInterval(iop::time::milliseconds interval, std::function<void(EventLoop&, const AuthToken&)> func) noexcept:
-  next(0), interval(interval), func(func) {}
-TaskInterval::TaskInterval(iop::time::milliseconds interval, std::function<void(EventLoop&)> func) noexcept:
-  next(0), interval(interval), func(func) {}
+auto EventLoop::setPanicWakeSchedule(const Backoff schedule) const noexcept -> void {
+  panic::setWakeSchedule(schedule);
+}
+
+AuthenticatedTaskInterval::AuthenticatedTaskInterval(iop::time::milliseconds interval, std::function<void(EventLoop&, const AuthToken&)> func, Priority priority, iop::time::milliseconds maxRunTime) noexcept:
+  next(0), interval(interval), func(func), priority(priority), maxRunTime(maxRunTime) {}
+TaskInterval::TaskInterval(iop::time::milliseconds interval, std::function<void(EventLoop&)> func, Priority priority, iop::time::milliseconds maxRunTime) noexcept:
+  next(0), interval(interval), func(func), priority(priority), maxRunTime(maxRunTime) {}
 
-auto EventLoop::setAuthenticatedInterval(iop::time::milliseconds interval, std::function<void(EventLoop&, const AuthToken&)> func) noexcept -> void {
-  this->authenticatedTasks.push_back(AuthenticatedTaskInterval(interval, func));
+Resume::Resume(iop::time::milliseconds timeout, std::function<bool()> ready) noexcept:
+  timeout(timeout), ready(std::move(ready)) {}
+SplitTaskInterval::SplitTaskInterval(iop::time::milliseconds interval, std::function<std::optional<Resume>(EventLoop&)> start, std::function<void(EventLoop&, bool)> finish, iop::time::milliseconds maxRunTime) noexcept:
+  next(0), interval(interval), start(start), finish(finish), pending(), deadline(0), maxRunTime(maxRunTime) {}
+
+auto EventLoop::setSplitInterval(iop::time::milliseconds interval, std::function<std::optional<Resume>(EventLoop&)> start, std::function<void(EventLoop&, bool)> finish, const iop::time::milliseconds maxRunTime) noexcept -> void {
+  this->splitTasks.push_back(SplitTaskInterval(interval, start, finish, maxRunTime));
+}
+auto EventLoop::setAuthenticatedInterval(iop::time::milliseconds interval, std::function<void(EventLoop&, const AuthToken&)> func, const Priority priority, const iop::time::milliseconds maxRunTime) noexcept -> void {
+  this->authenticatedTasks.push_back(AuthenticatedTaskInterval(interval, func, priority, maxRunTime));
 }
-auto EventLoop::setInterval(iop::time::milliseconds interval, std::function<void(EventLoop&)> func) noexcept -> void {
-  this->tasks.push_back(TaskInterval(interval, func));
+auto EventLoop::setInterval(iop::time::milliseconds interval, std::function<void(EventLoop&)> func, const Priority priority, const iop::time::milliseconds maxRunTime) noexcept -> void {
+  this->tasks.push_back(TaskInterval(interval, func, priority, maxRunTime));
 }
 
-constexpr static uint64_t intervalTryStorageWifiCredentialsMillis =
-    10 * 60 * 1000; // 10 minutes
+// Per stored network, from 30 seconds to 10 minutes
+constexpr static Backoff backoffTryStorageWifi(30 * 1000, 10 * 60 * 1000, 2, 10);
 
 constexpr static uint64_t intervalTryHardcodedWifiCredentialsMillis =
     10 * 60 * 1000; // 10 minutes
@@ -111,6 +244,12 @@ constexpr static uint64_t intervalTryHardcodedWifiCredentialsMillis =
 constexpr static uint64_t intervalTryHardcodedIopCredentialsMillis =
     10 * 60 * 1000; // 10 minutes
 
+constexpr static uint64_t intervalTryCrashReportMillis =
+    10 * 60 * 1000; // 10 minutes
+
+constexpr static uint64_t intervalReportDeadlineMissesMillis =
+    10 * 60 * 1000; // 10 minutes
+
 auto EventLoop::syncNTP() noexcept -> void {
   IOP_TRACE();
 
@@ -126,7 +265,7 @@ auto EventLoop::syncNTP() noexcept -> void {
   this->logger().infoln(now.minute);
 
   constexpr const uint32_t oneDay = 24 * 60 * 60 * 1000;
-  this->nextNTPSync = iop_hal::thisThread.timeRunning() + oneDay;
+  this->nextNTPSync = iop::clock::now() + oneDay;
 }
 
 auto EventLoop::serve() noexcept -> void {
@@ -135,7 +274,7 @@ auto EventLoop::serve() noexcept -> void {
     auto authToken = this->api().authenticate(creds->organization, creds->login, creds->password);
 
     this->logger().debugln(IOP_STR("Tried to authenticate"));
-    if (const auto *token = std::get_if<std::unique_ptr<AuthToken>>(&authToken)) {
+    if (const auto *token = std::get_if<Box<AuthToken>>(&authToken)) {
       this->storage().setToken(**token);
     } else if (const auto *error = std::get_if<iop::NetworkStatus>(&authToken)) {
       this->handleAuthenticationFailure(*error);
@@ -143,29 +282,134 @@ auto EventLoop::serve() noexcept -> void {
   }
 }
 
-auto EventLoop::runAuthenticatedTasks() noexcept -> void {
-  IOP_TRACE();
-
-  const auto token = this->storage().token();
-  iop_assert(token, IOP_STR("Auth Token not found"));
+// Tasks that become due meanwhile wait for the next call, so a zero interval doesn't run forever
+template <typename Task, typename Run, typename Between>
+auto EventLoop::runDue(std::vector<Task> &tasks, const Priority priority, const LoopPhase phase, Run run, Between between) noexcept -> void {
+  auto &lateness = this->lateness_[static_cast<uint8_t>(priority)];
+  const auto now = iop::clock::now();
+  while (true) {
+    Task *earliest = nullptr;
+    for (auto &task: tasks) {
+      if (task.priority != priority || task.next >= now) continue;
+      if (!earliest || task.next < earliest->next) earliest = &task;
+    }
+    if (!earliest) return;
+
+    // The first run isn't scheduled, so it isn't late
+    const auto late = earliest->next ? iop::clock::now() - earliest->next : 0;
+    if (earliest->next) lateness.add(static_cast<double>(late));
+    earliest->next = iop::clock::now() + earliest->interval;
+
+    // Tasks may register others, moving the vector
+    const auto index = static_cast<uint16_t>(earliest - tasks.data());
+    iop::watchdog::enter(phase, index, earliest->maxRunTime);
+    {
+      const HeapScope taskHeap(earliest->heap);
+      run(*earliest);
+    }
+    const auto took = iop::watchdog::leave();
 
-  for (auto & task: this->authenticatedTasks) {
-    if (task.next < iop_hal::thisThread.timeRunning()) {
-      task.next = iop_hal::thisThread.timeRunning() + task.interval;
-      (task.func)(*this, *token);
-      iop_hal::thisThread.yield();
+    // Starting more than a whole interval late means runs were skipped
+    const auto &task = tasks[index];
+    if ((task.interval > 0 && late > task.interval) || took > task.maxRunTime) {
+      this->recordDeadlineMiss(DeadlineMiss { phase, index, late, took });
     }
+    iop::clock::yield();
+    between();
+  }
+}
+
+auto EventLoop::recordDeadlineMiss(const DeadlineMiss miss) noexcept -> void {
+  this->deadlineMisses_ += 1;
+  this->lastDeadlineMiss = miss;
+
+  // Reported as events, logging each of them to the network would add to the load
+  this->logger().debug(IOP_STR("Deadline miss, "));
+  this->logger().debug(loopPhaseToString(miss.phase));
+  this->logger().debug(IOP_STR(" task "));
+  this->logger().debug(static_cast<uint64_t>(miss.task));
+  this->logger().debug(IOP_STR(", late (ms): "));
+  this->logger().debug(static_cast<uint64_t>(miss.late));
+  this->logger().debug(IOP_STR(", took (ms): "));
+  this->logger().debugln(static_cast<uint64_t>(miss.took));
+}
+
+auto EventLoop::runAuthenticatedTasks() noexcept -> void {
+  IOP_TRACE();
+  const HeapScope heap(this->heapUsage_[static_cast<uint8_t>(LoopPhase::AUTHENTICATED_TASKS)]);
+
+  iop_assert(this->storage().token(), IOP_STR("Auth Token not found"));
+
+  // A task may have the token refused and removed, so it's fetched for each of them
+  const auto run = [this](AuthenticatedTaskInterval &task) {
+    const auto token = this->storage().token();
+    if (token) (task.func)(*this, *token);
+  };
+  for (uint8_t index = 0; index < priorities; ++index) {
+    const auto priority = static_cast<Priority>(index);
+    this->runDue(this->authenticatedTasks, priority, LoopPhase::AUTHENTICATED_TASKS, run, [this, priority]() {
+      if (priority != Priority::CRITICAL) this->runCriticalTasks();
+    });
   }
 }
 
 auto EventLoop::runUnauthenticatedTasks() noexcept -> void {
   IOP_TRACE();
+  const HeapScope heap(this->heapUsage_[static_cast<uint8_t>(LoopPhase::TASKS)]);
+
+  const auto run = [this](TaskInterval &task) { (task.func)(*this); };
+  for (uint8_t index = 0; index < priorities; ++index) {
+    const auto priority = static_cast<Priority>(index);
+    this->runDue(this->tasks, priority, LoopPhase::TASKS, run, [this, priority]() {
+      if (priority != Priority::CRITICAL) this->runCriticalTasks();
+    });
+  }
+}
+
+auto EventLoop::runCriticalTasks() noexcept -> void {
+  IOP_TRACE();
+
+  const auto nothing = []() {};
+  this->runDue(this->tasks, Priority::CRITICAL, LoopPhase::TASKS, [this](TaskInterval &task) { (task.func)(*this); }, nothing);
 
-  for (auto & task: this->tasks) {
-    if (task.next < iop_hal::thisThread.timeRunning()) {
-      task.next = iop_hal::thisThread.timeRunning() + task.interval;
-      (task.func)(*this);
-      iop_hal::thisThread.yield();
+  if (!this->storage().token()) return;
+  this->runDue(this->authenticatedTasks, Priority::CRITICAL, LoopPhase::AUTHENTICATED_TASKS, [this](AuthenticatedTaskInterval &task) {
+    const auto token = this->storage().token();
+    if (token) (task.func)(*this, *token);
+  }, nothing);
+}
+
+auto EventLoop::runSplitTasks() noexcept -> void {
+  IOP_TRACE();
+  const HeapScope heap(this->heapUsage_[static_cast<uint8_t>(LoopPhase::SPLIT_TASKS)]);
+
+  for (size_t index = 0; index < this->splitTasks.size(); ++index) {
+    auto &task = this->splitTasks[index];
+    const HeapScope taskHeap(task.heap);
+    const auto id = static_cast<uint16_t>(index);
+
+    if (task.pending) {
+      const auto ready = task.pending->ready && task.pending->ready();
+      if (!ready && task.deadline > iop::clock::now()) continue;
+
+      const auto timedOut = !ready && task.pending->ready;
+      task.pending.reset();
+      iop::watchdog::enter(LoopPhase::SPLIT_TASKS, id, task.maxRunTime);
+      (task.finish)(*this, timedOut);
+      const auto took = iop::watchdog::leave();
+      if (took > task.maxRunTime) this->recordDeadlineMiss(DeadlineMiss { LoopPhase::SPLIT_TASKS, id, 0, took });
+      iop::clock::yield();
+      this->runCriticalTasks();
+
+    } else if (task.next < iop::clock::now()) {
+      // The interval counts from the start, so the operation's duration doesn't drift the schedule
+      task.next = iop::clock::now() + task.interval;
+      iop::watchdog::enter(LoopPhase::SPLIT_TASKS, id, task.maxRunTime);
+      task.pending = (task.start)(*this);
+      const auto took = iop::watchdog::leave();
+      if (took > task.maxRunTime) this->recordDeadlineMiss(DeadlineMiss { LoopPhase::SPLIT_TASKS, id, 0, took });
+      if (task.pending) task.deadline = iop::clock::now() + task.pending->timeout;
+      iop::clock::yield();
     }
   }
 }
@@ -181,19 +425,37 @@ auto EventLoop::logIteration() noexcept -> void {
 }
 
 auto EventLoop::loop() noexcept -> void {
+  const RunningLoop running(*this);
+  // Getting here means the previous iteration finished
+  iop::watchdog::feed();
+  // Phases below have their own scopes, what's left is connectivity
+  const HeapScope heap(this->heapUsage_[static_cast<uint8_t>(LoopPhase::CONNECTIVITY)]);
   this->logger().traceln(IOP_STR("\n\n\n\n\n\n"));
   IOP_TRACE();
 
   this->logIteration();
 
+  if (iop::Network::isConnected()) {
+    this->bootTimeline.mark(BootStage::WIFI);
+    if (this->storage().token()) this->bootTimeline.mark(BootStage::AUTHENTICATION);
+  }
+
+  this->runCriticalTasks();
   if (this->handleInterrupts()) {
     return;
   }
 
-  if (iop::Network::isConnected() && this->nextNTPSync < iop_hal::thisThread.timeRunning()) {
+  if (this->radioOff && this->nextNetworkDeadline() <= iop::clock::now() + this->radioPolicy.wakeAhead) {
+    this->wakeRadio();
+  }
+
+  if (this->radioOff) {
+    // Until the next network deadline only the tasks that don't need the network run
+
+  } else if (iop::Network::isConnected() && this->nextNTPSync < iop::clock::now()) {
     this->syncNTP();
 
-  } else if (iop::Network::isConnected() && !this->storage().token() && iopUsername && iopPassword && this->nextTryHardcodedIopCredentials <= iop_hal::thisThread.timeRunning()) {
+  } else if (iop::Network::isConnected() && !this->storage().token() && iopUsername && iopPassword && this->nextTryHardcodedIopCredentials <= iop::clock::now()) {
     if (!this->credentialsServer.close()) {
       this->handleHardcodedIopCreds();
     }
@@ -205,29 +467,314 @@ auto EventLoop::loop() noexcept -> void {
     //
     // But hardcoded or creds persisted in memory will be retried
 
-    if (!iop::Network::isConnected() && this->storage().wifi() && this->nextTryStorageWifiCredentials <= iop_hal::thisThread.timeRunning()) {
+    // Retries close the portal, so they wait while someone is using it
+    const auto portalInUse = this->credentialsServer.inUse();
+    const auto storedWifi = iop::Network::isConnected() || portalInUse ? std::nullopt : this->nextStoredWifi();
+    if (storedWifi) {
       this->credentialsServer.close();
-      this->handleStoredWifiCreds();
+      this->handleStoredWifiCreds(*storedWifi);
 
-    } else if (!iop::Network::isConnected() && wifiSSID && wifiPSK && this->nextTryHardcodedWifiCredentials <= iop_hal::thisThread.timeRunning()) {
+    } else if (!iop::Network::isConnected() && !portalInUse && wifiSSID && wifiPSK && this->nextTryHardcodedWifiCredentials <= iop::clock::now()) {
       this->credentialsServer.close();
       this->handleHardcodedWifiCreds();
 
     } else {
+      // Serving may block authenticating the submitted credentials
+      this->runCriticalTasks();
       this->serve();
     }
 
   } else {
+    this->handleCrashReport();
+    this->runCriticalTasks();
     this->runAuthenticatedTasks();
+    this->handleBootTimeline();
+    this->handleDeadlineMisses();
+    this->handleRadioReport();
+    this->sleepRadio();
   }
 
+  this->runCriticalTasks();
   this->runUnauthenticatedTasks();
+  this->runSplitTasks();
+
+#ifdef IOP_HEAP_TRACKING
+  if (this->nextHeapReport <= iop::clock::now()) {
+    this->nextHeapReport = iop::clock::now() + IOP_HEAP_REPORT_MILLIS;
+    this->logHeapUsage();
+  }
+#endif
+}
+
+static auto logHeap(iop::Log &logger, const HeapUsage &usage) noexcept -> void {
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+  logger.debug(IOP_STR("free heap delta: "));
+  if (usage.freeHeapDelta < 0) logger.debug(IOP_STR("-"));
+  logger.debugln(static_cast<uint64_t>(usage.freeHeapDelta < 0 ? -static_cast<int64_t>(usage.freeHeapDelta) : usage.freeHeapDelta));
+#else
+  logger.debug(IOP_STR("allocations: "));
+  logger.debug(static_cast<uint64_t>(usage.allocations));
+  logger.debug(IOP_STR(", frees: "));
+  logger.debug(static_cast<uint64_t>(usage.frees));
+  logger.debug(IOP_STR(", bytes: "));
+  logger.debugln(static_cast<uint64_t>(usage.bytes));
+#endif
 }
 
-auto EventLoop::handleStoredWifiCreds() noexcept -> void {
+auto EventLoop::logHeapUsage() noexcept -> void {
   IOP_TRACE();
 
-  const auto &wifi = this->storage().wifi();
+  const auto stats = heap::stats();
+  this->logger().debug(IOP_STR("Free heap: "));
+  this->logger().debug(static_cast<uint64_t>(stats.free));
+  this->logger().debug(IOP_STR(", largest block: "));
+  this->logger().debug(static_cast<uint64_t>(stats.largestBlock));
+  this->logger().debug(IOP_STR(", fragmentation (%): "));
+  this->logger().debugln(static_cast<uint64_t>(stats.fragmentation));
+
+  for (uint8_t phase = 0; phase < loopPhases; ++phase) {
+    this->logger().debug(loopPhaseToString(static_cast<LoopPhase>(phase)));
+    this->logger().debug(IOP_STR(" "));
+    logHeap(this->logger(), this->heapUsage_[phase]);
+  }
+
+  // Tasks have no names, they are identified by the order they were registered
+  for (size_t index = 0; index < this->authenticatedTasks.size(); ++index) {
+    this->logger().debug(IOP_STR("Authenticated task "));
+    this->logger().debug(static_cast<uint64_t>(index));
+    this->logger().debug(IOP_STR(" "));
+    logHeap(this->logger(), this->authenticatedTasks[index].heap);
+  }
+  for (size_t index = 0; index < this->tasks.size(); ++index) {
+    this->logger().debug(IOP_STR("Task "));
+    this->logger().debug(static_cast<uint64_t>(index));
+    this->logger().debug(IOP_STR(" "));
+    logHeap(this->logger(), this->tasks[index].heap);
+  }
+  for (size_t index = 0; index < this->splitTasks.size(); ++index) {
+    this->logger().debug(IOP_STR("Split task "));
+    this->logger().debug(static_cast<uint64_t>(index));
+    this->logger().debug(IOP_STR(" "));
+    logHeap(this->logger(), this->splitTasks[index].heap);
+  }
+}
+
+auto EventLoop::handleBootTimeline() noexcept -> void {
+  IOP_TRACE();
+  const HeapScope heap(this->heapUsage_[static_cast<uint8_t>(LoopPhase::REPORTS)]);
+
+  if (!this->bootTimeline.isReady()) return;
+  // Sent only once, we don't want to disturb the normal operation retrying it
+  this->bootTimeline.setReported();
+
+  const auto token = this->storage().token();
+  iop_assert(token, IOP_STR("Auth Token not found"));
+
+  const auto md5 = this->firmwareMD5();
+  const auto make = [this, md5](JsonDocument &doc) {
+    auto timeline = doc.createNestedObject("boot_timeline");
+    timeline["firmware"] = md5;
+    for (uint8_t index = 0; index < bootStages; ++index) {
+      const auto stage = static_cast<BootStage>(index);
+      const auto moment = this->bootTimeline.at(stage);
+      if (moment) timeline[BootTimeline::toString(stage).toString()] = static_cast<uint64_t>(*moment);
+    }
+  };
+  auto json = this->api().makeJson(IOP_FUNC, make);
+  if (!json) {
+    this->logger().errorln(IOP_STR("Boot timeline doesn't fit IOP_JSON_CAPACITY"));
+    return;
+  }
+  this->registerEvent(*token, std::move(json));
+}
+
+auto EventLoop::handleDeadlineMisses() noexcept -> void {
+  IOP_TRACE();
+  const HeapScope heap(this->heapUsage_[static_cast<uint8_t>(LoopPhase::REPORTS)]);
+
+  if (this->reportedDeadlineMisses == this->deadlineMisses_ || !this->lastDeadlineMiss) return;
+  // A task that always misses would otherwise send an event every iteration
+  if (this->nextDeadlineMissReport > iop::clock::now()) return;
+  this->nextDeadlineMissReport = iop::clock::now() + intervalReportDeadlineMissesMillis;
+
+  const auto token = this->storage().token();
+  iop_assert(token, IOP_STR("Auth Token not found"));
+
+  const auto miss = *this->lastDeadlineMiss;
+  const auto count = this->deadlineMisses_ - this->reportedDeadlineMisses;
+  const auto make = [miss, count](JsonDocument &doc) {
+    auto report = doc.createNestedObject("deadline_misses");
+    report["count"] = count;
+    // Details of the last one
+    report["phase"] = loopPhaseToString(miss.phase).toString();
+    report["task"] = miss.task;
+    report["late"] = static_cast<uint64_t>(miss.late);
+    report["took"] = static_cast<uint64_t>(miss.took);
+  };
+  auto json = this->api().makeJson(IOP_FUNC, make);
+  if (!json) {
+    this->logger().errorln(IOP_STR("Deadline misses don't fit IOP_JSON_CAPACITY"));
+    return;
+  }
+
+  const auto status = this->api().registerEvent(*token, iop::to_view(*json));
+  if (status == iop::NetworkStatus::OK) this->reportedDeadlineMisses += count;
+  this->handleEventStatus(status);
+}
+
+auto EventLoop::setRadioPolicy(const RadioPolicy policy) noexcept -> void {
+  this->radioPolicy = policy;
+  if (this->radioOff && policy.mode != RadioMode::OFF) this->wakeRadio();
+  if (iop::Network::isConnected()) iop::radio::setMode(policy.mode);
+}
+
+auto EventLoop::radioOnTime() const noexcept -> iop::time::milliseconds {
+  if (this->radioOff) return this->radioOnMillis;
+  return this->radioOnMillis + (iop::clock::now() - this->radioOnSince);
+}
+
+auto EventLoop::nextNetworkDeadline() noexcept -> iop::time::milliseconds {
+  // A pending update needs the network now
+  if (this->pendingUpgrade) return iop::clock::now();
+
+  auto deadline = this->nextNTPSync;
+  for (const auto &task: this->authenticatedTasks) deadline = std::min(deadline, task.next);
+
+  if (this->storage().crashReport()) deadline = std::min(deadline, this->nextTryCrashReport);
+  if (this->reportedDeadlineMisses != this->deadlineMisses_) deadline = std::min(deadline, this->nextDeadlineMissReport);
+  if (this->radioPolicy.mode != RadioMode::ALWAYS_ON) deadline = std::min(deadline, this->nextRadioReport);
+  if (const auto since = iop::network_logger::pendingSince()) deadline = std::min(deadline, *since + this->radioPolicy.logFlush);
+  return deadline;
+}
+
+auto EventLoop::sleepRadio() noexcept -> void {
+  IOP_TRACE();
+  if (this->radioPolicy.mode != RadioMode::OFF) return;
+
+  // Logs buffered while offline wait for the next wake up otherwise
+  iop::network_logger::flush();
+
+  const auto now = iop::clock::now();
+  const auto deadline = this->nextNetworkDeadline();
+  if (deadline <= now + this->radioPolicy.minimumOff) return;
+
+  // Logged before turning off, so it isn't buffered
+  this->logger().debug(IOP_STR("Turning radio off, next network deadline in (ms): "));
+  this->logger().debugln(static_cast<uint64_t>(deadline - now));
+
+  this->radioOnMillis += now - this->radioOnSince;
+  this->radioOff = true;
+  iop::radio::off();
+#ifdef IOP_LINUX_MOCK
+  this->api().setRadioOff(true);
+#endif
+}
+
+auto EventLoop::wakeRadio() noexcept -> void {
+  IOP_TRACE();
+
+  iop::radio::on();
+#ifdef IOP_LINUX_MOCK
+  this->api().setRadioOff(false);
+#endif
+  this->radioOff = false;
+  this->radioOnSince = iop::clock::now();
+  this->radioWakes += 1;
+  // The loop reconnects to the last network right away, with a fast connect
+  this->logger().debugln(IOP_STR("Radio turned on for the next network deadline"));
+}
+
+auto EventLoop::handleRadioReport() noexcept -> void {
+  IOP_TRACE();
+  const HeapScope heap(this->heapUsage_[static_cast<uint8_t>(LoopPhase::REPORTS)]);
+
+  if (this->radioPolicy.mode == RadioMode::ALWAYS_ON || this->nextRadioReport > iop::clock::now()) return;
+  this->nextRadioReport = iop::clock::now() + IOP_RADIO_REPORT_MILLIS;
+
+  const auto token = this->storage().token();
+  iop_assert(token, IOP_STR("Auth Token not found"));
+
+  const auto onTime = this->radioOnTime();
+  const auto wakes = this->radioWakes;
+  const auto mode = this->radioPolicy.mode;
+  const auto make = [onTime, wakes, mode](JsonDocument &doc) {
+    auto report = doc.createNestedObject("radio");
+    report["mode"] = mode == RadioMode::OFF ? "OFF" : "MODEM_SLEEP";
+    report["on_millis"] = static_cast<uint64_t>(onTime);
+    report["uptime_millis"] = static_cast<uint64_t>(iop::clock::now());
+    report["wakes"] = wakes;
+  };
+  auto json = this->api().makeJson(IOP_FUNC, make);
+  if (!json) {
+    this->logger().errorln(IOP_STR("Radio report doesn't fit IOP_JSON_CAPACITY"));
+    return;
+  }
+  this->registerEvent(*token, std::move(json));
+}
+
+auto EventLoop::handleCrashReport() noexcept -> void {
+  IOP_TRACE();
+  const HeapScope heap(this->heapUsage_[static_cast<uint8_t>(LoopPhase::REPORTS)]);
+
+  if (this->nextTryCrashReport > iop::clock::now()) return;
+
+  const auto report = this->storage().crashReport();
+  if (!report) return;
+
+  const auto token = this->storage().token();
+  iop_assert(token, IOP_STR("Auth Token not found"));
+
+  const auto status = this->api().reportPanic(*token, *report);
+  switch (status) {
+  case iop::NetworkStatus::OK:
+    this->storage().removeCrashReport();
+    // It got far enough to report it, the next panic doesn't have to wait as long
+    iop::panic::resetWakes();
+    return;
+
+  case iop::NetworkStatus::BROKEN_CLIENT:
+    // Api::reportPanic truncates the report until it fits, if not even that works it never will
+    this->logger().errorln(IOP_STR("Unable to serialize crash report, discarding it"));
+    this->storage().removeCrashReport();
+    return;
+
+  case iop::NetworkStatus::UNAUTHORIZED:
+    this->logger().warnln(IOP_STR("Auth token was refused, deleting it"));
+    this->storage().removeToken();
+    return;
+
+  // Already logged at the Network level
+  case iop::NetworkStatus::BROKEN_SERVER:
+  case iop::NetworkStatus::IO_ERROR:
+    // Nothing to be done besides retrying later
+    this->nextTryCrashReport = iop::clock::now() + intervalTryCrashReportMillis;
+    return;
+  }
+  this->logger().errorln(IOP_STR("Unexpected status at EventLoop::handleCrashReport"));
+}
+
+auto EventLoop::nextStoredWifi() noexcept -> std::optional<uint8_t> {
+  IOP_TRACE();
+
+  const auto now = iop::clock::now();
+  std::optional<uint8_t> best;
+  uint32_t bestMillis = UINT32_MAX;
+  for (uint8_t slot = 0; slot < Storage::wifiSlots; ++slot) {
+    if (this->nextTryStorageWifi[slot] > now || !this->storage().wifi(slot)) continue;
+
+    const auto expected = this->storage().wifiStats(slot).expectedConnectMillis(this->storageWifiFailures[slot]);
+    if (!best || expected < bestMillis) {
+      best = slot;
+      bestMillis = expected;
+    }
+  }
+  return best;
+}
+
+auto EventLoop::handleStoredWifiCreds(const uint8_t slot) noexcept -> void {
+  IOP_TRACE();
+
+  const auto &wifi = this->storage().wifi(slot);
   if (!wifi) return;
 
   const WifiCredentials &stored = wifi->get();
@@ -241,13 +788,19 @@ auto EventLoop::handleStoredWifiCreds() noexcept -> void {
   switch (this->connect(ssid, psk)) {
     case ConnectResponse::OK:
       break;
-    case ConnectResponse::TIMEOUT:
+    case ConnectResponse::TIMEOUT: {
       // WiFi Credentials stored in persistent memory
       //
       // Ideally credentials be wrong, but we can't know if it's wrong or if it just timed-out or the router is offline
-      // So we keep retrying
-      this->nextTryStorageWifiCredentials = iop_hal::thisThread.timeRunning() + intervalTryStorageWifiCredentialsMillis;
+      // So we keep retrying, less and less often, while the other stored networks are tried
+      const auto failures = this->storageWifiFailures[slot];
+      if (failures < UINT16_MAX) this->storageWifiFailures[slot]++;
+      // Uptime when it fails varies per device, so devices sharing a router don't retry in lockstep
+      const auto seed = iop::hash(ssid, static_cast<uint32_t>(iop::clock::now()));
+      const auto delay = backoffTryStorageWifi.delay(failures, seed);
+      this->nextTryStorageWifi[slot] = iop::clock::now() + delay;
       break;
+    }
   }
 }
 
@@ -265,7 +818,7 @@ auto EventLoop::handleHardcodedWifiCreds() noexcept -> void {
       //
       // Ideally credentials won't be wrong, but we can't know if it's wrong or if it just timed-out or the router is offline
       // So we keep retrying
-      this->nextTryHardcodedWifiCredentials = iop_hal::thisThread.timeRunning() + intervalTryHardcodedWifiCredentialsMillis;
+      this->nextTryHardcodedWifiCredentials = iop::clock::now() + intervalTryHardcodedWifiCredentialsMillis;
       break;
   }
 }
@@ -274,7 +827,7 @@ auto EventLoop::handleHardcodedIopCreds() noexcept -> void {
   IOP_TRACE();
 
   if (iopUsername && iopPassword) {
-    this->nextTryHardcodedIopCredentials = iop_hal::thisThread.timeRunning() + intervalTryHardcodedIopCredentialsMillis;
+    this->nextTryHardcodedIopCredentials = iop::clock::now() + intervalTryHardcodedIopCredentialsMillis;
 
     this->logger().infoln(IOP_STR("Trying hardcoded iop credentials"));
 
@@ -282,7 +835,7 @@ auto EventLoop::handleHardcodedIopCreds() noexcept -> void {
     auto authToken = this->api().authenticate(iopOrganization->toString(), iopUsername->toString(), iopPassword->toString());
     this->logger().debugln(IOP_STR("Tried to authenticate"));
     
-    if (const auto *token = std::get_if<std::unique_ptr<AuthToken>>(&authToken)) {
+    if (const auto *token = std::get_if<Box<AuthToken>>(&authToken)) {
       this->storage().setToken(**token);
     } else if (const auto *error = std::get_if<iop::NetworkStatus>(&authToken)) {
       this->handleAuthenticationFailure(*error);
@@ -292,20 +845,39 @@ auto EventLoop::handleHardcodedIopCreds() noexcept -> void {
 
 auto EventLoop::handleInterrupts() noexcept -> bool {
   IOP_TRACE();
+  const HeapScope heap(this->heapUsage_[static_cast<uint8_t>(LoopPhase::INTERRUPTS)]);
+
+  const auto dropped = iop::droppedInterrupts();
+  if (dropped != this->droppedInterrupts) {
+    this->logger().warn(IOP_STR("Interrupt queue was full, interrupts dropped since boot: "));
+    this->logger().warnln(static_cast<uint64_t>(dropped));
+    this->droppedInterrupts = dropped;
+  }
 
   const auto authToken = this->storage().token();
-  if (!authToken) return false;
 
-  auto handled = false;
+  // Updates are coalesced, as they all do the same thing. User interrupts don't need the network, they are always handled
   while (true) {
-    auto ev = iop::descheduleInterrupt();
-    if (ev == InterruptEvent::NONE)
-      return handled;
+    const auto interrupt = iop::descheduleInterrupt();
+    if (interrupt.event == InterruptEvent::NONE)
+      break;
+
+    if (interrupt.event == InterruptEvent::MUST_UPGRADE) {
+      this->pendingUpgrade = true;
+      continue;
+    }
 
-    handled = true;
-    this->handleInterrupt(ev, *authToken);
-    iop_hal::thisThread.yield();
+    this->handleInterrupt(interrupt, authToken);
+    iop::clock::yield();
   }
+
+  // Without a token or the network the update would be lost, it waits (and wakes the radio, see `nextNetworkDeadline`)
+  if (!this->pendingUpgrade || !authToken || this->radioOff || !iop::Network::isConnected()) return false;
+
+  this->pendingUpgrade = false;
+  this->handleInterrupt(Interrupt { InterruptEvent::MUST_UPGRADE, 0, 0 }, authToken);
+  iop::clock::yield();
+  return true;
 }
 
 auto upgrade(EventLoop & loop, const std::optional<std::reference_wrapper<const AuthToken>> &token) noexcept -> void {
@@ -334,34 +906,56 @@ auto upgrade(EventLoop & loop, const std::optional<std::reference_wrapper<const
   }
 }
 
-auto EventLoop::handleInterrupt(const InterruptEvent event, const std::optional<std::reference_wrapper<const AuthToken>> &token) noexcept -> void {
-    // Satisfies linter when all interrupt features are disabled
-    (void)*this;
-    (void)event;
-    (void)token;
-
+auto EventLoop::handleInterrupt(const Interrupt interrupt, const std::optional<std::reference_wrapper<const AuthToken>> &token) noexcept -> void {
     IOP_TRACE();
     this->logger().debug(IOP_STR("Handling interrupt: "));
-    this->logger().debugln(static_cast<uint64_t>(event));
+    this->logger().debugln(static_cast<uint64_t>(interrupt.event));
 
-    switch (event) {
+    switch (interrupt.event) {
     case InterruptEvent::NONE:
       break;
     case InterruptEvent::MUST_UPGRADE:
       upgrade(*this, token);
       break;
+    case InterruptEvent::USER:
+      if (this->interruptHandler) {
+        (this->interruptHandler)(*this, interrupt);
+      } else {
+        this->logger().warnln(IOP_STR("User interrupt scheduled, but no handler was set"));
+      }
+      break;
     };
 }
 
+auto EventLoop::setInterruptHandler(std::function<void(EventLoop&, const Interrupt&)> handler) noexcept -> void {
+  this->interruptHandler = handler;
+}
+
 auto EventLoop::connect(std::string_view ssid, std::string_view password) noexcept -> ConnectResponse {
   this->logger().info(IOP_STR("Connect: "));
   this->logger().infoln(iop::scapeNonPrintable(iop::to_view(ssid)));
 
-  if (!iop::wifi.connectToAccessPoint(ssid, password)) {
+  const auto start = iop::clock::now();
+
+  // Reconnecting directly to the last access point we used skips the full channel scan
+  auto connected = false;
+  const auto slot = this->storage().wifiSlot(ssid);
+  const auto stored = slot ? this->storage().wifi(*slot) : std::nullopt;
+  const auto radio = slot ? this->storage().wifiRadio(*slot) : std::nullopt;
+  if (stored && radio && iop::to_view(stored->get().password.get()) == password) {
+    connected = iop::radio::fastConnect(ssid, password, *radio);
+    if (!connected) this->logger().infoln(IOP_STR("Fast connect failed, scanning for the access point"));
+  }
+
+  if (!connected && !iop::wifi.connectToAccessPoint(ssid, password)) {
     this->logger().errorln(IOP_STR("Wifi authentication timed out"));
     return ConnectResponse::TIMEOUT;
   }
 
+  const auto took = iop::clock::now() - start;
+  this->logger().info(connected ? IOP_STR("Fast connect took (ms): ") : IOP_STR("Connect took (ms): "));
+  this->logger().infoln(static_cast<uint64_t>(took));
+
   if (!iop::Network::isConnected()) {
     const auto status = iop::wifi.status();
     auto statusStr = iop_hal::statusToString(status);
@@ -381,13 +975,36 @@ auto EventLoop::connect(std::string_view ssid, std::string_view password) noexce
     this->logger().info(IOP_STR(", status: "));
     this->logger().infoln(status);
 
+    iop::radio::setMode(this->radioPolicy.mode);
     this->storage().setWifi(WifiCredentials(name, psk));
+    // Some routers take long to connect, or fail often, the history allows us to rank the stored networks
+    if (const auto connectedSlot = this->storage().wifiSlot(iop::to_view(name))) {
+      this->storage().recordWifiConnection(*connectedSlot, this->storageWifiFailures[*connectedSlot], took, iop::radio::rssi());
+      this->storageWifiFailures[*connectedSlot] = 0;
+      this->nextTryStorageWifi[*connectedSlot] = 0;
+
+      if (const auto current = iop::radio::current()) {
+        this->storage().setWifiRadio(*connectedSlot, *current);
+      }
+    }
   }
   return ConnectResponse::OK;
 }
 
 auto EventLoop::registerEvent(const AuthToken& token, const Api::Json json) noexcept -> void {
-  const auto status = this->api().registerEvent(token, json);
+  if (!json) {
+    this->logger().errorln(IOP_STR("Unable to send measurements"));
+    iop_panic(IOP_STR("EventLoop::registerEvent buffer overflow"));
+  }
+  this->registerEvent(token, iop::to_view(*json));
+}
+
+auto EventLoop::registerEvent(const AuthToken& token, const std::string_view json) noexcept -> void {
+  this->handleEventStatus(this->api().registerEvent(token, json));
+}
+
+auto EventLoop::handleEventStatus(const iop::NetworkStatus status) noexcept -> void {
+  this->bootTimeline.mark(BootStage::FIRST_EVENT);
   switch (status) {
   case iop::NetworkStatus::BROKEN_CLIENT:
     this->logger().errorln(IOP_STR("Unable to send measurements"));
@@ -407,7 +1024,7 @@ auto EventLoop::registerEvent(const AuthToken& token, const Api::Json json) noex
   case iop::NetworkStatus::OK: // Cool beans
     return;
   }
-  this->logger().errorln(IOP_STR("Unexpected status at EventLoop::registerEvent"));
+  this->logger().errorln(IOP_STR("Unexpected status at EventLoop::handleEventStatus"));
 }
 
 auto EventLoop::handleAuthenticationFailure(iop::NetworkStatus status) noexcept -> void {
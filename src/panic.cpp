@@ -1,16 +1,31 @@
 #include "iop-hal/panic.hpp"
 #include "iop-hal/device.hpp"
 #include "iop/loop.hpp"
+#include "iop/clock.hpp"
 #include "iop/api.hpp"
+#include "iop/watchdog.hpp"
 #include "iop-hal/log.hpp"
 
+#if defined(IOP_ESP8266)
+#include <Esp.h>
+#include <user_interface.h>
+#elif defined(IOP_ESP32)
+#include <esp_attr.h>
+#include <esp_system.h>
+#endif
+
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+#include <pgmspace.h>
+#endif
+
 namespace iop {
 auto update() noexcept -> void {
   IOP_TRACE();
-  const auto token = iop::eventLoop.storage().token();
+  const auto token = iop::currentLoop().storage().token();
   if (!token)
     return;
-  const auto status = iop::eventLoop.api().update(*token);
+
+  const auto status = iop::currentLoop().api().update(*token);
 
   switch (status) {
   case iop_hal::UpdateStatus::UNAUTHORIZED:
@@ -34,22 +49,66 @@ auto update() noexcept -> void {
   iop::panicLogger().errorln(IOP_STR("Bad status, panic::update"));
 }
 
-// TODO(pc): dump stackstrace on iop_panic
-// https://github.com/sticilface/ESPmanager/blob/dce7fc06806a90c179a40eb2d74f4278fffad5b4/src/SaveStack.cpp
+template <size_t SIZE>
+static auto copyTruncated(std::array<char, SIZE> &to, const std::string_view from) noexcept -> void {
+  to.fill('\0');
+  memcpy(to.data(), from.data(), std::min(from.length(), SIZE - 1));
+}
+
+// Straight from flash into the buffer, allocating here could fail or re-enter when the heap is the reason we panicked
+template <size_t SIZE>
+static auto copyTruncated(std::array<char, SIZE> &to, const iop::StaticString from) noexcept -> void {
+  to.fill('\0');
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+  strncpy_P(to.data(), from.asCharPtr(), SIZE - 1);
+#else
+  strncpy(to.data(), from.asCharPtr(), SIZE - 1);
+#endif
+}
+
+// Copies a raw window of the stack, starting at `stack` and never going past `stackEnd` (if known)
+static auto captureStack(CrashReport &report, const uint32_t *stack, const uint32_t *stackEnd) noexcept -> void {
+  report.stackPointer = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(stack));
+  report.stack.fill(0);
+  for (auto &word: report.stack) {
+    if (stackEnd != nullptr && stack >= stackEnd) break;
+    word = *stack++;
+  }
+}
+
+// Persists the panic site so it survives the reboot, in case we fail to report it before that
+static auto recordPanic(const std::string_view &msg, iop::CodePoint const &point) noexcept -> void {
+  IOP_TRACE();
+
+  CrashReport report;
+  memset(&report, 0, sizeof(CrashReport));
+  report.reason = ResetReason::PANIC;
+  report.uptime = static_cast<uint32_t>(iop::clock::now());
+  report.line = point.line();
+  copyTruncated(report.file, point.file());
+  copyTruncated(report.func, point.func());
+  copyTruncated(report.msg, msg);
+  captureStack(report, reinterpret_cast<const uint32_t *>(__builtin_frame_address(0)), nullptr);
+
+  if (!iop::currentLoop().storage().setCrashReport(report)) {
+    iop::panicLogger().errorln(IOP_STR("Unable to persist crash report"));
+  }
+}
+
 auto reportPanic(const std::string_view &msg, const iop::StaticString &file, const uint32_t line, const iop::StaticString &func) noexcept -> bool {
   IOP_TRACE();
 
   // Prevents network logging
   iop::Log::takeHook();
 
-  const auto token = iop::eventLoop.storage().token();
+  const auto token = iop::currentLoop().storage().token();
   if (!token) {
     iop::panicLogger().critln(IOP_STR("No auth token, unable to report iop_panic"));
     return false;
   }
 
   const auto panicData = iop::PanicData(msg, file, line, func);
-  const auto status = iop::eventLoop.api().reportPanic(*token, panicData);
+  const auto status = iop::currentLoop().api().reportPanic(*token, panicData);
 
   switch (status) {
   case iop::NetworkStatus::UNAUTHORIZED:
@@ -70,6 +129,8 @@ auto reportPanic(const std::string_view &msg, const iop::StaticString &file, con
 
   case iop::NetworkStatus::OK:
     iop::panicLogger().infoln(IOP_STR("Reported iop_panic to server successfully"));
+    // Avoids reporting it again after reboot
+    iop::currentLoop().storage().removeCrashReport();
     return true;
   }
   iop::panicLogger().errorln(IOP_STR("Unexpected status Api::reportPanic"));
@@ -78,19 +139,66 @@ auto reportPanic(const std::string_view &msg, const iop::StaticString &file, con
 
 static void halt(const std::string_view &msg, iop::CodePoint const &point) noexcept __attribute__((noreturn));
 
+static auto wakeSchedule = Backoff(60 * 1000, 60 * 60 * 1000, 2, 20); // 1 minute, doubling up to 1 hour, 20% jitter
+
+/// Wake ups of a halted device, each one is a reboot so the count is kept in RTC memory.
+///
+/// It's stored as raw bytes in RTC memory, its size must stay a multiple of 4
+struct PanicWakes {
+  uint32_t magic;
+  /// Hash of the device, its firmware and the panic site the count belongs to
+  uint32_t key;
+  uint32_t count;
+};
+
+static_assert(sizeof(PanicWakes) % 4 == 0, "RTC memory is written in 4 bytes blocks");
+
+constexpr static uint32_t wakesMagic = 0x5EE9CA7;
+
+#if defined(IOP_ESP32)
+// Not initialized at boot, so it survives deep sleep and software resets
+RTC_NOINIT_ATTR static PanicWakes wakes;
+#else
+// The ESP8266 keeps a copy in RTC memory, in linux it survives the simulated deep sleeps of the virtual clock
+static PanicWakes wakes;
+#endif
+
+static auto loadWakes() noexcept -> void {
+#if defined(IOP_ESP8266)
+  if (!ESP.rtcUserMemoryRead(IOP_PANIC_RTC_BLOCK, reinterpret_cast<uint32_t *>(&wakes), sizeof(wakes))) wakes.magic = 0;
+#endif
+}
+
+static auto storeWakes() noexcept -> void {
+#if defined(IOP_ESP8266)
+  ESP.rtcUserMemoryWrite(IOP_PANIC_RTC_BLOCK, reinterpret_cast<uint32_t *>(&wakes), sizeof(wakes));
+#endif
+}
+
+// Unique per device, so a fleet panicking because of the same bug doesn't wake up in lockstep
+static auto deviceSeed(const AuthToken &token) noexcept -> uint32_t {
+  return iop::hash(iop::currentLoop().firmwareMD5(), iop::hash(iop::to_view(token)));
+}
+
 static void halt(const std::string_view &msg, iop::CodePoint const &point) noexcept {
   IOP_TRACE();
 
-  constexpr const uint32_t oneHour = ((uint32_t)60) * 60;
+  // Waiting for updates takes as long as it needs
+  iop::watchdog::stop();
+  recordPanic(msg, point);
+
+  const auto maybeToken = iop::currentLoop().storage().token();
+  const auto seed = maybeToken ? deviceSeed(*maybeToken) : 0;
+  const auto site = iop::hash(point.file(), point.line());
 
   auto reportedPanic = false;
   while (true) {
-    if (!iop::eventLoop.storage().wifi()) {
+    if (!iop::currentLoop().storage().wifi()) {
       iop::panicLogger().warnln(IOP_STR("Nothing we can do, no wifi config available"));
       break;
     }
 
-    if (!iop::eventLoop.storage().token()) {
+    if (!iop::currentLoop().storage().token()) {
       iop::panicLogger().warnln(IOP_STR("Nothing we can do, no auth token available"));
       break;
     }
@@ -99,13 +207,18 @@ static void halt(const std::string_view &msg, iop::CodePoint const &point) noexc
       if (!reportedPanic)
         reportedPanic = reportPanic(msg, point.file(), point.line(), point.func());
 
-      // Panic data is lost if report fails but update works
+      // If the report fails but the update works, the persisted crash report is sent after reboot
       // Doesn't return if update succeeds
       update();
     } else {
       iop::panicLogger().warnln(IOP_STR("No network, unable to recover"));
     }
-    iop_hal::device.deepSleep(oneHour);
+
+    const auto delay = iop::panic::nextWake(seed, site, iop::currentLoop().api().takeNextCheckHint());
+
+    iop::panicLogger().info(IOP_STR("Sleeping before checking for updates again (secs): "));
+    iop::panicLogger().infoln(static_cast<uint64_t>(delay / 1000));
+    iop::clock::deepSleep(std::max(static_cast<uint32_t>(delay / 1000), static_cast<uint32_t>(1)));
   }
 
   iop_hal::thisThread.halt();
@@ -119,5 +232,163 @@ auto setCleanup(iop::PanicHook::Cleanup cleanup) noexcept -> void {
   hook.cleanup = cleanup;
   iop::setPanicHook(hook);
 }
+auto setWakeSchedule(const Backoff schedule) noexcept -> void { wakeSchedule = schedule; }
+
+auto nextWake(const uint32_t seed, const uint32_t site, const std::optional<iop::time::milliseconds> hint) noexcept -> iop::time::milliseconds {
+  loadWakes();
+  const auto key = iop::hash(std::string_view(reinterpret_cast<const char *>(&site), sizeof(site)), seed);
+  if (wakes.magic != wakesMagic || wakes.key != key) {
+    wakes.magic = wakesMagic;
+    wakes.key = key;
+    wakes.count = 0;
+  }
+
+  const auto attempt = wakes.count;
+  if (wakes.count < UINT32_MAX) wakes.count++;
+  storeWakes();
+  return hint ? wakeSchedule.jittered(*hint, attempt, seed) : wakeSchedule.delay(attempt, seed);
+}
+
+auto resetWakes() noexcept -> void {
+  wakes.magic = 0;
+  storeWakes();
+}
+
+auto resetReason() noexcept -> ResetReason {
+#if defined(IOP_ESP8266)
+  const auto *info = ESP.getResetInfoPtr();
+  if (!info) return ResetReason::UNKNOWN;
+  switch (info->reason) {
+  case REASON_DEFAULT_RST:
+    return ResetReason::POWER_ON;
+  case REASON_WDT_RST:
+  case REASON_SOFT_WDT_RST:
+    return ResetReason::WATCHDOG;
+  case REASON_EXCEPTION_RST:
+    return ResetReason::EXCEPTION;
+  case REASON_SOFT_RESTART:
+    return ResetReason::SOFTWARE;
+  case REASON_DEEP_SLEEP_AWAKE:
+    return ResetReason::DEEP_SLEEP;
+  case REASON_EXT_SYS_RST:
+    return ResetReason::EXTERNAL;
+  }
+  return ResetReason::UNKNOWN;
+#elif defined(IOP_ESP32)
+  switch (esp_reset_reason()) {
+  case ESP_RST_POWERON:
+    return ResetReason::POWER_ON;
+  case ESP_RST_EXT:
+    return ResetReason::EXTERNAL;
+  case ESP_RST_SW:
+    return ResetReason::SOFTWARE;
+  case ESP_RST_PANIC:
+    return ResetReason::EXCEPTION;
+  case ESP_RST_INT_WDT:
+  case ESP_RST_TASK_WDT:
+  case ESP_RST_WDT:
+    return ResetReason::WATCHDOG;
+  case ESP_RST_DEEPSLEEP:
+    return ResetReason::DEEP_SLEEP;
+  case ESP_RST_BROWNOUT:
+    return ResetReason::BROWNOUT;
+  default:
+    return ResetReason::UNKNOWN;
+  }
+#else
+  // Processes always start from scratch in linux
+  return ResetReason::POWER_ON;
+#endif
+}
+
+auto resetReasonToString(const ResetReason reason) noexcept -> iop::StaticString {
+  switch (reason) {
+  case ResetReason::UNKNOWN:
+    return IOP_STR("UNKNOWN");
+  case ResetReason::POWER_ON:
+    return IOP_STR("POWER_ON");
+  case ResetReason::EXTERNAL:
+    return IOP_STR("EXTERNAL");
+  case ResetReason::SOFTWARE:
+    return IOP_STR("SOFTWARE");
+  case ResetReason::DEEP_SLEEP:
+    return IOP_STR("DEEP_SLEEP");
+  case ResetReason::EXCEPTION:
+    return IOP_STR("EXCEPTION");
+  case ResetReason::WATCHDOG:
+    return IOP_STR("WATCHDOG");
+  case ResetReason::BROWNOUT:
+    return IOP_STR("BROWNOUT");
+  case ResetReason::PANIC:
+    return IOP_STR("PANIC");
+  }
+  return IOP_STR("UNKNOWN");
+}
+
+auto recordUnexpectedReset(ResetReason reason) noexcept -> void {
+  IOP_TRACE();
+
+  // What the loop was running, the software watchdog resets the device like a software restart
+  const auto watched = iop::watchdog::takeRecord();
+  if (watched && watched->fired) reason = ResetReason::WATCHDOG;
+
+  switch (reason) {
+  case ResetReason::EXCEPTION:
+  case ResetReason::WATCHDOG:
+  case ResetReason::BROWNOUT:
+    break;
+  default:
+    // Expected resets, nothing to report
+    return;
+  }
+
+  // The crash handler (or iop_panic) may have already stored a richer report
+  if (iop::currentLoop().storage().crashReport()) return;
+
+  CrashReport report;
+  memset(&report, 0, sizeof(CrashReport));
+  report.reason = reason;
+  if (watched) {
+    // The phase goes where the function name would go, the task index where the line would
+    report.uptime = watched->start;
+    report.line = watched->task;
+    copyTruncated(report.func, iop::loopPhaseToString(watched->phase));
+    if (watched->task == iop::watchdog::noTask) {
+      snprintf(report.msg.data(), report.msg.size(), "%s outside of tasks, limit=%ums", watched->fired ? "stalled" : "reset", static_cast<unsigned int>(watched->limit));
+    } else {
+      snprintf(report.msg.data(), report.msg.size(), "%s in task %u, limit=%ums", watched->fired ? "stalled" : "reset", static_cast<unsigned int>(watched->task), static_cast<unsigned int>(watched->limit));
+    }
+  } else {
+    copyTruncated(report.msg, iop::panic::resetReasonToString(reason));
+  }
+
+  if (!iop::currentLoop().storage().setCrashReport(report)) {
+    iop::panicLogger().errorln(IOP_STR("Unable to persist crash report"));
+  }
+}
+}
+}
+
+#if defined(IOP_ESP8266)
+// Called by the ESP8266 core on exceptions and software watchdog resets, right before rebooting.
+// Hardware watchdog resets don't get here, they are detected at boot by `recordUnexpectedReset`.
+extern "C" void custom_crash_callback(struct rst_info *info, uint32_t stack, uint32_t stackEnd) {
+  // Prevents network logging
+  iop::Log::takeHook();
+
+  iop::CrashReport report;
+  memset(&report, 0, sizeof(iop::CrashReport));
+  report.reason = info->reason == REASON_EXCEPTION_RST ? iop::ResetReason::EXCEPTION : iop::ResetReason::WATCHDOG;
+  report.uptime = static_cast<uint32_t>(iop::clock::now());
+  // The faulting PC is the most valuable address, so it goes where the function name would go
+  snprintf(report.func.data(), report.func.size(), "epc1=0x%08x", info->epc1);
+  // Phase and task running, see `iop::watchdog`
+  const auto &watched = iop::watchdog::current();
+  snprintf(report.msg.data(), report.msg.size(), "exccause=%u excvaddr=0x%08x phase=%u task=%u", info->exccause, info->excvaddr,
+           static_cast<unsigned int>(watched.phase), static_cast<unsigned int>(watched.task));
+  report.line = watched.task;
+  iop::captureStack(report, reinterpret_cast<const uint32_t *>(stack), reinterpret_cast<const uint32_t *>(stackEnd));
+
+  iop::currentLoop().storage().setCrashReport(report);
 }
-}
\ No newline at end of file
+#endif
\ No newline at end of file
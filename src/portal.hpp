@@ -0,0 +1,131 @@
+// Generated by tools/portal.py from assets/portal, do not edit
+#ifndef IOP_PORTAL_HPP
+#define IOP_PORTAL_HPP
+
+#include "iop-hal/string.hpp"
+
+namespace iop {
+namespace portal {
+
+constexpr static size_t cssLength = 678;
+static auto cssETag() -> iop::StaticString { return IOP_STR("\"638ee583\""); }
+static auto cssPath() -> iop::StaticString { return IOP_STR("/portal.638ee583.css"); }
+static auto css() -> iop::StaticString {
+  return IOP_STR(
+    "html,body{height:100%;width:100%;display:flex;align-items:center;font-family:Tahoma,sans-serif;backg"
+    "round-color:#DFDFDF;margin:0}.center{display:flex;width:100%;flex-direction:column;align-items:cente"
+    "r;text-align:center}h3{margin-top:0}h1{padding-top:2em}.border{border:1px solid;border-radius:0.125r"
+    "em;padding:1em;margin-top:3em}.wifi,.iop{width:300px}form{width:500px !important}.submit{background-"
+    "color:#A3A3A3;border:solid 1px #626262;border-radius:3px;margin-top:1em;color:#070707}input{backgrou"
+    "nd-color:#DFDFDF}.input{float:right;border:solid 1px #626262;border-radius:3px;padding-left:5px;heig"
+    "ht:calc(100% - 2px)}.overwrite{margin:1em 0}.input-padding{padding-bottom:1em}"
+  );
+}
+
+constexpr static size_t scriptLength = 1064;
+static auto scriptETag() -> iop::StaticString { return IOP_STR("\"6378cda1\""); }
+static auto scriptPath() -> iop::StaticString { return IOP_STR("/portal.6378cda1.js"); }
+static auto script() -> iop::StaticString {
+  return IOP_STR(
+    "function toggleDisplay(className,checked){for(const el of document.getElementsByClassName(className)"
+    "){if(checked===true){el.style.display='block';}else if(checked===false){el.style.display='none';}}}d"
+    "ocument.querySelector(\"input[name='wifi']\").addEventListener('change',ev=>toggleDisplay('wifi',ev."
+    "currentTarget.checked));document.querySelector(\"input[name='iop']\").addEventListener('change',ev=>"
+    "toggleDisplay('iop',ev.currentTarget.checked));for(const el of document.getElementsByClassName('wifi"
+    "')){toggleDisplay('wifi',el.checked);}for(const el of document.getElementsByClassName('iop')){toggle"
+    "Display('iop',el.checked);}function loadNetworks(){fetch('/networks').then(response=>response.json()"
+    ").then(networks=>{const list=document.getElementById('networks');list.replaceChildren(...networks.ma"
+    "p(network=>{const option=document.createElement('option');option.value=network.ssid;option.label=net"
+    "work.ssid + ' (' + network.rssi + ' dBm' +(network.secure ? ', protected' : '')+ ')';return option;}"
+    "));}).catch(()=>{});}loadNetworks();setInterval(loadNetworks,15000);"
+  );
+}
+
+constexpr static size_t pageMustConnectNeedsAuthLength = 1191;
+static auto pageMustConnectNeedsAuth() -> iop::StaticString {
+  return IOP_STR(
+    "<!DOCTYPE HTML><html><head><meta charset='UTF-8'><link rel='stylesheet' href='/portal.638ee583.css'>"
+    "</head><body><div class='center'><h1>Internet of Plants</h1><form class='center' action='/submit' me"
+    "thod='POST'><div class='border'><h3>WiFi Credentials</h3><div><input type='hidden' value='true' name"
+    "='wifi'></div><div class='center'><div class='wifi input-padding'><span>Network name:</span><input n"
+    "ame='ssid' type='text' class='input' list='networks' autocomplete='off'><datalist id='networks'></da"
+    "talist></div><div class='wifi'><span>Password:</span><input name='password' type='password' class='i"
+    "nput'></div></div></div><div class='border'><h3>Internet of Plants Credentials</h3><input type='hidd"
+    "en' value='true' name='iop'><div><div class='iop input-padding'><span>Organization:</span><input nam"
+    "e='iopOrganization' type='text' class='input'></div><div class='iop input-padding'><span>Email:</spa"
+    "n><input name='iopEmail' type='text' class='input'></div><div class='iop'><span>Password:</span><inp"
+    "ut name='iopPassword' type='password' class='input'></div></div></div><input type='submit' value='Su"
+    "bmit' class='submit'></form></div><script src='/portal.6378cda1.js'></script></body></html>"
+  );
+}
+
+constexpr static size_t pageMustConnectLength = 1507;
+static auto pageMustConnect() -> iop::StaticString {
+  return IOP_STR(
+    "<!DOCTYPE HTML><html><head><meta charset='UTF-8'><link rel='stylesheet' href='/portal.638ee583.css'>"
+    "</head><body><div class='center'><h1>Internet of Plants</h1><form class='center' action='/submit' me"
+    "thod='POST'><div class='border'><h3>WiFi Credentials</h3><div><input type='hidden' value='true' name"
+    "='wifi'></div><div class='center'><div class='wifi input-padding'><span>Network name:</span><input n"
+    "ame='ssid' type='text' class='input' list='networks' autocomplete='off'><datalist id='networks'></da"
+    "talist></div><div class='wifi'><span>Password:</span><input name='password' type='password' class='i"
+    "nput'></div></div></div><div class='border'><h3>Internet of Plants Credentials</h3><em>Already authe"
+    "nticated with the server, if you want to update the Internet of Plants credentials please check the "
+    "box below and fill the fields.</em><div class='overwrite'><input type='checkbox' name='iop'><label f"
+    "or='iop'>Overwrite Internet of Plants Credentials</label></div><div class='center'><div class='iop i"
+    "nput-padding' style='display: none'><span>Organization:</span><input name='iopOrganization' type='te"
+    "xt' class='input'></div><div class='iop input-padding' style='display: none'><span>Email:</span><inp"
+    "ut name='iopEmail' type='text' class='input'></div><div class='iop' style='display: none'><span>Pass"
+    "word:</span><input name='iopPassword' type='password' class='input'></div></div></div><input type='s"
+    "ubmit' value='Submit' class='submit'></form></div><script src='/portal.6378cda1.js'></script></body>"
+    "</html>"
+  );
+}
+
+constexpr static size_t pageNeedsAuthLength = 1427;
+static auto pageNeedsAuth() -> iop::StaticString {
+  return IOP_STR(
+    "<!DOCTYPE HTML><html><head><meta charset='UTF-8'><link rel='stylesheet' href='/portal.638ee583.css'>"
+    "</head><body><div class='center'><h1>Internet of Plants</h1><form class='center' action='/submit' me"
+    "thod='POST'><div class='border'><h3>WiFi Credentials</h3><em>Already connected to the network, if yo"
+    "u want to update the WiFi credentials please check the box below and fill the fields.</em><div class"
+    "='overwrite'><input type='checkbox' name='wifi'><label for='wifi'>Overwrite wifi credentials</label>"
+    "</div><div class='center'><div class='wifi input-padding' style='display: none'><span>Network name:<"
+    "/span><input name='ssid' type='text' class='input' list='networks' autocomplete='off'><datalist id='"
+    "networks'></datalist></div><div class='wifi' style='display: none'><span>Password:</span><input name"
+    "='password' type='password' class='input'></div></div></div><div class='border'><h3>Internet of Plan"
+    "ts Credentials</h3><input type='hidden' value='true' name='iop'><div><div class='iop input-padding'>"
+    "<span>Organization:</span><input name='iopOrganization' type='text' class='input'></div><div class='"
+    "iop input-padding'><span>Email:</span><input name='iopEmail' type='text' class='input'></div><div cl"
+    "ass='iop'><span>Password:</span><input name='iopPassword' type='password' class='input'></div></div>"
+    "</div><input type='submit' value='Submit' class='submit'></form></div><script src='/portal.6378cda1."
+    "js'></script></body></html>"
+  );
+}
+
+constexpr static size_t pageLength = 1743;
+static auto page() -> iop::StaticString {
+  return IOP_STR(
+    "<!DOCTYPE HTML><html><head><meta charset='UTF-8'><link rel='stylesheet' href='/portal.638ee583.css'>"
+    "</head><body><div class='center'><h1>Internet of Plants</h1><form class='center' action='/submit' me"
+    "thod='POST'><div class='border'><h3>WiFi Credentials</h3><em>Already connected to the network, if yo"
+    "u want to update the WiFi credentials please check the box below and fill the fields.</em><div class"
+    "='overwrite'><input type='checkbox' name='wifi'><label for='wifi'>Overwrite wifi credentials</label>"
+    "</div><div class='center'><div class='wifi input-padding' style='display: none'><span>Network name:<"
+    "/span><input name='ssid' type='text' class='input' list='networks' autocomplete='off'><datalist id='"
+    "networks'></datalist></div><div class='wifi' style='display: none'><span>Password:</span><input name"
+    "='password' type='password' class='input'></div></div></div><div class='border'><h3>Internet of Plan"
+    "ts Credentials</h3><em>Already authenticated with the server, if you want to update the Internet of "
+    "Plants credentials please check the box below and fill the fields.</em><div class='overwrite'><input"
+    " type='checkbox' name='iop'><label for='iop'>Overwrite Internet of Plants Credentials</label></div><"
+    "div class='center'><div class='iop input-padding' style='display: none'><span>Organization:</span><i"
+    "nput name='iopOrganization' type='text' class='input'></div><div class='iop input-padding' style='di"
+    "splay: none'><span>Email:</span><input name='iopEmail' type='text' class='input'></div><div class='i"
+    "op' style='display: none'><span>Password:</span><input name='iopPassword' type='password' class='inp"
+    "ut'></div></div></div><input type='submit' value='Submit' class='submit'></form></div><script src='/"
+    "portal.6378cda1.js'></script></body></html>"
+  );
+}
+
+}
+}
+#endif
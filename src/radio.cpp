@@ -0,0 +1,223 @@
+#include "iop/radio.hpp"
+#include "iop/clock.hpp"
+
+#include <ArduinoJson.h>
+#include <algorithm>
+
+#if defined(IOP_ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(IOP_ESP32)
+#include <WiFi.h>
+#endif
+
+namespace iop {
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+static auto isOpen(const int index) noexcept -> bool {
+#if defined(IOP_ESP8266)
+  return WiFi.encryptionType(index) == ENC_TYPE_NONE;
+#else
+  return WiFi.encryptionType(index) == WIFI_AUTH_OPEN;
+#endif
+}
+#endif
+
+auto WifiScanner::request() noexcept -> void {
+  IOP_TRACE();
+
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+  if (this->scanning || this->nextScan > iop::clock::now()) return;
+
+  this->logger.debugln(IOP_STR("Starting WiFi scan"));
+  WiFi.scanNetworks(true);
+  this->scanning = true;
+#endif
+}
+
+auto WifiScanner::poll() noexcept -> void {
+  IOP_TRACE();
+
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+  if (!this->scanning) return;
+
+  const auto found = WiFi.scanComplete();
+  if (found == WIFI_SCAN_RUNNING) return;
+
+  this->scanning = false;
+  this->nextScan = iop::clock::now() + IOP_WIFI_SCAN_INTERVAL_MILLIS;
+  if (found < 0) {
+    this->logger.warnln(IOP_STR("WiFi scan failed"));
+    return;
+  }
+
+  this->length = 0;
+  for (int index = 0; index < found; ++index) {
+    ScannedNetwork network;
+    network.ssid.fill('\0');
+    const auto ssid = WiFi.SSID(index);
+    // Hidden networks can't be selected anyway
+    if (ssid.length() == 0) continue;
+    memcpy(network.ssid.data(), ssid.c_str(), std::min(static_cast<size_t>(ssid.length()), network.ssid.size()));
+    network.rssi = static_cast<int8_t>(WiFi.RSSI(index));
+    network.security = isOpen(index) ? WifiSecurity::OPEN : WifiSecurity::PROTECTED;
+    network.channel = static_cast<uint8_t>(WiFi.channel(index));
+
+    // Mesh networks have many access points with the same SSID, we only keep the strongest
+    auto *const begin = this->networks.data();
+    auto *const end = begin + this->length;
+    auto *same = std::find_if(begin, end, [&network](const ScannedNetwork &other) { return other.ssid == network.ssid; });
+    if (same != end) {
+      if (same->rssi < network.rssi) *same = network;
+    } else if (this->length < this->networks.size()) {
+      this->networks[this->length++] = network;
+    } else {
+      // Table is full, replaces the weakest if this one is stronger
+      auto *weakest = std::min_element(begin, end, [](const ScannedNetwork &a, const ScannedNetwork &b) { return a.rssi < b.rssi; });
+      if (weakest->rssi < network.rssi) *weakest = network;
+    }
+  }
+  WiFi.scanDelete();
+
+  std::sort(this->networks.data(), this->networks.data() + this->length, [](const ScannedNetwork &a, const ScannedNetwork &b) { return a.rssi > b.rssi; });
+
+  this->logger.debug(IOP_STR("WiFi scan found networks: "));
+  this->logger.debugln(static_cast<uint64_t>(this->length));
+#endif
+}
+
+auto WifiScanner::stop() noexcept -> void {
+  IOP_TRACE();
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+  if (this->scanning) {
+    WiFi.scanDelete();
+    this->scanning = false;
+  }
+#endif
+}
+
+auto WifiScanner::toJson(std::array<char, WifiScanner::jsonCapacity> &buffer) const noexcept -> bool {
+  IOP_TRACE();
+
+  // Keys are literals so they aren't copied, but SSIDs are
+  StaticJsonDocument<JSON_ARRAY_SIZE(IOP_WIFI_SCAN_RESULTS) + IOP_WIFI_SCAN_RESULTS * (JSON_OBJECT_SIZE(3) + sizeof(iop::NetworkName) + 1)> doc;
+  auto list = doc.to<JsonArray>();
+  for (const auto &network: *this) {
+    auto object = list.createNestedObject();
+    // NetworkName isn't NUL terminated if the SSID has 32 bytes
+    object["ssid"] = std::string_view(network.ssid.data(), strnlen(network.ssid.data(), network.ssid.size()));
+    object["rssi"] = network.rssi;
+    object["secure"] = network.security == WifiSecurity::PROTECTED;
+  }
+  if (doc.overflowed()) return false;
+
+  buffer.fill('\0');
+  serializeJson(doc, buffer.data(), buffer.size() - 1);
+  return true;
+}
+
+namespace radio {
+auto fastConnect(const std::string_view ssid, const std::string_view psk, const WifiRadio &radio) noexcept -> bool {
+  IOP_TRACE();
+
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+  // The SDK expects NUL terminated strings
+  std::array<char, sizeof(iop::NetworkName) + 1> ssidBuffer;
+  std::array<char, sizeof(iop::NetworkPassword) + 1> pskBuffer;
+  ssidBuffer.fill('\0');
+  pskBuffer.fill('\0');
+  memcpy(ssidBuffer.data(), ssid.data(), std::min(ssid.length(), sizeof(iop::NetworkName)));
+  memcpy(pskBuffer.data(), psk.data(), std::min(psk.length(), sizeof(iop::NetworkPassword)));
+
+#ifdef IOP_WIFI_REUSE_IP
+  if (radio.ip != 0) {
+    WiFi.config(IPAddress(radio.ip), IPAddress(radio.gateway), IPAddress(radio.mask), IPAddress(radio.dns));
+  }
+#endif
+
+  WiFi.begin(ssidBuffer.data(), pskBuffer.data(), radio.channel, radio.bssid.data(), true);
+
+  const auto deadline = iop::clock::now() + IOP_WIFI_FAST_CONNECT_MILLIS;
+  while (iop::clock::now() < deadline) {
+    const auto status = WiFi.status();
+    if (status == WL_CONNECTED) return true;
+    // The access point moved or the credentials changed, no point in waiting
+    if (status == WL_NO_SSID_AVAIL || status == WL_CONNECT_FAILED) break;
+    iop::clock::yield();
+  }
+
+#ifdef IOP_WIFI_REUSE_IP
+  // Re-enables DHCP for the regular connection
+  WiFi.config(IPAddress(0u), IPAddress(0u), IPAddress(0u));
+#endif
+  WiFi.disconnect();
+  return false;
+#else
+  (void) ssid;
+  (void) psk;
+  (void) radio;
+  return false;
+#endif
+}
+
+auto current() noexcept -> std::optional<WifiRadio> {
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+  if (WiFi.status() != WL_CONNECTED) return std::nullopt;
+
+  const auto *bssid = WiFi.BSSID();
+  if (!bssid) return std::nullopt;
+
+  WifiRadio radio;
+  memcpy(radio.bssid.data(), bssid, radio.bssid.size());
+  radio.channel = static_cast<uint8_t>(WiFi.channel());
+  radio.ip = static_cast<uint32_t>(WiFi.localIP());
+  radio.gateway = static_cast<uint32_t>(WiFi.gatewayIP());
+  radio.mask = static_cast<uint32_t>(WiFi.subnetMask());
+  radio.dns = static_cast<uint32_t>(WiFi.dnsIP());
+  return radio;
+#else
+  return std::nullopt;
+#endif
+}
+
+auto rssi() noexcept -> std::optional<int8_t> {
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+  if (WiFi.status() != WL_CONNECTED) return std::nullopt;
+  return static_cast<int8_t>(WiFi.RSSI());
+#else
+  return std::nullopt;
+#endif
+}
+
+auto setMode(const RadioMode mode) noexcept -> void {
+  IOP_TRACE();
+  // The SDKs modem sleep by default, disabling it would cost far more than the latency it saves
+  if (mode == RadioMode::ALWAYS_ON) return;
+#if defined(IOP_ESP8266)
+  WiFi.setSleepMode(WIFI_MODEM_SLEEP);
+#elif defined(IOP_ESP32)
+  WiFi.setSleep(true);
+#endif
+}
+
+auto off() noexcept -> void {
+  IOP_TRACE();
+#if defined(IOP_ESP8266)
+  WiFi.disconnect();
+  WiFi.mode(WIFI_OFF);
+  WiFi.forceSleepBegin();
+#elif defined(IOP_ESP32)
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+#endif
+}
+
+auto on() noexcept -> void {
+  IOP_TRACE();
+#if defined(IOP_ESP8266)
+  WiFi.forceSleepWake();
+  WiFi.mode(WIFI_STA);
+#elif defined(IOP_ESP32)
+  WiFi.mode(WIFI_STA);
+#endif
+}
+}
+}
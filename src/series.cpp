@@ -0,0 +1,206 @@
+#include "iop/series.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace iop {
+namespace series {
+auto BitWriter::write(const uint64_t value, const uint8_t count) noexcept -> bool {
+  if (this->bits + count > this->capacity * 8) return false;
+
+  for (uint8_t index = count; index > 0; --index) {
+    const auto bit = (value >> (index - 1)) & 1;
+    const auto byte = this->bits / 8;
+    const auto mask = static_cast<uint8_t>(0x80 >> (this->bits % 8));
+    // Clears as it goes, so rewound bits can be overwritten
+    if (bit) {
+      this->data[byte] |= mask;
+    } else {
+      this->data[byte] &= static_cast<uint8_t>(~mask);
+    }
+    this->bits += 1;
+  }
+  return true;
+}
+
+auto BitReader::read(const uint8_t count) noexcept -> std::optional<uint64_t> {
+  if (this->bits + count > this->length * 8) return std::nullopt;
+
+  uint64_t value = 0;
+  for (uint8_t index = 0; index < count; ++index) {
+    const auto bit = (this->data[this->bits / 8] >> (7 - this->bits % 8)) & 1;
+    value = (value << 1) | bit;
+    this->bits += 1;
+  }
+  return value;
+}
+
+static auto zigzag(const int64_t value) noexcept -> uint64_t {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+static auto unzigzag(const uint64_t value) noexcept -> int64_t {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+struct Bucket {
+  uint8_t prefix;
+  uint8_t prefixBits;
+  uint8_t valueBits;
+};
+
+static constexpr std::array<Bucket, 5> buckets = {{
+  { 0b10, 2, 7 },
+  { 0b110, 3, 9 },
+  { 0b1110, 4, 12 },
+  { 0b11110, 5, 32 },
+  { 0b11111, 5, 64 },
+}};
+
+auto TimestampEncoder::append(BitWriter &writer, const uint64_t timestamp) noexcept -> bool {
+  if (this->first) {
+    if (!writer.write(timestamp, 64)) return false;
+    this->first = false;
+    this->last = timestamp;
+    return true;
+  }
+
+  const auto delta = static_cast<int64_t>(timestamp - this->last);
+  const auto encoded = zigzag(delta - this->lastDelta);
+
+  auto ok = false;
+  if (encoded == 0) {
+    ok = writer.write(0, 1);
+  } else {
+    for (const auto &bucket: buckets) {
+      if (bucket.valueBits < 64 && encoded >> bucket.valueBits) continue;
+      ok = writer.write(bucket.prefix, bucket.prefixBits) && writer.write(encoded, bucket.valueBits);
+      break;
+    }
+  }
+  if (!ok) return false;
+
+  this->last = timestamp;
+  this->lastDelta = delta;
+  return true;
+}
+
+auto TimestampDecoder::next(BitReader &reader) noexcept -> std::optional<uint64_t> {
+  if (this->first) {
+    const auto timestamp = reader.read(64);
+    if (!timestamp) return std::nullopt;
+    this->first = false;
+    this->last = *timestamp;
+    return timestamp;
+  }
+
+  uint64_t encoded = 0;
+  const auto flag = reader.read(1);
+  if (!flag) return std::nullopt;
+  if (*flag) {
+    // Counts the ones after the first, up to 4, to find the bucket
+    uint8_t ones = 0;
+    while (ones < 3) {
+      const auto bit = reader.read(1);
+      if (!bit) return std::nullopt;
+      if (!*bit) break;
+      ones += 1;
+    }
+    auto bucket = buckets[ones];
+    if (ones == 3) {
+      const auto last = reader.read(1);
+      if (!last) return std::nullopt;
+      bucket = buckets[3 + *last];
+    }
+    const auto value = reader.read(bucket.valueBits);
+    if (!value) return std::nullopt;
+    encoded = *value;
+  }
+
+  this->lastDelta += unzigzag(encoded);
+  this->last += static_cast<uint64_t>(this->lastDelta);
+  return this->last;
+}
+
+static auto toBits(const float value) noexcept -> uint32_t {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static auto fromBits(const uint32_t bits) noexcept -> float {
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+auto ValueEncoder::append(BitWriter &writer, const float value) noexcept -> bool {
+  const auto bits = toBits(value);
+  if (this->first) {
+    if (!writer.write(bits, 32)) return false;
+    this->first = false;
+    this->last = bits;
+    return true;
+  }
+
+  const auto xored = bits ^ this->last;
+  if (xored == 0) {
+    if (!writer.write(0, 1)) return false;
+    return true;
+  }
+
+  // Leading zeroes are capped to fit 5 bits
+  const auto leading = static_cast<uint8_t>(std::min(__builtin_clz(xored), 31));
+  const auto trailing = static_cast<uint8_t>(__builtin_ctz(xored));
+
+  if (this->hasWindow && leading >= this->leading && trailing >= this->trailing) {
+    const auto meaningful = static_cast<uint8_t>(32 - this->leading - this->trailing);
+    if (!writer.write(0b10, 2) || !writer.write(xored >> this->trailing, meaningful)) return false;
+  } else {
+    const auto meaningful = static_cast<uint8_t>(32 - leading - trailing);
+    if (!writer.write(0b11, 2) || !writer.write(leading, 5) || !writer.write(meaningful - 1, 5) || !writer.write(xored >> trailing, meaningful)) return false;
+    this->leading = leading;
+    this->trailing = trailing;
+    this->hasWindow = true;
+  }
+  this->last = bits;
+  return true;
+}
+
+auto ValueDecoder::next(BitReader &reader) noexcept -> std::optional<float> {
+  if (this->first) {
+    const auto bits = reader.read(32);
+    if (!bits) return std::nullopt;
+    this->first = false;
+    this->last = static_cast<uint32_t>(*bits);
+    return fromBits(this->last);
+  }
+
+  const auto changed = reader.read(1);
+  if (!changed) return std::nullopt;
+  if (!*changed) return fromBits(this->last);
+
+  const auto newWindow = reader.read(1);
+  if (!newWindow) return std::nullopt;
+  if (*newWindow) {
+    const auto leading = reader.read(5);
+    const auto meaningful = reader.read(5);
+    if (!leading || !meaningful) return std::nullopt;
+    this->leading = static_cast<uint8_t>(*leading);
+    this->trailing = static_cast<uint8_t>(32 - *leading - (*meaningful + 1));
+  }
+
+  const auto meaningful = static_cast<uint8_t>(32 - this->leading - this->trailing);
+  const auto xored = reader.read(meaningful);
+  if (!xored) return std::nullopt;
+  this->last ^= static_cast<uint32_t>(*xored << this->trailing);
+  return fromBits(this->last);
+}
+
+auto writeLE(uint8_t *data, const uint64_t value, const uint8_t bytes) noexcept -> void {
+  for (uint8_t index = 0; index < bytes; ++index) {
+    data[index] = static_cast<uint8_t>(value >> (index * 8));
+  }
+}
+}
+}
@@ -1,194 +1,86 @@
 #include "iop/server.hpp"
 
 #include "iop-hal/wifi.hpp"
-#include "iop-hal/thread.hpp"
+#include "iop/clock.hpp"
 
 #include "iop-hal/network.hpp"
 #include "iop-hal/device.hpp"
 #include "iop/api.hpp"
 #include "iop/loop.hpp"
+#include "portal.hpp"
 
 namespace iop {
-auto pageHTMLStart() -> iop::StaticString {
-  return IOP_STR(
-    "<!DOCTYPE HTML>\r\n"
-    "<html><meta charset='UTF-8'><body><div class='center'>\r\n"
-    "  <h1>Internet of Plants</h1>\r\n"
-    "  <form class='center' action='/submit' method='POST'>\r\n");
+// Portal assets are minified at build time by tools/portal.py, they live in assets/portal
+static auto page(const bool mustConnect, const bool needsIopAuth) noexcept -> std::pair<iop::StaticString, size_t> {
+  if (mustConnect && needsIopAuth) return std::make_pair(portal::pageMustConnectNeedsAuth(), portal::pageMustConnectNeedsAuthLength);
+  if (mustConnect) return std::make_pair(portal::pageMustConnect(), portal::pageMustConnectLength);
+  if (needsIopAuth) return std::make_pair(portal::pageNeedsAuth(), portal::pageNeedsAuthLength);
+  return std::make_pair(portal::page(), portal::pageLength);
 }
 
-auto wifiOverwriteHTML() -> iop::StaticString {
-  return IOP_STR(
-    "    <div class='border'>\r\n"
-    "      <h3>WiFi Credentials</h3>\r\n"
-    "      <em>Already connected to the network, if you want to update the WiFi credentials please check the box below and fill the fields.</em>\r\n"
-    "      <div class='overwrite'>\r\n"
-    "        <input type='checkbox' name='wifi'>\r\n"
-    "        <label for='wifi'>Overwrite wifi credentials</label>\r\n"
-    "      </div>\r\n"
-    "      <div class='center'>\r\n"
-    "        <div class='wifi input-padding' style='display: none'>\r\n"
-    "          <span>Network name:</span>\r\n"
-    "          <input name='ssid' type='text' class='input' />\r\n"
-    "        </div>\r\n"
-    "        <div class='wifi' style='display: none'>\r\n"
-    "          <span>Password:</span>\r\n"
-    "          <input name='password' type='password' class='input' />\r\n"
-    "        </div>\r\n"
-    "      </div>\r\n"
-    "    </div>\r\n");
+// The path has the content's hash, so it can be cached forever
+static auto sendImmutable(iop_hal::HttpConnection &conn, const iop::StaticString type, const iop::StaticString content, const size_t length, const iop::StaticString etag) noexcept -> void {
+  conn.sendHeader(IOP_STR("Cache-Control"), IOP_STR("public, max-age=31536000, immutable"));
+  conn.sendHeader(IOP_STR("ETag"), etag);
+  conn.setContentLength(length);
+  conn.send(200, type, content);
 }
 
-auto wifiHTML() -> iop::StaticString {
-  return IOP_STR(
-    "    <div class='border'>\r\n"
-    "      <h3>WiFi Credentials</h3>\r\n"
-    "      <div><input type='hidden' value='true' name='wifi'></div>\r\n"
-    "      <div class='center'>\r\n"
-    "        <div class='wifi input-padding'>\r\n"
-    "          <span>Network name:</span>\r\n"
-    "          <input name='ssid' type='text' class='input' />\r\n"
-    "        </div>\r\n"
-    "        <div class='wifi'>\r\n"
-    "          <span>Password:</span>\r\n"
-    "          <input name='password' type='password' class='input' />\r\n"
-    "        </div>\r\n"
-    "      </div>\r\n"
-    "    </div>\r\n");
+// Operating systems probe these to detect captive portals. Answering with a redirect makes them open the portal,
+// and is much cheaper than rendering the form for every probe
+static auto connectivityChecks() noexcept -> std::array<iop::StaticString, 9> {
+  return {
+    IOP_STR("/generate_204"), // Android
+    IOP_STR("/gen_204"), // Android
+    IOP_STR("/hotspot-detect.html"), // Apple
+    IOP_STR("/library/test/success.html"), // Apple
+    IOP_STR("/connecttest.txt"), // Windows
+    IOP_STR("/ncsi.txt"), // Windows
+    IOP_STR("/redirect"), // Windows
+    IOP_STR("/success.txt"), // Firefox
+    IOP_STR("/canonical.html"), // Firefox and Ubuntu
+  };
 }
 
-auto iopOverwriteHTML() -> iop::StaticString {
-  return IOP_STR(
-    "    <div class='border'>\r\n"
-    "      <h3>Internet of Plants Credentials</h3>\r\n"
-    "      <em>Already authenticated with the server, if you want to update the Internet of Plants credentials please check the box below and fill the fields.</em\r\n"
-    "      <div class='overwrite'>\r\n"
-    "        <input type='checkbox' name='iop'>\r\n"
-    "        <label for='iop'>Overwrite Internet of Plants Credentials</label>\r\n"
-    "      </div>\r\n"
-    "      <div class='center'>\r\n"
-    "        <div class='iop input-padding' style='display: none'>\r\n"
-    "          <span>Organization:</span>\r\n"
-    "          <input name='iopOrganization' type='text' class='input' />\r\n"
-    "        </div>\r\n"
-    "        <div class='iop input-padding' style='display: none'>\r\n"
-    "          <span>Email:</span>\r\n"
-    "          <input name='iopEmail' type='text' class='input' />\r\n"
-    "        </div>\r\n"
-    "        <div class='iop' style='display: none'>\r\n"
-    "          <span>Password:</span>\r\n"
-    "          <input name='iopPassword' type='password' class='input' />\r\n"
-    "        </div>\r\n"
-    "      </div>\r\n"
-    "    </div>\r\n");
-}
+// Set by every route, so `CredentialsServer::serve` knows when there is nothing left to drain
+static IOP_THREAD_LOCAL bool handledRequest = false;
 
-auto iopHTML() -> iop::StaticString {
-  return IOP_STR(
-    "    <div class='border'>\r\n"
-    "      <h3>Internet of Plants Credentials</h3>\r\n"
-    "      <input type='hidden' value='true' name='iop' />\r\n"
-    "      <div>\r\n"
-    "        <div class='iop input-padding'>\r\n"
-    "          <span>Organization:</span>\r\n"
-    "          <input name='iopOrganization' type='text' class='input' />\r\n"
-    "        </div>\r\n"
-    "        <div class='iop input-padding'>\r\n"
-    "          <span>Email:</span>\r\n"
-    "          <input name='iopEmail' type='text' class='input' />\r\n"
-    "        </div>\r\n"
-    "        <div class='iop'>\r\n"
-    "          <span>Password:</span>\r\n"
-    "          <input name='iopPassword' type='password' class='input' />\r\n"
-    "        </div>\r\n"
-    "      </div>\r\n"
-    "    </div>\r\n");
+template <typename F>
+static auto tracked(F handler) noexcept {
+  return [handler](iop_hal::HttpConnection &conn, iop::Log &logger) {
+    handledRequest = true;
+    handler(conn, logger);
+  };
 }
 
-auto script() -> iop::StaticString {
-  return IOP_STR(
-    "    <script type='application/javascript'>\r\n"
-    "    function toggleDisplay(className, checked) {\r\n"
-    "      for (const el of document.getElementsByClassName(className)) {\r\n"
-    "        if (checked === true) {\r\n"
-    "          el.style.display = 'block';\r\n"
-    "        } else if (checked === false) {\r\n"
-    "          el.style.display = 'none';\r\n"
-    "        }\r\n"
-    "      }\r\n"
-    "    }\r\n"
-    "    document.querySelector(\"input[name='wifi']\").addEventListener('change', ev => toggleDisplay('wifi', ev.currentTarget.checked));\r\n"
-    "    document.querySelector(\"input[name='iop']\").addEventListener('change', ev => toggleDisplay('iop', ev.currentTarget.checked));\r\n"
-    "    for (const el of document.getElementsByClassName('wifi')) {\r\n"
-    "      toggleDisplay('wifi', el.checked);\r\n"
-    "    }\r\n"
-    "    for (const el of document.getElementsByClassName('iop')) {\r\n"
-    "      toggleDisplay('iop', el.checked);\r\n"
-    "    }\r\n"
-    "    </script>\r\n");
-}
-auto css() -> iop::StaticString {
-  return IOP_STR(
-    "    <style>\r\n"
-    "    html, body {\r\n"
-    "      height: 100%;\r\n"
-    "      width: 100%;\r\n"
-    "      display: flex;\r\n"
-    "      align-items: center;\r\n"
-    "      font-family: Tahoma, sans-serif;\r\n"
-    "      background-color: #DFDFDF;\r\n"
-    "      margin: 0;\r\n"
-    "    }\r\n"
-    "    .center {\r\n"
-    "      display: flex;\r\n"
-    "      width: 100%;\r\n"
-    "      flex-direction: column;\r\n"
-    "      align-items: center;\r\n"
-    "      text-align: center;\r\n"
-    "    }\r\n"
-    "    h3 { margin-top: 0; }\r\n"
-    "    h1 { padding-top: 2em; }\r\n"
-    "    .border {\r\n"
-    "      border: 1px solid;\r\n"
-    "      border-radius: 0.125rem;\r\n"
-    "      padding: 1em;\r\n"
-    "      margin-top: 3em;\r\n"
-    "    }\r\n"
-    "    .wifi, .iop {\r\n"
-    "      width: 300px;\r\n"
-    "    }\r\n"
-    "    form { width: 500px !important; }\r\n"
-    "    .submit {\r\n"
-    "      background-color: #A3A3A3;\r\n"
-    "      border: solid 1px #626262;\r\n"
-    "      border-radius: 3px;\r\n"
-    "      margin-top: 1em;\r\n"
-    "      color: #070707;\r\n"
-    "    }\r\n"
-    "    input { background-color: #DFDFDF; }\r\n"
-    "    .input {\r\n"
-    "      float: right;\r\n"
-    "      border: solid 1px #626262;\r\n"
-    "      border-radius: 3px;\r\n"
-    "      padding-left: 5px;\r\n"
-    "      height: calc(100% - 2px);\r\n"
-    "    }\r\n"
-    "    .overwrite { margin: 1em 0; }\r\n"
-    "    .input-padding { padding-bottom: 1em; }\r\n"
-    "    </style>\r\n");
-}
+using ScanJson = std::array<char, WifiScanner::jsonCapacity>;
 
-auto pageHTMLEnd() -> iop::StaticString {
-  return IOP_STR(
-    "    <input type='submit' value='Submit' class='submit' />\r\n"
-    "  </form>\r\n"
-    "</div></body></html>");
-}
+#ifdef IOP_STATIC_ARENA
+static iop::Pool<DynamicWifiCredential, IOP_ARENA_CREDENTIALS> wifiCredentials;
+static iop::Pool<DynamicIopCredential, IOP_ARENA_CREDENTIALS> iopCredentials;
+// Scan results are served from the pool instead of the stack, as they don't fit in the ESP8266's
+static iop::Pool<ScanJson, 1> scanJsons;
+
+static auto releaseWifiCredential(const DynamicWifiCredential *creds) noexcept -> void { wifiCredentials.release(creds); }
+static auto releaseIopCredential(const DynamicIopCredential *creds) noexcept -> void { iopCredentials.release(creds); }
+static auto releaseScanJson(const ScanJson *json) noexcept -> void { scanJsons.release(json); }
 
-auto CredentialsServer::setup() noexcept -> void {
+static auto fits(const std::string_view value, const size_t size) noexcept -> bool { return value.length() <= size; }
+#endif
+
+auto CredentialsServer::setup(EventLoop &loop) noexcept -> void {
   IOP_TRACE();
-  this->server.on(IOP_STR("/favicon.ico"), [](iop_hal::HttpConnection &conn, iop::Log &logger) { conn.send(404, IOP_STR("text/plain"), IOP_STR("")); (void) logger; });
-  this->server.on(IOP_STR("/submit"), [this](iop_hal::HttpConnection &conn, iop::Log &logger) {
+  this->loop = &loop;
+  for (const auto path: connectivityChecks()) {
+    this->server.on(path, tracked([](iop_hal::HttpConnection &conn, iop::Log &logger) {
+      // Every DNS query resolves to us, so a relative redirect lands on the form
+      conn.sendHeader(IOP_STR("Location"), IOP_STR("/"));
+      conn.send(302, IOP_STR("text/plain"), IOP_STR(""));
+      (void) logger;
+    }));
+  }
+  this->server.on(IOP_STR("/favicon.ico"), tracked([](iop_hal::HttpConnection &conn, iop::Log &logger) { conn.send(404, IOP_STR("text/plain"), IOP_STR("")); (void) logger; }));
+  this->server.on(IOP_STR("/submit"), tracked([this](iop_hal::HttpConnection &conn, iop::Log &logger) {
     IOP_TRACE();
     logger.debugln(IOP_STR("Received credentials form"));
 
@@ -198,8 +90,17 @@ auto CredentialsServer::setup() noexcept -> void {
     if (wifi && ssid && psk) {
       logger.debug(IOP_STR("SSID: "));
       logger.debugln(*ssid);
-      this->credentialsWifi = std::unique_ptr<DynamicWifiCredential>(new (std::nothrow) DynamicWifiCredential(*ssid, *psk));
+#ifdef IOP_STATIC_ARENA
+      if (!fits(*ssid, sizeof(iop::NetworkName)) || !fits(*psk, sizeof(iop::NetworkPassword))) {
+        logger.warnln(IOP_STR("WiFi credentials are too long"));
+      } else {
+        this->credentialsWifi = wifiCredentials.make(releaseWifiCredential, *ssid, *psk);
+        if (!this->credentialsWifi) logger.errorln(IOP_STR("No pooled WiFi credentials available, raise IOP_ARENA_CREDENTIALS"));
+      }
+#else
+      this->credentialsWifi = Box<DynamicWifiCredential>(new (std::nothrow) DynamicWifiCredential(*ssid, *psk));
       iop_assert(this->credentialsWifi, IOP_STR("Unable to allocate credentialsWifi"));
+#endif
     }
 
     const auto iop = conn.arg(IOP_STR("iop"));
@@ -211,40 +112,68 @@ auto CredentialsServer::setup() noexcept -> void {
       logger.debugln(*email);
       logger.debug(IOP_STR("Organization: "));
       logger.debugln(*organization);
-      this->credentialsIop = std::unique_ptr<DynamicIopCredential>(new (std::nothrow) DynamicIopCredential(*organization, *email, *password));
+#ifdef IOP_STATIC_ARENA
+      if (!fits(*organization, IOP_ARENA_CREDENTIAL_SIZE) || !fits(*email, IOP_ARENA_CREDENTIAL_SIZE) || !fits(*password, IOP_ARENA_CREDENTIAL_SIZE)) {
+        logger.warnln(IOP_STR("IoP credentials are longer than IOP_ARENA_CREDENTIAL_SIZE"));
+      } else {
+        this->credentialsIop = iopCredentials.make(releaseIopCredential, *organization, *email, *password);
+        if (!this->credentialsIop) logger.errorln(IOP_STR("No pooled IoP credentials available, raise IOP_ARENA_CREDENTIALS"));
+      }
+#else
+      this->credentialsIop = Box<DynamicIopCredential>(new (std::nothrow) DynamicIopCredential(*organization, *email, *password));
       iop_assert(this->credentialsIop, IOP_STR("Unable to allocate credentialsIop"));
+#endif
     }
 
     conn.sendHeader(IOP_STR("Location"), IOP_STR("/"));
     conn.send(302, IOP_STR("text/plain"), IOP_STR(""));
-  });
-
-  this->server.onNotFound([this](iop_hal::HttpConnection &conn, iop::Log &logger) {
+  }));
+
+  this->server.on(portal::cssPath(), tracked([](iop_hal::HttpConnection &conn, iop::Log &logger) {
+    sendImmutable(conn, IOP_STR("text/css"), portal::css(), portal::cssLength, portal::cssETag());
+    (void) logger;
+  }));
+  this->server.on(portal::scriptPath(), tracked([](iop_hal::HttpConnection &conn, iop::Log &logger) {
+    sendImmutable(conn, IOP_STR("application/javascript"), portal::script(), portal::scriptLength, portal::scriptETag());
+    (void) logger;
+  }));
+
+  this->server.on(IOP_STR("/networks"), tracked([this](iop_hal::HttpConnection &conn, iop::Log &logger) {
     IOP_TRACE();
-    logger.infoln(IOP_STR("Serving form"));
-
-    const auto needsIopAuth = !eventLoop.storage().token() && !this->credentialsIop;
-    // Not needing IoP auth means the WiFi credentials we have are invalid
-    const auto mustConnect = !iop::Network::isConnected() && (!eventLoop.storage().wifi() || !needsIopAuth);
+#ifdef IOP_STATIC_ARENA
+    auto json = scanJsons.make(releaseScanJson);
+#else
+    auto json = Box<ScanJson>(new (std::nothrow) ScanJson());
+#endif
+    if (!json || !this->scanner.toJson(*json)) {
+      logger.errorln(IOP_STR("Unable to serialize WiFi scan results"));
+      conn.send(500, IOP_STR("text/plain"), IOP_STR(""));
+      return;
+    }
 
-    auto len = pageHTMLStart().length() + pageHTMLEnd().length() + script().length() + css().length();
-    len += mustConnect ? wifiHTML().length() : wifiOverwriteHTML().length();
-    len += needsIopAuth ? iopHTML().length() : iopOverwriteHTML().length();
+    // The cached results are served, the scan refreshes them for the page's next request
+    this->scanner.request();
 
-    conn.setContentLength(len);
-    conn.send(200, IOP_STR("text/html"), pageHTMLStart());
+    // Results change with every scan
+    conn.sendHeader(IOP_STR("Cache-Control"), IOP_STR("no-store"));
+    conn.send(200, IOP_STR("application/json"), std::string_view(json->data()));
+  }));
 
-    if (mustConnect) conn.sendData(wifiHTML());
-    else conn.sendData(wifiOverwriteHTML());
+  this->server.onNotFound(tracked([this](iop_hal::HttpConnection &conn, iop::Log &logger) {
+    IOP_TRACE();
+    logger.infoln(IOP_STR("Serving form"));
 
-    if (needsIopAuth) conn.sendData(iopHTML());
-    else conn.sendData(iopOverwriteHTML());
+    const auto needsIopAuth = !this->loop->storage().token() && !this->credentialsIop;
+    // Not needing IoP auth means the WiFi credentials we have are invalid
+    const auto mustConnect = !iop::Network::isConnected() && (!this->loop->storage().wifi() || !needsIopAuth);
 
-    conn.sendData(script());
-    conn.sendData(css());
-    conn.sendData(pageHTMLEnd());
+    const auto [html, length] = page(mustConnect, needsIopAuth);
+    // The form depends on the device state, so it must always be revalidated
+    conn.sendHeader(IOP_STR("Cache-Control"), IOP_STR("no-cache"));
+    conn.setContentLength(length);
+    conn.send(200, IOP_STR("text/html"), html);
     logger.debugln(IOP_STR("Served HTML"));
-  });
+  }));
 }
 
 CredentialsServer::CredentialsServer() noexcept: logger(IOP_STR("SERVER")) {}
@@ -256,19 +185,21 @@ auto CredentialsServer::setAccessPointCredentials(StaticString SSID, StaticStrin
 
 auto CredentialsServer::start() noexcept -> void {
   IOP_TRACE();
+  iop_assert(this->loop, IOP_STR("CredentialsServer::setup must be called before serving"));
   if (!this->isServerOpen) {
     this->isServerOpen = true;
+    this->lastRequest.reset();
     this->logger.info(IOP_STR("Network connection: "));
     this->logger.infoln(iop::Network::isConnected());
     this->logger.infoln(IOP_STR("Valid credentials are not available"));
     this->logger.info(IOP_STR("Setting our own wifi access point: "));
     this->logger.infoln(this->credentialsAccessPoint->login);
 
-    const auto hasWifi = eventLoop.storage().wifi() || this->credentialsWifi;
+    const auto hasWifi = this->loop->storage().wifi() || this->credentialsWifi;
     this->logger.debug(IOP_STR("Has Wifi Creds: "));
     this->logger.debugln(hasWifi);
 
-    const auto hasIop = eventLoop.storage().token() || this->credentialsIop;
+    const auto hasIop = this->loop->storage().token() || this->credentialsIop;
     this->logger.debug(IOP_STR("Has IoP Creds: "));
     this->logger.debugln(hasIop);
 
@@ -278,16 +209,18 @@ auto CredentialsServer::start() noexcept -> void {
   
     // Some architectures force a disconnect when AP is enabled (AP_STA is fragile), so we reconnect
     if (isConnected && !iop::Network::isConnected()) {
-      const auto wifi = eventLoop.storage().wifi();
+      const auto wifi = this->loop->storage().wifi();
       // Should have something, but there might be a race so we can't be sure
       if (wifi) {
-        eventLoop.connect(iop::to_view(wifi->get().ssid), iop::to_view(wifi->get().password.get()));
+        this->loop->connect(iop::to_view(wifi->get().ssid), iop::to_view(wifi->get().password.get()));
       }
     }
 
     // Makes it a captive portal (redirects all wifi trafic to it)
     this->dnsServer.start();
     this->server.begin();
+    // So the form has networks to suggest right away, later scans are requested by the form (`/networks`)
+    this->scanner.request();
 
     this->logger.info(IOP_STR("Opened captive portal: "));
     this->logger.infoln(iop::wifi.ourAccessPointIp());
@@ -302,6 +235,7 @@ auto CredentialsServer::close() noexcept -> bool {
 
     this->dnsServer.close();
     this->server.close();
+    this->scanner.stop();
 
     iop::wifi.disableOurAccessPoint();
     return true;
@@ -309,14 +243,18 @@ auto CredentialsServer::close() noexcept -> bool {
   return false;
 }
 
-auto CredentialsServer::serve() noexcept -> std::unique_ptr<DynamicIopCredential> {
+auto CredentialsServer::inUse() const noexcept -> bool {
+  return this->isServerOpen && this->lastRequest && iop::clock::now() - *this->lastRequest < IOP_PORTAL_IDLE_MILLIS;
+}
+
+auto CredentialsServer::serve() noexcept -> Box<DynamicIopCredential> {
   IOP_TRACE();
 
   if (this->credentialsWifi) {
     this->close();
 
     this->logger.infoln(IOP_STR("Connecting to WiFi"));
-    eventLoop.connect(this->credentialsWifi->login, this->credentialsWifi->password);
+    this->loop->connect(this->credentialsWifi->login, this->credentialsWifi->password);
     this->credentialsWifi = nullptr;
     return nullptr;
   }
@@ -329,8 +267,23 @@ auto CredentialsServer::serve() noexcept -> std::unique_ptr<DynamicIopCredential
   this->start();
 
   this->logger.traceln(IOP_STR("Serve captive portal"));
-  this->dnsServer.handleClient();
-  this->server.handleClient();
+
+  // Each call handles one DNS query and one HTTP connection, phones probing the portal queue many of both.
+  // So we drain them, interleaved, instead of handling a single one per event loop iteration. Without clients it returns
+  // right away. The HAL doesn't tell if a DNS query was answered, but clients connect after resolving
+  const auto deadline = iop::clock::now() + IOP_PORTAL_SERVE_MILLIS;
+  do {
+    handledRequest = false;
+    this->scanner.poll();
+    this->dnsServer.handleClient();
+    this->server.handleClient();
+    if (handledRequest) this->lastRequest = iop::clock::now();
+
+    // Submitted credentials are handled by the event loop, as connecting and authenticating block
+    if (this->credentialsWifi || this->credentialsIop) break;
+    if (!handledRequest) break;
+    iop::clock::yield();
+  } while (iop::clock::now() < deadline);
   return nullptr;
 }
 }
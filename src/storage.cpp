@@ -1,12 +1,14 @@
 #include "iop/storage.hpp"
 #include "iop/loop.hpp"
+#include "iop/clock.hpp"
 #include <optional>
+#include <algorithm>
 
 #include "iop-hal/storage.hpp"
 #include "iop-hal/panic.hpp"
 
 namespace iop {
-constexpr const uintmax_t EEPROM_SIZE = 512;
+constexpr const uintmax_t EEPROM_SIZE = 1024;
 
 // If another type is to be written to storage be carefull not to mess with what
 // already is there and update the static_assert below. Same deal for removing
@@ -16,35 +18,53 @@ constexpr const uintmax_t EEPROM_SIZE = 512;
 // Chosen by fair dice roll, garanteed to be random
 const uint8_t usedWifiConfigEEPROMFlag = 125;
 const uint8_t usedAuthTokenEEPROMFlag = 126;
+const uint8_t usedCrashReportEEPROMFlag = 127;
+const uint8_t usedFirmwareMD5EEPROMFlag = 128;
+const uint8_t usedWifiRadioEEPROMFlag = 129;
+const uint8_t usedWifiStatsEEPROMFlag = 130;
 
 // One byte is reserved for the magic byte ('isWritten' flag)
 const uintmax_t authTokenSize = 1 + 64;
 const uintmax_t wifiConfigSize = 1 + 32 + 64;
+const uintmax_t crashReportSize = 1 + sizeof(CrashReport);
+const uintmax_t firmwareMD5Size = 1 + sizeof(FirmwareIdentity) + sizeof(iop::MD5Hash);
+const uintmax_t wifiRadioSize = 1 + sizeof(WifiRadio);
+const uintmax_t wifiStatsSize = 1 + sizeof(WifiStats);
 
 // Allows each method to know where to write
 const uintmax_t wifiConfigIndex = 0;
 const uintmax_t authTokenIndex = wifiConfigIndex + wifiConfigSize;
-
-static_assert(authTokenIndex + authTokenSize < EEPROM_SIZE,
+const uintmax_t crashReportIndex = authTokenIndex + authTokenSize;
+const uintmax_t firmwareMD5Index = crashReportIndex + crashReportSize;
+const uintmax_t wifiRadioIndex = firmwareMD5Index + firmwareMD5Size;
+// Slot 0 is stored at wifiConfigIndex and wifiRadioIndex, the others come after
+const uintmax_t extraWifiConfigIndex = wifiRadioIndex + wifiRadioSize;
+const uintmax_t extraWifiRadioIndex = extraWifiConfigIndex + (Storage::wifiSlots - 1) * wifiConfigSize;
+const uintmax_t wifiStatsIndex = extraWifiRadioIndex + (Storage::wifiSlots - 1) * wifiRadioSize;
+
+static_assert(wifiStatsIndex + Storage::wifiSlots * wifiStatsSize < EEPROM_SIZE,
               "EEPROM too small to store needed credentials");
 
-auto Storage::setup() noexcept -> void { iop_hal::storage.setup(EEPROM_SIZE); }
-
-static AuthToken authToken;
+auto Storage::setup() noexcept -> void {
+  this->backend().setup(EEPROM_SIZE);
+  // What wasn't written to flash doesn't survive a reboot
+  this->pendingWifiStats.fill(std::nullopt);
+  this->wifiStatsWrittenAt.fill(0);
+}
 
 auto Storage::token() noexcept -> std::optional<std::reference_wrapper<const AuthToken>> {
   IOP_TRACE();
 
   // Check if magic byte is set in storage (as in, something is stored)
-  const auto flag = iop_hal::storage.get(authTokenIndex);
+  const auto flag = this->backend().get(authTokenIndex);
   if (!flag || *flag != usedAuthTokenEEPROMFlag)
     return std::nullopt;
 
-  const auto maybeAuthToken = iop_hal::storage.read<sizeof(AuthToken)>(authTokenIndex + 1);
+  const auto maybeAuthToken = this->backend().read<sizeof(AuthToken)>(authTokenIndex + 1);
   iop_assert(maybeAuthToken, IOP_STR("Failed to read AuthToken from storage"));
-  authToken = *maybeAuthToken;
+  this->authToken = *maybeAuthToken;
 
-  const auto tok = iop::to_view(authToken);
+  const auto tok = iop::to_view(this->authToken);
   // AuthToken must be printable US-ASCII (to be stored in HTTP headers))
   if (!iop::isAllPrintable(tok) || tok.length() != 64) {
     this->logger.error(IOP_STR("Auth token was non printable: "));
@@ -55,23 +75,23 @@ auto Storage::token() noexcept -> std::optional<std::reference_wrapper<const Aut
 
   this->logger.trace(IOP_STR("Found Auth token: "));
   this->logger.traceln(tok);
-  const auto ref = std::reference_wrapper<const AuthToken>(authToken);
+  const auto ref = std::reference_wrapper<const AuthToken>(this->authToken);
   return std::make_optional(ref);
 }
 
 void Storage::removeToken() noexcept {
   IOP_TRACE();
 
-  authToken.fill('\0');
+  this->authToken.fill('\0');
 
   // Checks if it's written to storage first, avoids wasting writes
-  const auto flag = iop_hal::storage.get(authTokenIndex);
+  const auto flag = this->backend().get(authTokenIndex);
   if (flag && *flag == usedAuthTokenEEPROMFlag) {
     this->logger.infoln(IOP_STR("Deleting stored auth token"));
 
-    iop_assert(iop_hal::storage.set(authTokenIndex, 0), IOP_STR("unable to reset auth token written flag"));
-    iop_assert(iop_hal::storage.write(authTokenIndex + 1, authToken), IOP_STR("unable to delete auth token"));
-    iop_assert(iop_hal::storage.commit(), IOP_STR("unable to commit auth token deletion"));
+    iop_assert(this->backend().set(authTokenIndex, 0), IOP_STR("unable to reset auth token written flag"));
+    iop_assert(this->backend().write(authTokenIndex + 1, this->authToken), IOP_STR("unable to delete auth token"));
+    iop_assert(this->backend().commit(), IOP_STR("unable to commit auth token deletion"));
   }
 }
 
@@ -79,9 +99,9 @@ auto Storage::setToken(const AuthToken &token) noexcept -> bool {
   IOP_TRACE();
 
   // Avoids re-writing same data
-  const auto flag = iop_hal::storage.get(authTokenIndex);
+  const auto flag = this->backend().get(authTokenIndex);
   if (flag && *flag == usedAuthTokenEEPROMFlag) {
-    const auto tok = iop_hal::storage.read<sizeof(AuthToken)>(authTokenIndex + 1);
+    const auto tok = this->backend().read<sizeof(AuthToken)>(authTokenIndex + 1);
     iop_assert(tok, IOP_STR("Failed to read AuthToken from storage"));
 
     if (*tok == token) {
@@ -92,87 +112,378 @@ auto Storage::setToken(const AuthToken &token) noexcept -> bool {
 
   this->logger.info(IOP_STR("Writing auth token to storage: "));
   this->logger.infoln(iop::to_view(token));
-  iop_assert(iop_hal::storage.set(authTokenIndex, usedAuthTokenEEPROMFlag), IOP_STR("unable to set auth token written flag"));
-  iop_assert(iop_hal::storage.write(authTokenIndex + 1, token), IOP_STR("unable to write auth token"));
-  iop_assert(iop_hal::storage.commit(), IOP_STR("unable to commit auth token"));
+  iop_assert(this->backend().set(authTokenIndex, usedAuthTokenEEPROMFlag), IOP_STR("unable to set auth token written flag"));
+  iop_assert(this->backend().write(authTokenIndex + 1, token), IOP_STR("unable to write auth token"));
+  iop_assert(this->backend().commit(), IOP_STR("unable to commit auth token"));
   return true;
 }
 
-static iop::NetworkName ssid;
-static iop::NetworkPassword psk;
+// Slot 0 lives where the single WiFi credential used to be stored, so it survives firmware updates
+static auto wifiConfigSlotIndex(const uint8_t slot) noexcept -> uintmax_t {
+  return slot == 0 ? wifiConfigIndex : extraWifiConfigIndex + (slot - 1) * wifiConfigSize;
+}
+static auto wifiRadioSlotIndex(const uint8_t slot) noexcept -> uintmax_t {
+  return slot == 0 ? wifiRadioIndex : extraWifiRadioIndex + (slot - 1) * wifiRadioSize;
+}
+static auto wifiStatsSlotIndex(const uint8_t slot) noexcept -> uintmax_t {
+  return wifiStatsIndex + slot * wifiStatsSize;
+}
 
-auto Storage::wifi() noexcept -> std::optional<std::reference_wrapper<const WifiCredentials>> {
+auto Storage::wifi(const uint8_t slot) noexcept -> std::optional<std::reference_wrapper<const WifiCredentials>> {
   IOP_TRACE();
+  iop_assert(slot < wifiSlots, IOP_STR("Invalid wifi slot"));
+
+  const auto index = wifiConfigSlotIndex(slot);
 
   // Check if magic byte is set in storage (as in, something is stored)
-  const auto flag = iop_hal::storage.get(wifiConfigIndex);
+  const auto flag = this->backend().get(index);
   if (!flag || *flag != usedWifiConfigEEPROMFlag)
     return std::nullopt;
 
-  const auto maybeSsid = iop_hal::storage.read<sizeof(iop::NetworkName)>(wifiConfigIndex + 1);
-  const auto maybePsk = iop_hal::storage.read<sizeof(iop::NetworkPassword)>(wifiConfigIndex + sizeof(iop::NetworkName) + 1);
+  const auto maybeSsid = this->backend().read<sizeof(iop::NetworkName)>(index + 1);
+  const auto maybePsk = this->backend().read<sizeof(iop::NetworkPassword)>(index + sizeof(iop::NetworkName) + 1);
   iop_assert(maybeSsid, IOP_STR("Failed to read SSID from storage"));
   iop_assert(maybePsk, IOP_STR("Failed to read PSK from storage"));
 
-  ssid = *maybeSsid;
-  psk = *maybePsk;
+  this->ssids[slot] = *maybeSsid;
+  this->psks[slot] = *maybePsk;
 
-  const auto ssidStr = iop::scapeNonPrintable(iop::to_view(ssid));
+  const auto ssidStr = iop::scapeNonPrintable(iop::to_view(this->ssids[slot]));
   this->logger.trace(IOP_STR("Found network credentials: "));
   this->logger.traceln(iop::to_view(ssidStr));
-  const auto creds = WifiCredentials(ssid, psk);
-  return std::make_optional(std::ref(creds));
+  this->credentials[slot].emplace(this->ssids[slot], this->psks[slot]);
+  return std::make_optional(std::cref(*this->credentials[slot]));
 }
 
-void Storage::removeWifi() noexcept {
+auto Storage::wifi() noexcept -> std::optional<std::reference_wrapper<const WifiCredentials>> {
+  for (uint8_t slot = 0; slot < wifiSlots; ++slot) {
+    const auto creds = this->wifi(slot);
+    if (creds) return creds;
+  }
+  return std::nullopt;
+}
+
+auto Storage::wifiSlot(const std::string_view ssid) noexcept -> std::optional<uint8_t> {
+  for (uint8_t slot = 0; slot < wifiSlots; ++slot) {
+    const auto creds = this->wifi(slot);
+    if (creds && iop::to_view(creds->get().ssid.get()) == ssid) return slot;
+  }
+  return std::nullopt;
+}
+
+void Storage::removeWifi(const uint8_t slot) noexcept {
   IOP_TRACE();
-  this->logger.infoln(IOP_STR("Deleting stored wifi config"));
+  iop_assert(slot < wifiSlots, IOP_STR("Invalid wifi slot"));
+
+  this->ssids[slot].fill('\0');
+  this->psks[slot].fill('\0');
+  this->credentials[slot].reset();
 
-  ssid.fill('\0');
-  psk.fill('\0');
+  const auto index = wifiConfigSlotIndex(slot);
 
   // Checks if it's written to storage first, avoids wasting writes
-  const auto flag = iop_hal::storage.get(wifiConfigIndex);
+  const auto flag = this->backend().get(index);
   if (flag && *flag == usedWifiConfigEEPROMFlag) {
-    this->logger.infoln(IOP_STR("Deleting stored wifi creds"));
+    this->logger.info(IOP_STR("Deleting stored wifi creds, slot: "));
+    this->logger.infoln(static_cast<uint64_t>(slot));
+
+    iop_assert(this->backend().set(index, 0), IOP_STR("unable to reset wifi creds written flag"));
+    iop_assert(this->backend().write(index + 1, this->ssids[slot]), IOP_STR("unable to delete wifi ssid"));
+    iop_assert(this->backend().write(index + sizeof(iop::NetworkName) + 1, this->psks[slot]), IOP_STR("unable to delete wifi psk"));
+    // Radio parameters and history belong to the credentials
+    iop_assert(this->backend().set(wifiRadioSlotIndex(slot), 0), IOP_STR("unable to reset wifi radio written flag"));
+    iop_assert(this->backend().set(wifiStatsSlotIndex(slot), 0), IOP_STR("unable to reset wifi stats written flag"));
+    iop_assert(this->backend().commit(), IOP_STR("unable to commit wifi creds deletion"));
+    this->pendingWifiStats[slot].reset();
+  }
+}
+
+void Storage::removeWifi() noexcept {
+  IOP_TRACE();
+  this->logger.infoln(IOP_STR("Deleting stored wifi config"));
 
-    iop_assert(iop_hal::storage.set(wifiConfigIndex, 0), IOP_STR("unable to reset wifi creds written flag"));
-    iop_assert(iop_hal::storage.write(wifiConfigIndex + 1, ssid), IOP_STR("unable to delete wifi ssid"));
-    iop_assert(iop_hal::storage.write(wifiConfigIndex + sizeof(iop::NetworkName) + 1, psk), IOP_STR("unable to delete wifi psk"));
-    iop_assert(iop_hal::storage.commit(), IOP_STR("unable to commit wifi creds deletion"));
+  for (uint8_t slot = 0; slot < wifiSlots; ++slot) {
+    this->removeWifi(slot);
   }
 }
 
 auto Storage::setWifi(const WifiCredentials &config) noexcept -> bool {
   IOP_TRACE();
 
-  // Avoids re-writing same data
-  const auto flag = iop_hal::storage.get(wifiConfigIndex);
-  if (flag && *flag == usedWifiConfigEEPROMFlag) {
-    const auto networkName = iop_hal::storage.read<sizeof(iop::NetworkName)>(wifiConfigIndex + 1);
-    const auto networkPassword = iop_hal::storage.read<sizeof(iop::NetworkPassword)>(wifiConfigIndex + sizeof(iop::NetworkName) + 1);
-    iop_assert(networkName, IOP_STR("Failed to read SSID from storage"));
-    iop_assert(networkPassword, IOP_STR("Failed to read PSK from storage"));
-
-    // Theoretically SSIDs can have a nullptr inside of it, but currently ESP8266 gives us random garbage after the first '\0' instead of zeroing the rest
-    // So we do not accept SSIDs with a nullptr in the middle
-    if (iop::to_view(*networkName) == iop::to_view(config.ssid.get()) && iop::to_view(*networkPassword) == iop::to_view(config.password.get())) {
+  // Theoretically SSIDs can have a nullptr inside of it, but currently ESP8266 gives us random garbage after the first '\0' instead of zeroing the rest
+  // So we do not accept SSIDs with a nullptr in the middle
+  const auto ssid = iop::to_view(config.ssid.get());
+  const auto password = iop::to_view(config.password.get());
+
+  // Same network replaces its own slot, otherwise we use an empty one, or evict the one with worse history
+  auto slot = this->wifiSlot(ssid);
+  if (slot) {
+    // Avoids re-writing same data
+    const auto stored = this->wifi(*slot);
+    if (stored && iop::to_view(stored->get().password.get()) == password) {
       this->logger.debugln(IOP_STR("Wifi Credentials already stored in storage"));
       return false;
     }
+  } else {
+    for (uint8_t index = 0; index < wifiSlots && !slot; ++index) {
+      if (!this->wifi(index)) slot = index;
+    }
+  }
+  if (!slot) {
+    uint8_t worst = 0;
+    for (uint8_t index = 1; index < wifiSlots; ++index) {
+      if (this->wifiStats(index).expectedConnectMillis(0) > this->wifiStats(worst).expectedConnectMillis(0)) worst = index;
+    }
+    slot = worst;
   }
 
   this->logger.info(IOP_STR("Writing wifi credentials to storage: "));
-  this->logger.infoln(iop::to_view(config.ssid.get()));
+  this->logger.infoln(ssid);
   this->logger.debug(IOP_STR("WiFi Creds: "));
-  this->logger.debug(iop::to_view(config.ssid.get()));
+  this->logger.debug(ssid);
   this->logger.debug(IOP_STR(" "));
-  this->logger.debugln(iop::to_view(config.password.get()));
+  this->logger.debugln(password);
+  this->logger.debug(IOP_STR("Slot: "));
+  this->logger.debugln(static_cast<uint64_t>(*slot));
+
+  const auto index = wifiConfigSlotIndex(*slot);
+  iop_assert(this->backend().set(index, usedWifiConfigEEPROMFlag), IOP_STR("unable to set wifi creds written flag"));
+  iop_assert(this->backend().write(index + 1, config.ssid.get()), IOP_STR("unable to write wifi ssid"));
+  iop_assert(this->backend().write(index + sizeof(iop::NetworkName) + 1, config.password.get()), IOP_STR("unable to write wifi psk"));
+  // Radio parameters and history belonged to the previous credentials
+  iop_assert(this->backend().set(wifiRadioSlotIndex(*slot), 0), IOP_STR("unable to reset wifi radio written flag"));
+  iop_assert(this->backend().set(wifiStatsSlotIndex(*slot), 0), IOP_STR("unable to reset wifi stats written flag"));
+  iop_assert(this->backend().commit(), IOP_STR("unable to commit wifi creds"));
+  this->pendingWifiStats[*slot].reset();
+  return true;
+}
+
+auto WifiStats::expectedConnectMillis(const uint16_t pendingFailures) const noexcept -> uint32_t {
+  // Laplace smoothing, a network without history is assumed to work half of the time
+  const uint32_t attempts = static_cast<uint32_t>(this->successes) + this->failures + pendingFailures;
+  const uint32_t successPerMille = std::max((static_cast<uint32_t>(this->successes) + 1) * 1000 / (attempts + 2), static_cast<uint32_t>(1));
+
+  // Networks without history are assumed to take as long as a full scan + association
+  const uint32_t took = this->successes > 0 ? this->connectMillis : 5000;
+
+  // Weak signals take longer to associate and are more likely to drop
+  const uint32_t rssiPenalty = this->rssi != 0 && this->rssi < -70 ? static_cast<uint32_t>(-70 - this->rssi) * 100 : 0;
+
+  return (took + rssiPenalty) * 1000 / successPerMille;
+}
+
+auto Storage::wifiStats(const uint8_t slot) noexcept -> WifiStats {
+  IOP_TRACE();
+  iop_assert(slot < wifiSlots, IOP_STR("Invalid wifi slot"));
+
+  if (const auto &pending = this->pendingWifiStats[slot]) return *pending;
+  return this->storedWifiStats(slot);
+}
+
+auto Storage::storedWifiStats(const uint8_t slot) noexcept -> WifiStats {
+  WifiStats stats;
+  memset(&stats, 0, sizeof(WifiStats));
+
+  const auto index = wifiStatsSlotIndex(slot);
+  const auto flag = this->backend().get(index);
+  if (!flag || *flag != usedWifiStatsEEPROMFlag)
+    return stats;
+
+  const auto maybeStats = this->backend().read<sizeof(WifiStats)>(index + 1);
+  iop_assert(maybeStats, IOP_STR("Failed to read WifiStats from storage"));
+  memcpy(&stats, maybeStats->data(), sizeof(WifiStats));
+  return stats;
+}
+
+auto Storage::recordWifiConnection(const uint8_t slot, const uint16_t failures, const iop::time::milliseconds took, const std::optional<int8_t> rssi) noexcept -> void {
+  IOP_TRACE();
+  iop_assert(slot < wifiSlots, IOP_STR("Invalid wifi slot"));
+
+  const auto stored = this->storedWifiStats(slot);
+  auto stats = this->wifiStats(slot);
+
+  // Old history decays, so networks that got better (or worse) are re-ranked
+  if (static_cast<uint32_t>(stats.successes) + stats.failures + failures >= 64) {
+    stats.successes /= 2;
+    stats.failures /= 2;
+  }
+
+  const auto tookMillis = static_cast<uint16_t>(std::min(took, static_cast<iop::time::milliseconds>(UINT16_MAX)));
+  // Exponential moving average, new connections weight 1/4
+  stats.connectMillis = stats.successes == 0 ? tookMillis : static_cast<uint16_t>((static_cast<uint32_t>(stats.connectMillis) * 3 + tookMillis) / 4);
+  stats.successes++;
+  stats.failures = static_cast<uint16_t>(std::min(static_cast<uint32_t>(stats.failures) + failures, static_cast<uint32_t>(UINT16_MAX)));
+  if (rssi) stats.rssi = *rssi;
+
+  // Most connections barely move the ranking, they are kept in memory until it changes enough or the last write gets old
+  const auto now = iop::clock::now();
+  const auto before = stored.expectedConnectMillis(0);
+  const auto after = stats.expectedConnectMillis(0);
+  const auto drift = before > after ? before - after : after - before;
+  const auto changed = static_cast<uint64_t>(drift) * 100 > static_cast<uint64_t>(before) * IOP_WIFI_STATS_CHANGE_PERCENT;
+  const auto stale = now - this->wifiStatsWrittenAt[slot] >= IOP_WIFI_STATS_WRITE_MILLIS;
+  if (stored.successes > 0 && failures == 0 && !changed && !stale) {
+    this->logger.debugln(IOP_STR("Wifi stats barely changed, keeping them in memory"));
+    this->pendingWifiStats[slot] = stats;
+    return;
+  }
+
+  std::array<char, sizeof(WifiStats)> raw;
+  memcpy(raw.data(), &stats, sizeof(WifiStats));
+
+  const auto index = wifiStatsSlotIndex(slot);
+  iop_assert(this->backend().set(index, usedWifiStatsEEPROMFlag), IOP_STR("unable to set wifi stats written flag"));
+  iop_assert(this->backend().write(index + 1, raw), IOP_STR("unable to write wifi stats"));
+  iop_assert(this->backend().commit(), IOP_STR("unable to commit wifi stats"));
+  this->pendingWifiStats[slot].reset();
+  this->wifiStatsWrittenAt[slot] = now;
+}
+
+auto Storage::crashReport() noexcept -> std::optional<std::reference_wrapper<const CrashReport>> {
+  IOP_TRACE();
+
+  // Check if magic byte is set in storage (as in, something is stored)
+  const auto flag = this->backend().get(crashReportIndex);
+  if (!flag || *flag != usedCrashReportEEPROMFlag)
+    return std::nullopt;
+
+  const auto maybeReport = this->backend().read<sizeof(CrashReport)>(crashReportIndex + 1);
+  iop_assert(maybeReport, IOP_STR("Failed to read CrashReport from storage"));
+  memcpy(&this->storedCrashReport, maybeReport->data(), sizeof(CrashReport));
+
+  // Strings are written by us, but storage may be corrupted, so we ensure they are terminated
+  this->storedCrashReport.file.back() = '\0';
+  this->storedCrashReport.func.back() = '\0';
+  this->storedCrashReport.msg.back() = '\0';
 
-  iop_assert(iop_hal::storage.set(wifiConfigIndex, usedWifiConfigEEPROMFlag), IOP_STR("unable to set wifi creds written flag"));
-  iop_assert(iop_hal::storage.write(wifiConfigIndex + 1, config.ssid.get()), IOP_STR("unable to write wifi ssid"));
-  iop_assert(iop_hal::storage.write(wifiConfigIndex + sizeof(iop::NetworkName) + 1, config.password.get()), IOP_STR("unable to write wifi psk"));
-  iop_assert(iop_hal::storage.commit(), IOP_STR("unable to commit wifi creds deletion"));
+  this->logger.trace(IOP_STR("Found crash report: "));
+  this->logger.traceln(iop::panic::resetReasonToString(this->storedCrashReport.reason));
+  const auto ref = std::reference_wrapper<const CrashReport>(this->storedCrashReport);
+  return std::make_optional(ref);
+}
+
+void Storage::removeCrashReport() noexcept {
+  IOP_TRACE();
+
+  // Checks if it's written to storage first, avoids wasting writes
+  const auto flag = this->backend().get(crashReportIndex);
+  if (flag && *flag == usedCrashReportEEPROMFlag) {
+    this->logger.infoln(IOP_STR("Deleting stored crash report"));
+
+    iop_assert(this->backend().set(crashReportIndex, 0), IOP_STR("unable to reset crash report written flag"));
+    iop_assert(this->backend().commit(), IOP_STR("unable to commit crash report deletion"));
+  }
+}
+
+auto Storage::setCrashReport(const CrashReport &report) noexcept -> bool {
+  IOP_TRACE();
+
+  std::array<char, sizeof(CrashReport)> raw;
+  memcpy(raw.data(), &report, sizeof(CrashReport));
+
+  if (!this->backend().set(crashReportIndex, usedCrashReportEEPROMFlag)) return false;
+  if (!this->backend().write(crashReportIndex + 1, raw)) return false;
+  return this->backend().commit();
+}
+
+auto Storage::firmwareMD5(const FirmwareIdentity &identity) noexcept -> std::optional<std::reference_wrapper<const iop::MD5Hash>> {
+  IOP_TRACE();
+
+  // Check if magic byte is set in storage (as in, something is stored)
+  const auto flag = this->backend().get(firmwareMD5Index);
+  if (!flag || *flag != usedFirmwareMD5EEPROMFlag)
+    return std::nullopt;
+
+  const auto maybeIdentity = this->backend().read<sizeof(FirmwareIdentity)>(firmwareMD5Index + 1);
+  iop_assert(maybeIdentity, IOP_STR("Failed to read FirmwareIdentity from storage"));
+
+  FirmwareIdentity stored;
+  memcpy(&stored, maybeIdentity->data(), sizeof(FirmwareIdentity));
+  if (!(stored == identity)) {
+    this->logger.debugln(IOP_STR("Cached firmware MD5 belongs to another image"));
+    return std::nullopt;
+  }
+
+  const auto maybeMD5 = this->backend().read<sizeof(iop::MD5Hash)>(firmwareMD5Index + 1 + sizeof(FirmwareIdentity));
+  iop_assert(maybeMD5, IOP_STR("Failed to read firmware MD5 from storage"));
+  this->cachedFirmwareMD5 = *maybeMD5;
+
+  if (!iop::isAllPrintable(iop::to_view(this->cachedFirmwareMD5))) {
+    this->logger.errorln(IOP_STR("Cached firmware MD5 was non printable"));
+    this->removeFirmwareMD5();
+    return std::nullopt;
+  }
+
+  const auto ref = std::reference_wrapper<const iop::MD5Hash>(this->cachedFirmwareMD5);
+  return std::make_optional(ref);
+}
+
+void Storage::removeFirmwareMD5() noexcept {
+  IOP_TRACE();
+
+  // Checks if it's written to storage first, avoids wasting writes
+  const auto flag = this->backend().get(firmwareMD5Index);
+  if (flag && *flag == usedFirmwareMD5EEPROMFlag) {
+    this->logger.debugln(IOP_STR("Deleting cached firmware MD5"));
+
+    iop_assert(this->backend().set(firmwareMD5Index, 0), IOP_STR("unable to reset firmware MD5 written flag"));
+    iop_assert(this->backend().commit(), IOP_STR("unable to commit firmware MD5 deletion"));
+  }
+}
+
+auto Storage::setFirmwareMD5(const FirmwareIdentity &identity, const iop::MD5Hash &md5) noexcept -> bool {
+  IOP_TRACE();
+
+  std::array<char, sizeof(FirmwareIdentity)> raw;
+  memcpy(raw.data(), &identity, sizeof(FirmwareIdentity));
+
+  this->logger.debugln(IOP_STR("Caching firmware MD5"));
+  iop_assert(this->backend().set(firmwareMD5Index, usedFirmwareMD5EEPROMFlag), IOP_STR("unable to set firmware MD5 written flag"));
+  iop_assert(this->backend().write(firmwareMD5Index + 1, raw), IOP_STR("unable to write firmware identity"));
+  iop_assert(this->backend().write(firmwareMD5Index + 1 + sizeof(FirmwareIdentity), md5), IOP_STR("unable to write firmware MD5"));
+  iop_assert(this->backend().commit(), IOP_STR("unable to commit firmware MD5"));
+  return true;
+}
+
+auto Storage::wifiRadio(const uint8_t slot) noexcept -> std::optional<std::reference_wrapper<const WifiRadio>> {
+  IOP_TRACE();
+  iop_assert(slot < wifiSlots, IOP_STR("Invalid wifi slot"));
+
+  const auto index = wifiRadioSlotIndex(slot);
+
+  // Check if magic byte is set in storage (as in, something is stored)
+  const auto flag = this->backend().get(index);
+  if (!flag || *flag != usedWifiRadioEEPROMFlag)
+    return std::nullopt;
+
+  const auto maybeRadio = this->backend().read<sizeof(WifiRadio)>(index + 1);
+  iop_assert(maybeRadio, IOP_STR("Failed to read WifiRadio from storage"));
+  memcpy(&this->storedWifiRadios[slot], maybeRadio->data(), sizeof(WifiRadio));
+
+  this->logger.trace(IOP_STR("Found wifi radio parameters, channel: "));
+  this->logger.traceln(static_cast<uint64_t>(this->storedWifiRadios[slot].channel));
+  const auto ref = std::reference_wrapper<const WifiRadio>(this->storedWifiRadios[slot]);
+  return std::make_optional(ref);
+}
+
+auto Storage::setWifiRadio(const uint8_t slot, const WifiRadio &radio) noexcept -> bool {
+  IOP_TRACE();
+
+  // Avoids re-writing same data, this is called at every connection
+  const auto stored = this->wifiRadio(slot);
+  if (stored && stored->get() == radio) {
+    this->logger.debugln(IOP_STR("Wifi radio parameters already stored in storage"));
+    return false;
+  }
+
+  std::array<char, sizeof(WifiRadio)> raw;
+  memcpy(raw.data(), &radio, sizeof(WifiRadio));
+
+  const auto index = wifiRadioSlotIndex(slot);
+  this->logger.debugln(IOP_STR("Writing wifi radio parameters to storage"));
+  iop_assert(this->backend().set(index, usedWifiRadioEEPROMFlag), IOP_STR("unable to set wifi radio written flag"));
+  iop_assert(this->backend().write(index + 1, raw), IOP_STR("unable to write wifi radio"));
+  iop_assert(this->backend().commit(), IOP_STR("unable to commit wifi radio"));
   return true;
 }
-}
\ No newline at end of file
+}
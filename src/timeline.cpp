@@ -0,0 +1,39 @@
+#include "iop/timeline.hpp"
+#include "iop/clock.hpp"
+
+namespace iop {
+auto BootTimeline::mark(const BootStage stage) noexcept -> void {
+  auto &moment = this->stages[static_cast<uint8_t>(stage)];
+  if (!moment) moment = iop::clock::now();
+}
+
+auto BootTimeline::at(const BootStage stage) const noexcept -> std::optional<iop::time::milliseconds> {
+  return this->stages[static_cast<uint8_t>(stage)];
+}
+
+auto BootTimeline::toString(const BootStage stage) noexcept -> iop::StaticString {
+  switch (stage) {
+  case BootStage::STORAGE:
+    return IOP_STR("storage");
+  case BootStage::API:
+    return IOP_STR("api");
+  case BootStage::PANIC:
+    return IOP_STR("panic");
+  case BootStage::NETWORK_LOGGER:
+    return IOP_STR("network_logger");
+  case BootStage::CREDENTIALS_SERVER:
+    return IOP_STR("credentials_server");
+  case BootStage::FIRMWARE_MD5:
+    return IOP_STR("firmware_md5");
+  case BootStage::USER_SETUP:
+    return IOP_STR("user_setup");
+  case BootStage::WIFI:
+    return IOP_STR("wifi");
+  case BootStage::AUTHENTICATION:
+    return IOP_STR("authentication");
+  case BootStage::FIRST_EVENT:
+    return IOP_STR("first_event");
+  }
+  return IOP_STR("unknown");
+}
+}
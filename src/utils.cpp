@@ -2,42 +2,114 @@
 #include "iop-hal/device.hpp"
 #include "iop/utils.hpp"
 
+#include <atomic>
+
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+#include <pgmspace.h>
+#endif
+
 namespace iop {
-static volatile InterruptEvent interruptEvents[interruptVariants] = { InterruptEvent::NONE, InterruptEvent::NONE, InterruptEvent::NONE };
+static_assert((IOP_INTERRUPT_QUEUE_SIZE & (IOP_INTERRUPT_QUEUE_SIZE - 1)) == 0, "IOP_INTERRUPT_QUEUE_SIZE must be a power of two");
+constexpr static uint32_t interruptQueueSize = IOP_INTERRUPT_QUEUE_SIZE;
+
+// Bounded multi-producer single-consumer queue (Dmitry Vyukov's design).
+//
+// Every slot has a sequence number that tells who owns it: free for the producer at position `pos`,
+// or ready for the consumer at position `pos`. It's stored relative to the slot index,
+// so the zero-initialized static memory is a valid empty queue (no constructor needs to run before the first interrupt).
+struct InterruptSlot {
+  std::atomic<uint32_t> sequence;
+  Interrupt interrupt;
+};
+static InterruptSlot interruptSlots[interruptQueueSize];
+static std::atomic<uint32_t> interruptsHead(0); // Only touched by the consumer
+static std::atomic<uint32_t> interruptsTail(0); // Reserved by producers
+static std::atomic<uint32_t> interruptsDropped(0);
 
-auto descheduleInterrupt() noexcept -> InterruptEvent {
+auto descheduleInterrupt() noexcept -> Interrupt {
   IOP_TRACE();
-  for (volatile auto &el : interruptEvents) {
-    // TODO: lock interrupts
-    if (el != InterruptEvent::NONE) {
-      const auto tmp = el;
-      el = InterruptEvent::NONE;
-      return tmp;
-    }
-  }
-  return InterruptEvent::NONE;
-}
-// This function is called inside an interrupt, it can't be fancy (it can only call functions stored in IOP_RAM)
-void IOP_RAM scheduleInterrupt(const InterruptEvent ev) noexcept {
-  volatile InterruptEvent *ptr = nullptr;
-  for (volatile auto &el : interruptEvents) {
-    if (el == InterruptEvent::NONE && ptr == nullptr) {
-      ptr = &el;
-    } else if (el == ev) {
+  const auto pos = interruptsHead.load(std::memory_order_relaxed);
+  const auto index = pos % interruptQueueSize;
+  auto &slot = interruptSlots[index];
+
+  // Not published yet (or queue empty)
+  const auto sequence = slot.sequence.load(std::memory_order_acquire);
+  if (static_cast<int32_t>(sequence - (pos + 1 - index)) < 0)
+    return Interrupt { InterruptEvent::NONE, 0, 0 };
+
+  const auto interrupt = slot.interrupt;
+  // Frees the slot for the producer that will reach it in the next lap
+  slot.sequence.store(pos + interruptQueueSize - index, std::memory_order_release);
+  interruptsHead.store(pos + 1, std::memory_order_relaxed);
+  return interrupt;
+}
+
+// This function may be called inside an interrupt, it can't be fancy (it can only call functions stored in IOP_RAM)
+void IOP_RAM scheduleInterrupt(const InterruptEvent ev, const uint16_t code, const uint32_t payload) noexcept {
+  auto pos = interruptsTail.load(std::memory_order_relaxed);
+  InterruptSlot *slot = nullptr;
+  while (true) {
+    const auto index = pos % interruptQueueSize;
+    slot = &interruptSlots[index];
+
+    const auto sequence = slot->sequence.load(std::memory_order_acquire);
+    const auto diff = static_cast<int32_t>(sequence - (pos - index));
+    if (diff == 0) {
+      // Slot is free, tries to reserve it (another producer may win the race, so pos gets updated)
+      if (interruptsTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+    } else if (diff < 0) {
+      // The consumer hasn't freed this slot yet, the queue is full. We can't log from here.
+      interruptsDropped.fetch_add(1, std::memory_order_relaxed);
       return;
-    } else if (el != InterruptEvent::NONE) {
-      continue;
+    } else {
+      pos = interruptsTail.load(std::memory_order_relaxed);
     }
   }
 
-  if (ptr != nullptr) {
-    *ptr = ev;
-  } else {
-    // If no space is available and we reach here there is a bug in the code,
-    // interruptVariants is probably wrong. We used to panic here, but that
-    // doesn't work when called from interrupts
-    iop::Log::print("[CRIT] RESET: Unable to store interrupt, 'interruptVariant' is probably wrong\n",
-                    iop::LogLevel::INFO, iop::LogType::STARTEND);
+  slot->interrupt = Interrupt { ev, code, payload };
+  slot->sequence.store(pos + 1 - (pos % interruptQueueSize), std::memory_order_release);
+}
+
+auto droppedInterrupts() noexcept -> uint32_t {
+  return interruptsDropped.load(std::memory_order_relaxed);
+}
+
+auto hash(const std::string_view data, uint32_t seed) noexcept -> uint32_t {
+  for (const auto byte: data) {
+    seed ^= static_cast<uint8_t>(byte);
+    seed *= 16777619;
+  }
+  return seed;
+}
+
+auto hash(const iop::StaticString data, uint32_t seed) noexcept -> uint32_t {
+  const auto *ptr = data.asCharPtr();
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+  for (auto byte = pgm_read_byte(ptr); byte; byte = pgm_read_byte(++ptr)) {
+#else
+  for (auto byte = static_cast<uint8_t>(*ptr); byte; byte = static_cast<uint8_t>(*++ptr)) {
+#endif
+    seed ^= byte;
+    seed *= 16777619;
+  }
+  return seed;
+}
+
+auto Backoff::jittered(const iop::time::milliseconds delay, const uint32_t attempt, const uint32_t seed) const noexcept -> iop::time::milliseconds {
+  const auto clamped = std::min(delay, this->max);
+  const auto spread = clamped * std::min(this->jitter, static_cast<uint8_t>(100)) / 100;
+  if (spread == 0) return clamped;
+
+  // Mixes the attempt in, so devices with close seeds don't stay close
+  const auto noise = iop::hash(std::string_view(reinterpret_cast<const char *>(&attempt), sizeof(attempt)), seed);
+  return clamped - spread + (noise % (2 * spread + 1));
+}
+
+auto Backoff::delay(const uint32_t attempt, const uint32_t seed) const noexcept -> iop::time::milliseconds {
+  auto delay = this->initial;
+  for (uint32_t index = 0; index < attempt && delay < this->max; ++index) {
+    delay *= std::max(this->factor, static_cast<uint8_t>(1));
   }
+  return this->jittered(delay, attempt, seed);
 }
 }
@@ -0,0 +1,137 @@
+#include "iop/watchdog.hpp"
+#include "iop/clock.hpp"
+
+#include <atomic>
+
+#if defined(IOP_ESP8266)
+#include <Esp.h>
+#include <Ticker.h>
+#include <user_interface.h>
+#elif defined(IOP_ESP32)
+#include <Ticker.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#endif
+
+namespace iop {
+namespace watchdog {
+constexpr static uint32_t magic = 0x10BDD06;
+
+#if defined(IOP_ESP32)
+// Not initialized at boot, so it survives software and watchdog resets
+RTC_NOINIT_ATTR static WatchdogRecord record;
+#else
+// The ESP8266 keeps a copy in RTC memory
+static IOP_THREAD_LOCAL WatchdogRecord record;
+#endif
+static IOP_THREAD_LOCAL iop::time::milliseconds iterationStart = 0;
+/// Odd while `set` is writing the record. The timer may interrupt it (or run in parallel, in the ESP32), so `check`
+/// only trusts `start` and `limit` if it was even and unchanged around reading them
+static IOP_THREAD_LOCAL std::atomic<uint32_t> sequence(0);
+
+#if defined(IOP_WATCHDOG) && (defined(IOP_ESP8266) || defined(IOP_ESP32))
+static Ticker ticker;
+#endif
+
+static auto persist() noexcept -> void {
+#if defined(IOP_WATCHDOG) && defined(IOP_ESP8266)
+  ESP.rtcUserMemoryWrite(IOP_WATCHDOG_RTC_BLOCK, reinterpret_cast<uint32_t *>(&record), sizeof(record));
+#endif
+}
+
+static auto set(const LoopPhase phase, const uint16_t task, const iop::time::milliseconds limit, const iop::time::milliseconds start) noexcept -> void {
+  // Only the loop writes, so it doesn't need a read-modify-write
+  const auto version = sequence.load(std::memory_order_relaxed);
+  sequence.store(version + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  record.magic = magic;
+  record.start = static_cast<uint32_t>(start);
+  record.limit = static_cast<uint32_t>(limit);
+  record.task = task;
+  record.phase = phase;
+  record.fired = false;
+
+  sequence.store(version + 2, std::memory_order_release);
+  persist();
+}
+
+#if defined(IOP_WATCHDOG) && (defined(IOP_ESP8266) || defined(IOP_ESP32))
+// Runs from a timer, so it catches sections that stall while yielding, like a network call waiting for a dead server.
+// Sections that never yield are caught by the hardware watchdog, the record in RTC memory tells which one it was
+static auto check() noexcept -> void {
+  // A new start with the previous limit (or the opposite) would reset a healthy device, a torn read waits for the next check
+  const auto version = sequence.load(std::memory_order_acquire);
+  if (version & 1) return;
+  const auto start = record.start;
+  const auto limit = record.limit;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (sequence.load(std::memory_order_relaxed) != version) return;
+
+  const auto elapsed = static_cast<uint32_t>(iop::clock::now()) - start;
+  if (elapsed <= limit) return;
+
+  record.fired = true;
+  persist();
+#if defined(IOP_ESP8266)
+  // Safe outside of the loop's context, unlike ESP.restart
+  system_restart();
+#else
+  esp_restart();
+#endif
+}
+#endif
+
+auto setup() noexcept -> void {
+  iterationStart = iop::clock::now();
+  set(LoopPhase::SETUP, noTask, IOP_WATCHDOG_LOOP_MILLIS, iterationStart);
+#if defined(IOP_WATCHDOG) && (defined(IOP_ESP8266) || defined(IOP_ESP32))
+  ticker.attach_ms(IOP_WATCHDOG_CHECK_MILLIS, check);
+#endif
+}
+
+auto stop() noexcept -> void {
+#if defined(IOP_WATCHDOG) && (defined(IOP_ESP8266) || defined(IOP_ESP32))
+  ticker.detach();
+#endif
+}
+
+auto enter(const LoopPhase phase, const uint16_t task, const iop::time::milliseconds limit) noexcept -> void {
+  set(phase, task, limit, iop::clock::now());
+}
+
+auto leave() noexcept -> iop::time::milliseconds {
+  const auto took = static_cast<uint32_t>(iop::clock::now()) - record.start;
+  set(LoopPhase::CONNECTIVITY, noTask, IOP_WATCHDOG_LOOP_MILLIS, iterationStart);
+  return took;
+}
+
+auto feed() noexcept -> void {
+  iterationStart = iop::clock::now();
+  set(LoopPhase::CONNECTIVITY, noTask, IOP_WATCHDOG_LOOP_MILLIS, iterationStart);
+#if defined(IOP_WATCHDOG) && defined(IOP_ESP8266)
+  ESP.wdtFeed();
+#endif
+}
+
+auto takeRecord() noexcept -> std::optional<WatchdogRecord> {
+#if defined(IOP_WATCHDOG) && defined(IOP_ESP8266)
+  WatchdogRecord stored;
+  if (!ESP.rtcUserMemoryRead(IOP_WATCHDOG_RTC_BLOCK, reinterpret_cast<uint32_t *>(&stored), sizeof(stored))) return std::nullopt;
+#elif defined(IOP_WATCHDOG) && defined(IOP_ESP32)
+  const auto stored = record;
+#else
+  // Nothing survives a restart in linux
+  WatchdogRecord stored;
+  stored.magic = 0;
+#endif
+  if (stored.magic != magic || static_cast<uint8_t>(stored.phase) >= loopPhases) return std::nullopt;
+
+  record.magic = 0;
+  persist();
+  return stored;
+}
+
+auto current() noexcept -> const WatchdogRecord & { return record; }
+}
+}
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Compares two runs of examples/benchmark, failing if any benchmark regressed.
+
+Usage:
+    python tools/compare_benchmarks.py baseline.jsonl candidate.jsonl [--threshold 10]
+
+Each run is the benchmark's output, non JSON lines (logs) are ignored. A benchmark regressed if it got slower
+by more than `--threshold` percent, or if it allocates more per operation. Compression results (`compression_ratio`)
+are deterministic, so any drop in the ratio is a regression. Exits with 1 on regressions.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    results = {}
+    with open(path, encoding="utf-8") as run:
+        for line in run:
+            line = line.strip()
+            if not line.startswith("{"):
+                continue
+            try:
+                result = json.loads(line)
+            except ValueError:
+                continue
+            if "name" in result:
+                results[result["name"]] = result
+    return results
+
+
+def compare_ratios(baseline, candidate):
+    """Compares the compression results and removes them from both runs, what's left are timings"""
+    regressions = 0
+    for name in sorted(baseline.keys() | candidate.keys()):
+        old, new = baseline.get(name, {}), candidate.get(name, {})
+        if "compression_ratio" not in old and "compression_ratio" not in new:
+            continue
+        baseline.pop(name, None)
+        candidate.pop(name, None)
+        if "compression_ratio" not in old or "compression_ratio" not in new:
+            continue
+
+        regressed = new["compression_ratio"] < old["compression_ratio"]
+        regressions += regressed
+        ratios = f"{old['compression_ratio']:.2f}->{new['compression_ratio']:.2f}"
+        print(f"{name:40} {'ratio':>12} {ratios:>24}{'  REGRESSION' if regressed else ''}")
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("baseline")
+    parser.add_argument("candidate")
+    parser.add_argument("--threshold", type=float, default=10, help="percentage of slowdown tolerated, timing is noisy")
+    args = parser.parse_args()
+
+    baseline, candidate = load(args.baseline), load(args.candidate)
+    print(f"{'benchmark':40} {'ns/op':>12} {'change':>9} {'allocs/op':>14}")
+    regressions = compare_ratios(baseline, candidate)
+    for name in sorted(baseline.keys() | candidate.keys()):
+        if name not in candidate:
+            print(f"{name:40} {'removed':>12}")
+            continue
+        new = candidate[name]
+        if name not in baseline:
+            print(f"{name:40} {new['ns_per_op']:12.2f} {'new':>9} {new['allocations_per_op']:14.3f}")
+            continue
+        old = baseline[name]
+
+        change = (new["ns_per_op"] - old["ns_per_op"]) / old["ns_per_op"] * 100 if old["ns_per_op"] else 0
+        allocations = f"{old['allocations_per_op']:.3f}->{new['allocations_per_op']:.3f}"
+        regressed = change > args.threshold or new["allocations_per_op"] > old["allocations_per_op"]
+        regressions += regressed
+        print(f"{name:40} {new['ns_per_op']:12.2f} {change:+8.1f}% {allocations:>14}{'  REGRESSION' if regressed else ''}")
+
+    if regressions:
+        print(f"{regressions} regression(s)")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,478 @@
+#!/usr/bin/env python3
+"""Local stand-in for the internet-of-plants monitor server.
+
+It answers every route `iop::Api` uses, so the firmware can run end-to-end without the real server:
+
+    POST /v1/user/login   -> 64 bytes auth token (any credentials are accepted)
+    POST /v1/event        -> 200, the JSON body is validated
+    POST /v1/event/series -> 200, the `iop::TimeSeries` body is decoded (400 if it's invalid)
+    POST /v1/log          -> 200
+    POST /v1/panic        -> 200, optionally with {"next_check": secs}
+    GET  /v1/update       -> 304, or the firmware binary if --firmware is set and its MD5 differs from the device's
+    GET  /stats           -> per endpoint statistics, as JSON
+    GET  /events?key=KEY  -> how many events had KEY, and its value in the last of them: {"received": N, "last": ...}
+    GET  /inflate?enabled=0 -> stops (or with 1 resumes) inflating bodies, like --no-inflate, answers {"enabled": bool}
+
+Devices built with IOP_DEBUG talk to http://127.0.0.1:4001, the default port.
+
+Usage:
+    python tools/monitor_server.py [--port 4001] [--latency MS] [--jitter MS]
+                                   [--error-rate P] [--error-status CODE]
+                                   [--endpoint /v1/event:latency=200,error-rate=0.1,status=503]
+                                   [--firmware .pio/build/<env>/firmware.bin] [--next-check SECS]
+                                   [--record traffic.jsonl | --replay traffic.jsonl] [--seed N] [--no-inflate]
+
+Devices built with IOP_COMPRESSION post their first big log or event with `?accept_encoding=deflate`, the answer
+`{"accept_encoding": "deflate"}` tells them to send the next ones deflated, with `?encoding=deflate`, and they are
+inflated. `--no-inflate` answers like servers that don't support it: no hint, and 415 to deflated bodies. `/inflate`
+switches it at runtime, so tests can simulate a server rolled back after devices enabled compression.
+
+Injected latency and errors apply to every route, `--endpoint` overrides them for a single route (it may be repeated).
+`--record` appends each request and its response to a JSON lines file, `--replay` answers with the recorded
+responses, in order, per route. Statistics are printed when the server stops (Ctrl+C or SIGTERM).
+"""
+
+import argparse
+import base64
+import hashlib
+import json
+import random
+import signal
+import struct
+import threading
+import time
+import zlib
+from collections import defaultdict, deque
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs
+
+ROUTES = ("/v1/user/login", "/v1/event", "/v1/event/series", "/v1/log", "/v1/panic", "/v1/update")
+
+# Headers the OTA clients send with the MD5 of the running image
+SKETCH_MD5_HEADERS = ("x-ESP8266-sketch-md5", "x-ESP32-sketch-md5")
+
+
+class BitReader:
+    def __init__(self, data):
+        self.data = data
+        self.bit = 0
+
+    def read(self, count):
+        if self.bit + count > len(self.data) * 8:
+            raise ValueError("truncated column")
+        value = 0
+        for _ in range(count):
+            value = (value << 1) | ((self.data[self.bit // 8] >> (7 - self.bit % 8)) & 1)
+            self.bit += 1
+        return value
+
+
+# (value bits) per delta of delta bucket, indexed by the number of ones after the first of the prefix
+TIMESTAMP_BUCKETS = (7, 9, 12, 32, 64)
+
+
+def decode_timestamps(reader, count):
+    timestamps = []
+    last = delta = 0
+    for index in range(count):
+        if index == 0:
+            last = reader.read(64)
+            timestamps.append(last)
+            continue
+        encoded = 0
+        if reader.read(1):
+            ones = 0
+            while ones < 3 and reader.read(1):
+                ones += 1
+            if ones == 3:
+                ones += reader.read(1)
+            encoded = reader.read(TIMESTAMP_BUCKETS[ones])
+        delta += (encoded >> 1) ^ -(encoded & 1)
+        last += delta
+        timestamps.append(last)
+    return timestamps
+
+
+def decode_values(reader, count):
+    values = []
+    last = leading = trailing = 0
+    for index in range(count):
+        if index == 0:
+            last = reader.read(32)
+        elif reader.read(1):
+            if reader.read(1):
+                leading = reader.read(5)
+                trailing = 32 - leading - (reader.read(5) + 1)
+            last ^= reader.read(32 - leading - trailing) << trailing
+        values.append(struct.unpack("<f", struct.pack("<I", last))[0])
+    return values
+
+
+def decode_series(body):
+    """Decodes an `iop::TimeSeries` payload into {"sent_at": uptime, "samples": [{"uptime": ms, field: value, ...}]}"""
+    version, fields, count, sent_at = struct.unpack_from("<BBHQ", body)
+    if version != 1:
+        raise ValueError(f"unknown series version: {version}")
+    offset = struct.calcsize("<BBHQ")
+    keys = []
+    for _ in range(fields):
+        length = body[offset]
+        keys.append(body[offset + 1:offset + 1 + length].decode())
+        offset += 1 + length
+    columns = []
+    for _ in range(fields + 1):
+        (length,) = struct.unpack_from("<H", body, offset)
+        columns.append(body[offset + 2:offset + 2 + length])
+        offset += 2 + length
+    if offset != len(body):
+        raise ValueError("trailing bytes")
+
+    timestamps = decode_timestamps(BitReader(columns[0]), count)
+    values = [decode_values(BitReader(column), count) for column in columns[1:]]
+    samples = [dict(zip(["uptime", *keys], row)) for row in zip(timestamps, *values)]
+    return {"sent_at": sent_at, "samples": samples}
+
+
+class Faults:
+    def __init__(self, latency=0.0, jitter=0.0, error_rate=0.0, status=500):
+        self.latency = latency
+        self.jitter = jitter
+        self.error_rate = error_rate
+        self.status = status
+
+    def override(self, spec):
+        faults = Faults(self.latency, self.jitter, self.error_rate, self.status)
+        for option in filter(None, spec.split(",")):
+            key, _, value = option.partition("=")
+            if key == "latency":
+                faults.latency = float(value)
+            elif key == "jitter":
+                faults.jitter = float(value)
+            elif key == "error-rate":
+                faults.error_rate = float(value)
+            elif key == "status":
+                faults.status = int(value)
+            else:
+                raise argparse.ArgumentTypeError(f"unknown endpoint option: {key}")
+        return faults
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.started = time.monotonic()
+        self.deflated = 0
+        self.inflated = 0
+        self.routes = defaultdict(lambda: {"requests": 0, "errors": 0, "bytes_in": 0, "bytes_out": 0, "latencies": []})
+
+    def add(self, route, status, bytes_in, bytes_out, latency):
+        with self.lock:
+            stats = self.routes[route]
+            stats["requests"] += 1
+            stats["errors"] += status >= 400
+            stats["bytes_in"] += bytes_in
+            stats["bytes_out"] += bytes_out
+            stats["latencies"].append(latency)
+
+    def add_inflated(self, deflated, plain):
+        with self.lock:
+            self.deflated += deflated
+            self.inflated += plain
+
+    def summary(self):
+        elapsed = max(time.monotonic() - self.started, 1e-9)
+        with self.lock:
+            summary = {}
+            if self.inflated:
+                summary["compression"] = {"deflated_bytes": self.deflated, "inflated_bytes": self.inflated,
+                                          "ratio": round(self.inflated / max(self.deflated, 1), 2)}
+            for route, stats in sorted(self.routes.items()):
+                latencies = sorted(stats["latencies"])
+                summary[route] = {
+                    "requests": stats["requests"],
+                    "errors": stats["errors"],
+                    "requests_per_sec": round(stats["requests"] / elapsed, 2),
+                    "bytes_in": stats["bytes_in"],
+                    "bytes_out": stats["bytes_out"],
+                    "p50_ms": round(percentile(latencies, 0.50) * 1000, 3),
+                    "p99_ms": round(percentile(latencies, 0.99) * 1000, 3),
+                    "max_ms": round((latencies[-1] if latencies else 0) * 1000, 3),
+                }
+            return summary
+
+
+def percentile(ordered, fraction):
+    if not ordered:
+        return 0.0
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+class Events:
+    """Events received per top level key, so tests can check what devices sent"""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.keys = {}
+
+    def add(self, event):
+        if not isinstance(event, dict):
+            return
+        with self.lock:
+            for key, value in event.items():
+                received = self.keys.get(key, {"received": 0})["received"]
+                self.keys[key] = {"received": received + 1, "last": value}
+
+    def get(self, key):
+        with self.lock:
+            return self.keys.get(key, {"received": 0, "last": None})
+
+
+class Replay:
+    """Recorded responses, answered in order per route. When a route runs out the live handler answers"""
+
+    def __init__(self, path):
+        self.lock = threading.Lock()
+        self.responses = defaultdict(deque)
+        with open(path, encoding="utf-8") as traffic:
+            for line in traffic:
+                entry = json.loads(line)
+                self.responses[(entry["method"], entry["path"])].append(entry["response"])
+
+    def next(self, method, path):
+        with self.lock:
+            queue = self.responses.get((method, path))
+            return queue.popleft() if queue else None
+
+
+class MonitorServer(ThreadingHTTPServer):
+    daemon_threads = True
+
+    def __init__(self, address, options):
+        super().__init__(address, Handler)
+        self.options = options
+        self.random = random.Random(options.seed)
+        self.random_lock = threading.Lock()
+        self.faults = Faults(options.latency, options.jitter, options.error_rate, options.error_status)
+        self.endpoint_faults = {}
+        for spec in options.endpoint:
+            path, _, overrides = spec.partition(":")
+            self.endpoint_faults[path] = self.faults.override(overrides)
+        self.stats = Stats()
+        self.events = Events()
+        self.inflates = not options.no_inflate
+        self.replay = Replay(options.replay) if options.replay else None
+        self.record_lock = threading.Lock()
+        self.record = open(options.record, "a", encoding="utf-8") if options.record else None
+        self.firmware = None
+        if options.firmware:
+            with open(options.firmware, "rb") as binary:
+                self.firmware = binary.read()
+            self.firmware_md5 = hashlib.md5(self.firmware).hexdigest()
+
+    def roll(self):
+        with self.random_lock:
+            return self.random.random()
+
+    def faults_for(self, path):
+        return self.endpoint_faults.get(path, self.faults)
+
+    def write_record(self, entry):
+        if self.record:
+            with self.record_lock:
+                self.record.write(json.dumps(entry) + "\n")
+                self.record.flush()
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server: MonitorServer
+
+    def log_message(self, format, *args):
+        if self.server.options.verbose:
+            super().log_message(format, *args)
+
+    def do_GET(self):
+        self.handle_request("GET")
+
+    def do_POST(self):
+        self.handle_request("POST")
+
+    def handle_request(self, method):
+        start = time.monotonic()
+        path, _, query = self.path.partition("?")
+        length = int(self.headers.get("Content-Length") or 0)
+        body = self.rfile.read(length) if length else b""
+        encoding = parse_qs(query).get("encoding", [None])[0]
+
+        if path == "/stats":
+            self.respond(200, json.dumps(self.server.stats.summary()).encode(), "application/json")
+            return
+        if path == "/events":
+            key = parse_qs(query).get("key", [""])[0]
+            self.respond(200, json.dumps(self.server.events.get(key)).encode(), "application/json")
+            return
+        if path == "/inflate":
+            enabled = parse_qs(query).get("enabled", [None])[0]
+            if enabled is not None:
+                self.server.inflates = enabled == "1"
+            self.respond(200, json.dumps({"enabled": self.server.inflates}).encode(), "application/json")
+            return
+
+        faults = self.server.faults_for(path)
+        delay = faults.latency + (self.server.roll() * faults.jitter if faults.jitter else 0)
+        if delay:
+            time.sleep(delay / 1000)
+
+        replayed = self.server.replay.next(method, path) if self.server.replay else None
+        if replayed:
+            status, headers, payload = replayed["status"], replayed.get("headers", {}), base64.b64decode(replayed["body"])
+        elif faults.error_rate and self.server.roll() < faults.error_rate:
+            status, headers, payload = faults.status, {}, b""
+        else:
+            status, headers, payload = self.route(method, path, self.inflate(body, encoding))
+
+        if status == 200 and path in ("/v1/event", "/v1/log") and self.advertises_deflate(query):
+            headers["Content-Type"] = "application/json"
+            payload = json.dumps({"accept_encoding": "deflate"}).encode()
+
+        self.respond(status, payload, headers.pop("Content-Type", "text/plain"), headers)
+        self.server.stats.add(f"{method} {path}", status, len(body), len(payload), time.monotonic() - start)
+        self.server.write_record({
+            "method": method,
+            "path": path,
+            "headers": dict(self.headers),
+            "body": base64.b64encode(body).decode(),
+            "response": {"status": status, "headers": headers, "body": base64.b64encode(payload).decode()},
+        })
+
+    def advertises_deflate(self, query):
+        """Devices ask if deflated bodies are accepted before sending them"""
+        return parse_qs(query).get("accept_encoding", [None])[0] == "deflate" and self.server.inflates
+
+    def inflate(self, body, encoding):
+        """Returns the plain body, or the status to answer with if it can't be inflated"""
+        if encoding is None:
+            return body
+        if encoding != "deflate" or not self.server.inflates:
+            return 415
+        try:
+            plain = zlib.decompress(body)
+        except zlib.error:
+            return 400
+        self.server.stats.add_inflated(len(body), len(plain))
+        return plain
+
+    def route(self, method, path, body):
+        if isinstance(body, int):
+            return body, {}, b""
+        if path not in ROUTES:
+            return 404, {}, b""
+        if path == "/v1/user/login":
+            return self.login(body)
+
+        if not self.headers.get("Authorization"):
+            return 401, {}, b""
+
+        headers = {}
+        if self.server.firmware:
+            # Devices compare it to their own MD5 to know an update is available
+            headers["LATEST_VERSION"] = self.server.firmware_md5
+
+        if path == "/v1/update":
+            return self.update(headers)
+        if path == "/v1/log":
+            return 200, headers, b""
+
+        if path == "/v1/event/series":
+            try:
+                series = decode_series(body)
+            except (ValueError, IndexError, struct.error) as error:
+                return 400, headers, str(error).encode()
+            if self.server.options.verbose:
+                print(json.dumps(series))
+            return 200, headers, b""
+
+        try:
+            decoded = json.loads(body or b"null")
+        except ValueError:
+            return 400, headers, b"invalid json"
+        if path == "/v1/event":
+            self.server.events.add(decoded)
+
+        if path == "/v1/panic" and self.server.options.next_check is not None:
+            headers["Content-Type"] = "application/json"
+            return 200, headers, json.dumps({"next_check": self.server.options.next_check}).encode()
+        return 200, headers, b""
+
+    def login(self, body):
+        try:
+            credentials = json.loads(body)
+            organization, email = credentials["organization"], credentials["email"]
+        except (ValueError, KeyError, TypeError):
+            return 400, {}, b""
+        # Deterministic, so a restarted server keeps accepting the devices. sha256 in hex has 64 printable bytes
+        return 200, {}, hashlib.sha256(f"{organization}:{email}".encode()).hexdigest().encode()
+
+    def update(self, headers):
+        if not self.server.firmware:
+            return 304, headers, b""
+        running = next((self.headers.get(name) for name in SKETCH_MD5_HEADERS if self.headers.get(name)), None)
+        if running == self.server.firmware_md5:
+            return 304, headers, b""
+        headers["Content-Type"] = "application/octet-stream"
+        headers["x-MD5"] = self.server.firmware_md5
+        return 200, headers, self.server.firmware
+
+    def respond(self, status, payload, content_type, headers=None):
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(payload)))
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+        self.end_headers()
+        self.wfile.write(payload)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=4001)
+    parser.add_argument("--latency", type=float, default=0, help="milliseconds added to every response")
+    parser.add_argument("--jitter", type=float, default=0, help="up to this many milliseconds are randomly added")
+    parser.add_argument("--error-rate", type=float, default=0, help="probability (0-1) of answering with --error-status")
+    parser.add_argument("--error-status", type=int, default=500)
+    parser.add_argument("--endpoint", action="append", default=[], help="per route faults, /v1/event:latency=200,error-rate=0.1,status=503")
+    parser.add_argument("--firmware", help="binary served by /v1/update")
+    parser.add_argument("--next-check", type=int, help="seconds sent as the panic report's next_check hint")
+    parser.add_argument("--seed", type=int, default=0, help="seeds jitter and error injection, so runs are reproducible")
+    parser.add_argument("--no-inflate", action="store_true", help="doesn't advertise compression and answers deflated bodies with 415, like servers without it")
+    parser.add_argument("--verbose", action="store_true")
+    traffic = parser.add_mutually_exclusive_group()
+    traffic.add_argument("--record", help="appends every request and response to this JSON lines file")
+    traffic.add_argument("--replay", help="answers with the responses recorded in this JSON lines file")
+    return parser.parse_args()
+
+
+def interrupt(signum, frame):
+    raise KeyboardInterrupt
+
+
+def main():
+    options = parse_args()
+    # Stops gracefully when killed by a benchmark script too, printing the statistics
+    signal.signal(signal.SIGTERM, interrupt)
+    server = MonitorServer((options.host, options.port), options)
+    print(f"Monitor server stand-in listening on http://{options.host}:{options.port}")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.server_close()
+        if server.record:
+            server.record.close()
+        print(json.dumps(server.stats.summary(), indent=2))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""Generates src/portal.hpp from the captive portal assets in assets/portal.
+
+Every page variant (connected vs must connect, authenticated vs not) is minified and stored whole,
+so its size is known at compile time. CSS and JS are served from fingerprinted URLs, so browsers
+cache them forever and only the small form is downloaded on each visit.
+
+It runs automatically from build_flags.py when an asset changes, or manually:
+    python tools/portal.py [--stats]
+"""
+
+import gzip
+import hashlib
+import os
+import re
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.realpath(__file__)))
+ASSETS = os.path.join(ROOT, "assets", "portal")
+OUTPUT = os.path.join(ROOT, "src", "portal.hpp")
+
+# (function suffix, wifi fragment, iop fragment)
+VARIANTS = [
+    ("MustConnectNeedsAuth", "wifi.html", "iop.html"),
+    ("MustConnect", "wifi.html", "iop-overwrite.html"),
+    ("NeedsAuth", "wifi-overwrite.html", "iop.html"),
+    ("", "wifi-overwrite.html", "iop-overwrite.html"),
+]
+
+
+def read(name):
+    with open(os.path.join(ASSETS, name), encoding="utf-8") as asset:
+        return asset.read()
+
+
+def outside_strings(source, transform):
+    """Applies `transform` to the code, leaving quoted strings untouched"""
+    parts = re.split(r"""("(?:[^"\\]|\\.)*"|'(?:[^'\\]|\\.)*')""", source)
+    return "".join(part if index % 2 else transform(part) for index, part in enumerate(parts))
+
+
+def minify_html(source):
+    source = re.sub(r">\s+<", "><", source.strip())
+    return source.replace(" />", ">")
+
+
+def minify_css(source):
+    source = re.sub(r"\s+", " ", source.strip())
+    source = re.sub(r"\s*([{}:;,])\s*", r"\1", source)
+    return source.replace(";}", "}")
+
+
+def minify_js(source):
+    source = "".join(line.strip() for line in source.splitlines())
+    return outside_strings(source, lambda code: re.sub(r"\s*(=>|===|=|,|\{|\}|\(|\))\s*", r"\1", code))
+
+
+def fingerprint(content):
+    return hashlib.sha256(content.encode("utf-8")).hexdigest()[:8]
+
+
+def c_string(content, indent="    "):
+    escaped = content.replace("\\", "\\\\").replace('"', '\\"')
+    chunks = [escaped[index:index + 100] for index in range(0, len(escaped), 100)]
+    return "\n".join(f'{indent}"{chunk}"' for chunk in chunks)
+
+
+def build():
+    css = minify_css(read("style.css"))
+    js = minify_js(read("script.js"))
+    css_path = f"/portal.{fingerprint(css)}.css"
+    js_path = f"/portal.{fingerprint(js)}.js"
+
+    start = minify_html(read("start.html").replace("{{css}}", css_path))
+    end = minify_html(read("end.html").replace("{{js}}", js_path))
+
+    pages = []
+    for suffix, wifi, iop in VARIANTS:
+        page = start + minify_html(read(wifi)) + minify_html(read(iop)) + end
+        pages.append((suffix, page))
+    return css_path, css, js_path, js, pages
+
+
+def render(css_path, css, js_path, js, pages):
+    out = [
+        "// Generated by tools/portal.py from assets/portal, do not edit",
+        "#ifndef IOP_PORTAL_HPP",
+        "#define IOP_PORTAL_HPP",
+        "",
+        '#include "iop-hal/string.hpp"',
+        "",
+        "namespace iop {",
+        "namespace portal {",
+    ]
+
+    def asset(name, content, path=None):
+        out.append(f"constexpr static size_t {name}Length = {len(content.encode('utf-8'))};")
+        if path:
+            # Only the fingerprinted assets are cached, pages change with the device's state
+            out.append(f'static auto {name}ETag() -> iop::StaticString {{ return IOP_STR("\\"{fingerprint(content)}\\""); }}')
+            out.append(f'static auto {name}Path() -> iop::StaticString {{ return IOP_STR("{path}"); }}')
+        out.append(f"static auto {name}() -> iop::StaticString {{")
+        out.append("  return IOP_STR(")
+        out.append(c_string(content))
+        out.append("  );")
+        out.append("}")
+        out.append("")
+
+    out.append("")
+    asset("css", css, css_path)
+    asset("script", js, js_path)
+    for suffix, page in pages:
+        asset(f"page{suffix}", page)
+
+    out += ["}", "}", "#endif", ""]
+    return "\n".join(out)
+
+
+def stats(css, js, pages):
+    original = sum(len(read(name)) for name in ("start.html", "end.html", "style.css", "script.js"))
+    print(f"css: {len(css)} bytes ({len(gzip.compress(css.encode()))} gzipped)")
+    print(f"js: {len(js)} bytes ({len(gzip.compress(js.encode()))} gzipped)")
+    for suffix, page in pages:
+        print(f"page{suffix}: {len(page)} bytes ({len(gzip.compress(page.encode()))} gzipped)")
+    print(f"shared assets before minification: {original} bytes")
+
+
+def is_stale():
+    if not os.path.exists(OUTPUT):
+        return True
+    generated = os.path.getmtime(OUTPUT)
+    sources = [os.path.join(ASSETS, name) for name in os.listdir(ASSETS)] + [os.path.realpath(__file__)]
+    return any(os.path.getmtime(source) > generated for source in sources)
+
+
+def generate(force=False):
+    if not force and not is_stale():
+        return False
+    css_path, css, js_path, js, pages = build()
+    with open(OUTPUT, "w", encoding="utf-8") as output:
+        output.write(render(css_path, css, js_path, js, pages))
+    return True
+
+
+if __name__ == "__main__":
+    generate(force=True)
+    if "--stats" in sys.argv:
+        _, css, _, js, pages = build()
+        stats(css, js, pages)
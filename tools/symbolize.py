@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Symbolizes the raw stack window of a crash report sent to /v1/panic.
+
+Usage:
+    python tools/symbolize.py firmware.elf report.json
+    python tools/symbolize.py firmware.elf 0x40201234 0x40105678 ...
+
+The report is the JSON payload sent by `Api::reportPanic` (or a file containing it).
+The ELF must be the exact build that crashed, PlatformIO leaves it at `.pio/build/<env>/firmware.elf`.
+"""
+
+import json
+import os
+import shutil
+import subprocess
+import sys
+
+# Machine field of the ELF header, used to pick the right toolchain
+EM_XTENSA = 94
+
+# Executable regions, anything else in the stack window is data
+CODE_REGIONS = {
+    "esp8266": [(0x40100000, 0x40110000), (0x40200000, 0x40300000)],
+    "esp32": [(0x40000000, 0x40400000), (0x400C2000, 0x40C00000)],
+}
+
+
+def elf_machine(path):
+    with open(path, "rb") as elf:
+        header = elf.read(20)
+    if header[:4] != b"\x7fELF":
+        sys.exit(f"{path} is not an ELF file")
+    endianness = "little" if header[5] == 1 else "big"
+    return int.from_bytes(header[18:20], endianness)
+
+
+def find_addr2line(elf):
+    if elf_machine(elf) != EM_XTENSA:
+        return "addr2line", None
+
+    for chip, prefix in (("esp8266", "xtensa-lx106-elf"), ("esp32", "xtensa-esp32-elf")):
+        name = f"{prefix}-addr2line"
+        if shutil.which(name):
+            return name, chip
+        # PlatformIO doesn't add its toolchains to PATH
+        packages = os.path.expanduser(os.path.join("~", ".platformio", "packages", f"toolchain-{prefix.replace('-elf', '')}", "bin", name))
+        if os.path.exists(packages):
+            return packages, chip
+    sys.exit("Unable to find xtensa addr2line, install the toolchain or add it to PATH")
+
+
+def parse_addresses(args):
+    if len(args) == 1 and not args[0].startswith("0x"):
+        with open(args[0]) as report_file:
+            report = json.load(report_file)
+        print(f"{report.get('reset_reason', 'PANIC')} at {report.get('file')}:{report.get('line')} {report.get('func')}")
+        print(f"Message: {report.get('msg')}")
+        print(f"Uptime: {report.get('uptime', 0)} ms, stack pointer: 0x{report.get('stack_pointer', 0):08x}")
+        words = report.get("stack", "").split()
+    else:
+        words = args
+    return [int(word, 16) for word in words]
+
+
+def is_code(address, chip):
+    if chip is None:
+        return address != 0
+    return any(start <= address < end for start, end in CODE_REGIONS[chip])
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(__doc__)
+
+    elf = sys.argv[1]
+    addr2line, chip = find_addr2line(elf)
+    addresses = [address for address in parse_addresses(sys.argv[2:]) if is_code(address, chip)]
+    if not addresses:
+        print("No code addresses found in the stack window")
+        return
+
+    output = subprocess.run(
+        [addr2line, "-pfiaC", "-e", elf] + [f"0x{address:08x}" for address in addresses],
+        check=True, capture_output=True, text=True,
+    )
+    print(output.stdout, end="")
+
+
+if __name__ == "__main__":
+    main()